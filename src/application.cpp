@@ -2,6 +2,7 @@
 // std
 #include <algorithm>
 #include <chrono>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -15,7 +16,6 @@
 #include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <glm/gtc/random.hpp>
 
 // stb
 #include <stb_image_write.h>
@@ -30,6 +30,11 @@
 #include "application.hpp"
 #include "cgra/cgra_gui.hpp"
 #include "cgra/cgra_shader.hpp"
+#include "scene/light.hpp"
+#include "scene/material.hpp"
+#include "scene/scene_file.hpp"
+#include "render/random.hpp"
+#include "render/renderer.hpp"
 
 
 using namespace std;
@@ -56,6 +61,23 @@ namespace {
 	inline vec3 reject(const vec3 &v, const vec3 &n) {
 		return v - project(v, n);
 	}
+
+	// render threads, and which one this is
+	inline int thread_count() {
+#ifdef CGRA_HAVE_OPENMP
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif // CGRA_HAVE_OPENMP
+	}
+
+	inline int thread_index() {
+#ifdef CGRA_HAVE_OPENMP
+		return omp_get_thread_num();
+#else
+		return 0;
+#endif // CGRA_HAVE_OPENMP
+	}
 }
 
 Application::Application(GLFWwindow *win) : m_window(win) {
@@ -63,7 +85,7 @@ Application::Application(GLFWwindow *win) : m_window(win) {
 	m_camera = std::make_unique<Camera>();
 
 	// setup default pathtracer
-	m_pathtracer = std::make_unique<SimplePathTracer>(&m_scene);
+	m_pathtracer = std::make_shared<SimplePathTracer>(m_scene.get());
 
 	// start at same size as window to minimize aliasing
 	int w = 0, h = 0;
@@ -88,24 +110,14 @@ Application::Application(GLFWwindow *win) : m_window(win) {
 
 	// setup textures
 	// using nearest to avoid upscaling problems with pixel time filtering
-	// texture 0
-	glGenTextures(1, &m_render_texture_back);
+	// render texture, updated a tile at a time
+	glGenTextures(1, &m_render_texture);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_render_texture_back);
+	glBindTexture(GL_TEXTURE_2D, m_render_texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_render_width, m_render_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-	// texture 1
-	glGenTextures(1, &m_render_texture_front);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_render_texture_front);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_render_width, m_render_height, 0, GL_RGBA, GL_FLOAT, nullptr);
 	// filtered texture
 	glGenTextures(1, &m_render_texture_filtered);
 	glActiveTexture(GL_TEXTURE0);
@@ -125,10 +137,9 @@ Application::Application(GLFWwindow *win) : m_window(win) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, m_render_width, m_render_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-	// pbo
-	glGenBuffers(1, &m_render_pbo);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_render_pbo);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	// pbos, persistently mapped if buffer storage is supported
+	glGenBuffers(upload_ring_size, m_upload_pbo);
+	m_persistent_upload = GLEW_ARB_buffer_storage;
 	// fbo
 	glGenFramebuffers(1, &m_render_fbo);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_render_fbo);
@@ -150,9 +161,11 @@ Application::Application(GLFWwindow *win) : m_window(win) {
 Application::~Application() {
 	glDeleteProgram(m_filter_prog);
 	glDeleteProgram(m_display_prog);
-	glDeleteTextures(1, &m_render_texture_back);
-	glDeleteTextures(1, &m_render_texture_front);
-	glDeleteBuffers(1, &m_render_pbo);
+	glDeleteTextures(1, &m_render_texture);
+	for (GLsync &fence : m_upload_fence) {
+		if (fence) glDeleteSync(fence);
+	}
+	glDeleteBuffers(upload_ring_size, m_upload_pbo);
 	glDeleteFramebuffers(1, &m_render_fbo);
 	m_should_exit = true;
 	m_raytrace_thread.join();
@@ -190,48 +203,48 @@ void Application::render() {
 
 	// update camera
 	updateCameraMovement(width, height);
+	updateScene();
 	if (m_restart_render) start();
 
 	glActiveTexture(GL_TEXTURE0);
 
-	// swap front and back render textures and upload the cpu-side
-	// pixel data through m_render_pbo to m_render_texture_back
-	// iif previous upload complete
-	if (!m_sync_render_texture || glClientWaitSync(m_sync_render_texture, 0, 0) == GL_ALREADY_SIGNALED) {
-		if (m_sync_render_texture) glDeleteSync(m_sync_render_texture);
-		m_sync_render_texture = nullptr;
-
-		// swap buffers (start displaying previous upload)
-		swap(m_render_texture_back, m_render_texture_front);
-
-		// upload new data, use pbo for async
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_render_pbo);
-		glBufferData(GL_PIXEL_UNPACK_BUFFER, m_render_data.size() * sizeof(pixel), nullptr, GL_STREAM_DRAW);
-		auto *pbodata = reinterpret_cast<pixel *>(glMapBufferRange(
-			GL_PIXEL_UNPACK_BUFFER,
-			0,
-			m_render_data.size() * sizeof(pixel),
-			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
-		));
-		copy(m_render_data.begin(), m_render_data.end(), pbodata);
-		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-		glBindTexture(GL_TEXTURE_2D, m_render_texture_back);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_render_width, m_render_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-
-		// fence so we know when upload finishes
-		m_sync_render_texture = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-
+	// show the denoised image or an aov instead if requested, the render
+	// threads can be writing the color and denoised pixels as they are read
+	function<void(size_t, size_t, pixel *)> display = [this](size_t first, size_t count, pixel *out) { m_render_data.read(first, count, out); };
+	int display_source = 0;
+	// aovs are shown from a copy the render thread takes between passes
+	// (or taken here if nothing is rendering)
+	const int shown_aov = m_display_aov;
+	bool show_aov = false;
+	if (shown_aov >= 0 && m_aov_buffer.enabled(AOV(shown_aov))) {
+		lock_guard<mutex> guard(m_save_lock);
+		if (!m_raytrace_thread.joinable() || m_should_exit) snapshotAOV();
+		show_aov = m_aov_snapshot.enabled(AOV(shown_aov)) && m_aov_snapshot.width() == m_render_width && m_aov_snapshot.height() == m_render_height;
+		if (show_aov) visualizeAOV(AOV(shown_aov));
+	}
+	if (show_aov) {
+		display = [this](size_t first, size_t count, pixel *out) { copy_n(m_aov_display_data.begin() + first, count, out); };
+		display_source = 2;
+	} else if (m_denoise && m_denoised_valid) {
+		display = [this](size_t first, size_t count, pixel *out) { m_denoised_data.read(first, count, out); };
+		display_source = 1;
 	}
 
-	// filter m_render_texture_front to m_render_texture_filtered
+	// aovs are visualized from scratch every frame, and switching what is
+	// shown changes every pixel, otherwise only the tiles written since
+	// the last frame are uploaded
+	if (display_source == 2 || display_source != m_display_source) m_dirty_tiles.markAll();
+	m_display_source = display_source;
+	uploadTiles(display);
+
+	// filter m_render_texture to m_render_texture_filtered
 	// reconstructs out of date pixel data based on timestamp
 	glBindTexture(GL_TEXTURE_2D, m_render_texture_filtered);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_render_width, m_render_height, 0, GL_RGBA, GL_FLOAT, nullptr);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_render_fbo);
 	glViewport(0, 0, m_render_width, m_render_height);
 	glUseProgram(m_filter_prog);
-	glBindTexture(GL_TEXTURE_2D, m_render_texture_front);
+	glBindTexture(GL_TEXTURE_2D, m_render_texture);
 	glUniform1i(glGetUniformLocation(m_filter_prog, "uTexture0"), 0);
 	glUniform1f(glGetUniformLocation(m_filter_prog, "uFrameTime"), m_frame_time);
 	draw_dummy();
@@ -268,6 +281,99 @@ void Application::render() {
 }
 
 
+void Application::uploadTiles(const function<void(size_t, size_t, pixel *)> &read) {
+	const auto time_begin = chrono::steady_clock::now();
+	const size_t n = size_t(m_render_width) * m_render_height;
+
+	// the texture and the ring are only reallocated when the size changes
+	if (m_upload_capacity != n) {
+		for (int r = 0; r < upload_ring_size; r++) {
+			if (m_upload_fence[r]) glDeleteSync(m_upload_fence[r]);
+			m_upload_fence[r] = nullptr;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo[r]);
+			if (m_persistent_upload) {
+				// buffer storage is immutable, so a new buffer
+				glDeleteBuffers(1, &m_upload_pbo[r]);
+				glGenBuffers(1, &m_upload_pbo[r]);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo[r]);
+				const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+				glBufferStorage(GL_PIXEL_UNPACK_BUFFER, n * sizeof(pixel), nullptr, flags);
+				m_upload_mapped[r] = reinterpret_cast<pixel *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, n * sizeof(pixel), flags));
+			} else {
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, n * sizeof(pixel), nullptr, GL_STREAM_DRAW);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, m_render_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_render_width, m_render_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+		m_upload_capacity = n;
+		m_dirty_tiles.markAll();
+	}
+
+	// the next pbo of the ring, unless the gpu is still reading it (then
+	// the tiles stay marked until next frame)
+	const int slot = m_upload_slot;
+	if (m_upload_fence[slot]) {
+		if (glClientWaitSync(m_upload_fence[slot], 0, 0) == GL_TIMEOUT_EXPIRED) return;
+		glDeleteSync(m_upload_fence[slot]);
+		m_upload_fence[slot] = nullptr;
+	}
+
+	m_dirty_tiles.collect(m_upload_tiles);
+	m_upload_tile_count = int(m_upload_tiles.size());
+	m_upload_bytes = 0;
+	if (m_upload_tiles.empty()) {
+		m_upload_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+		return;
+	}
+
+	// most of the image changed, so one copy of all of it
+	const bool whole = m_upload_tiles.size() * 2 > size_t(m_dirty_tiles.tiles());
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo[slot]);
+	pixel *dst = m_upload_mapped[slot];
+	if (!m_persistent_upload) {
+		// the fence has passed, so no need to synchronize
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+		dst = reinterpret_cast<pixel *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, n * sizeof(pixel), flags));
+	}
+
+	glBindTexture(GL_TEXTURE_2D, m_render_texture);
+	if (whole) {
+		read(0, n, dst);
+		if (!m_persistent_upload) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_render_width, m_render_height, GL_RGBA, GL_FLOAT, nullptr);
+		m_upload_bytes = n * sizeof(pixel);
+	} else {
+		// tiles packed one after another
+		size_t offset = 0;
+		for (int t : m_upload_tiles) {
+			int x, y, w, h;
+			m_dirty_tiles.rect(t, x, y, w, h);
+			for (int row = 0; row < h; row++) {
+				read(x + size_t(y + row) * m_render_width, w, dst + offset + size_t(row) * w);
+			}
+			offset += size_t(w) * h;
+		}
+		if (!m_persistent_upload) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		offset = 0;
+		for (int t : m_upload_tiles) {
+			int x, y, w, h;
+			m_dirty_tiles.rect(t, x, y, w, h);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_FLOAT, reinterpret_cast<void *>(offset * sizeof(pixel)));
+			offset += size_t(w) * h;
+		}
+		m_upload_bytes = offset * sizeof(pixel);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	m_upload_fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_upload_slot = (slot + 1) % upload_ring_size;
+	m_upload_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+}
+
+
 void Application::renderGUI() {
 
 	// progress bars and total duration
@@ -292,6 +398,9 @@ void Application::renderGUI() {
 	oss << "Duration : " << std::fixed << std::setprecision(2) << duration << " seconds";
 	ImGui::Text(oss.str().c_str());
 
+	// main thread time and bytes sent to the gpu for the last display frame
+	ImGui::Text("Upload : %.2f ms, %.2f MB (%d tiles)", m_upload_time, m_upload_bytes / (1024.0 * 1024.0), m_upload_tile_count);
+
 	ImGui::Separator();
 	
 	ImGui::Text("Display");
@@ -304,35 +413,94 @@ void Application::renderGUI() {
 		m_restart_render = true;
 	}
 
+	// preview frames trace as much as fits in the frame time
+	if (ImGui::SliderInt("Preview rate (Hz)", &m_frame_rate, 10, 120)) {
+		m_frame_scheduler.setBudget(1000.f / m_frame_rate);
+	}
+	if (m_preview_mode) {
+		ImGui::Text("  Frame : %.1f / %.1f / %.1f ms (p50/p95/p99, target %.1f)", m_frame_scheduler.percentile(50), m_frame_scheduler.percentile(95), m_frame_scheduler.percentile(99), m_frame_scheduler.budget());
+		const float coverage = m_frame_scheduler.coverage();
+		if (coverage > 1) ImGui::Text("  Traced : %.0f passes per frame", coverage);
+		else ImGui::Text("  Traced : %.0f%% of pixels per frame", coverage * 100);
+	}
+
+	// scenes are built in the background, the current one keeps rendering until then
 	static int scene_index = -1;
 	if (ImGui::Combo("Scene", &scene_index, "Simple Test\0Light Test\0Material Test\0Shape Test\0Cornell Box\0", 4)) {
-		stop();
-		switch (scene_index) {
-		case 0: m_scene = Scene::simpleScene(); break;
-		case 1: m_scene = Scene::lightScene(); break;
-		case 2: m_scene = Scene::materialScene(); break;
-		case 3: m_scene = Scene::shapeScene(); break;
-		case 4: m_scene = Scene::cornellBoxScene(); break;
+		const int index = scene_index;
+		requestScene([index](SceneFile &file) {
+			file.scene = makeScene(index);
+			return true;
+		});
+	}
+
+	// scene from a file (through its binary cache)
+	static char scene_filename[1024] = "res/scenes/cornell_box.scene";
+	ImGui::InputText("##scene_file", scene_filename, 1024);
+	ImGui::SameLine();
+	if (ImGui::Button("Load")) {
+		const string filename = scene_filename;
+		requestScene([filename](SceneFile &file) {
+			return loadSceneFile(CGRA_WORKDIR + filename, file) || loadSceneFile(filename, file);
+		});
+		scene_index = -1;
+	}
+	if (m_scene_switching) {
+		ImGui::Text(m_scene_loader.busy() ? "Loading..." : "Switching...");
+	} else if (m_scene_load_time >= 0) {
+		ImGui::Text("Loaded in %.1f ms (%s), switched in %.1f ms", m_scene_load_time, m_scene_from_cache ? "cache" : "built", m_scene_switch_time);
+		ImGui::Text("Gui blocked : %.2f ms", m_scene_stall_time);
+	}
+
+	// a new integrator is swapped in the same way
+	if (ImGui::Combo("PathTracer", &m_pathtracer_index, "Simple\0Core\0Completion\0Challenge\0", 4)) {
+		const auto time_begin = chrono::steady_clock::now();
+		m_pathtracer = makePathTracer(m_pathtracer_index, m_scene.get());
+		m_scene_swap.publish({ m_scene, m_pathtracer });
+		m_scene_request_time = time_begin;
+		m_scene_switching = true;
+		m_scene_stall_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+	}
+
+	ImGui::SliderFloat("Exposure", &m_exposure, 0, 100.0, "%.1f", 3.f);
+
+	// aov to show instead of the color
+	{
+		const char *items[int(AOV::Count) + 1] = { "Color" };
+		for (int i = 0; i < int(AOV::Count); i++) items[i + 1] = AOVBuffer::name(AOV(i));
+		int display_index = m_display_aov + 1;
+		if (ImGui::Combo("Show", &display_index, items, int(AOV::Count) + 1)) {
+			m_display_aov = display_index - 1;
 		}
-		
-		m_restart_render = true;
-		start();
 	}
 
-	static int pathtracer_index = 0;
-	if (ImGui::Combo("PathTracer", &pathtracer_index, "Simple\0Core\0Completion\0Challenge\0", 4)) {
-		stop();
-		switch (pathtracer_index) {
-		case 0: m_pathtracer = make_unique<SimplePathTracer>(&m_scene); break;
-		case 1: m_pathtracer = make_unique<CorePathTracer>(&m_scene); break;
-		case 2: m_pathtracer = make_unique<CompletionPathTracer>(&m_scene); break;
-		case 3: m_pathtracer = make_unique<ChallengePathTracer>(&m_scene); break;
+	ImGui::Checkbox("Progressive preview", &m_progressive);
+	if (m_progressive && m_preview_mode) {
+		// time taken to cover the whole image at each resolution
+		const char *names[preview_levels] = { "1/64", "1/16", "1/4", "Full" };
+		for (int l = 0; l < preview_levels; l++) {
+			if (m_coverage_time[l] > 0) ImGui::Text("  %s coverage : %.1f ms", names[l], m_coverage_time[l]);
+			else ImGui::Text("  %s coverage : -", names[l]);
 		}
-		m_restart_render = true;
-		start();
 	}
 
-	ImGui::SliderFloat("Exposure", &m_exposure, 0, 100.0, "%.1f", 3.f);
+	// fewer tiles to upload while a still render is in progress
+	ImGui::Checkbox("Render in tile order", &m_tile_order);
+
+	ImGui::Checkbox("Reproject preview", &m_reproject);
+	if (m_reproject && m_preview_mode) {
+		ImGui::SameLine();
+		ImGui::Text("%.0f%% kept", m_reproject_kept * 100);
+	}
+
+	if (ImGui::Checkbox("Denoise", &m_denoise) && m_denoise && m_should_exit) {
+		// render already finished, denoise what we have
+		denoise();
+	}
+	if (m_denoise) {
+		ImGui::SameLine();
+		ImGui::Text("%.1f ms", m_denoise_time);
+	}
 
 
 	// screen shots
@@ -340,10 +508,37 @@ void Application::renderGUI() {
 	if (ImGui::Button("Screenshot")) {
 		ImGui::OpenPopup("Save As");
 	}
+	if (m_image_writer.busy()) {
+		ImGui::SameLine();
+		ImGui::Text("Saving...");
+	} else if (m_image_writer.writeTime() > 0) {
+		ImGui::SameLine();
+		ImGui::Text("Saved (%.0f ms)", m_image_writer.writeTime());
+	}
 	if (ImGui::BeginPopup("Save As")) {
+		static int format = 0;
 		ImGui::InputText("Filename", filename, 1024);
+		ImGui::Combo("Format", &format, "PNG (display)\0EXR\0PFM\0", 3);
+		if (format > 0) {
+			// written from the linear float buffers, no gl involved
+			bool full_float = m_image_options.exr.type == EXRPixelType::Float;
+			ImGui::Checkbox("AOVs", &m_image_options.aovs);
+			if (format == 1) {
+				ImGui::Checkbox("Float", &full_float);
+				ImGui::SameLine();
+				ImGui::Checkbox("Compress", &m_image_options.exr.compress);
+				ImGui::SameLine();
+				ImGui::Checkbox("Multi-part", &m_image_options.multipart);
+			}
+			m_image_options.exr.type = full_float ? EXRPixelType::Float : EXRPixelType::Half;
+		}
 		if (ImGui::Button("Save")) {
-			screenshot(filename);
+			if (format == 0) {
+				screenshot(filename);
+			} else {
+				m_image_options.format = (format == 1) ? ImageFormat::EXR : ImageFormat::PFM;
+				saveImage(filename, m_image_options);
+			}
 			ImGui::CloseCurrentPopup();
 		}
 		ImGui::SameLine();
@@ -362,24 +557,225 @@ void Application::renderGUI() {
 	static int size[2] = { m_render_width, m_render_height };
 	static float samples = float(m_render_perpixel_samples);
 	static int ray_depth = m_render_ray_depth;
+	static bool deterministic = m_deterministic;
+	static int seed = m_render_seed;
+	static int precision = int(m_accumulation_precision);
 
 	ImGui::InputInt2("Size (w,h)", size);
 	ImGui::SliderFloat("Samples", &samples, 1, 10000, "%.0f", 5.f);
 	ImGui::SliderInt("Ray depth", &ray_depth, 0, 10);
+	ImGui::Checkbox("Deterministic", &deterministic);
+	if (deterministic) {
+		ImGui::SameLine();
+		ImGui::InputInt("Seed", &seed);
+	}
+	ImGui::Combo("Accumulation", &precision, "Float\0Kahan\0Double\0", 3);
+
+	ImGui::Checkbox("Cache primary hits", &m_use_hit_cache);
+	if (m_use_hit_cache) {
+		ImGui::SliderInt("Cached samples", &m_hit_cache_samples, 1, 16);
+		ImGui::Text("Hit cache : %d samples, %.1f MB", m_hit_cache.validSamples(), m_hit_cache.bytes() / (1024.0 * 1024.0));
+	}
+
+	if (ImGui::TreeNode("AOVs")) {
+		for (int i = 0; i < int(AOV::Count); i++) {
+			ImGui::CheckboxFlags(AOVBuffer::name(AOV(i)), &m_aov_mask, AOVBuffer::bit(AOV(i)));
+		}
+		ImGui::TreePop();
+	}
 
 	if (ImGui::Button("Force Restart", ImVec2(-1, 0))) {
 		stop();
 		resize(size[0], size[1]);
 		m_render_perpixel_samples = int(samples);
 		m_render_ray_depth = ray_depth;
+		m_deterministic = deterministic;
+		m_render_seed = seed;
+		m_accumulation_precision = AccumulationPrecision(precision);
+		m_accumulation.resize(m_render_width, m_render_height, m_accumulation_precision);
 		start();
 	}
 
+	// checkpoints
+	static char checkpoint_filename[1024] = "render.checkpoint";
+	if (ImGui::InputText("Checkpoint file", checkpoint_filename, 1024)) {
+		m_checkpoint_filename = checkpoint_filename;
+	}
+	ImGui::Checkbox("Checkpoint", &m_checkpoint);
+	if (m_checkpoint) {
+		ImGui::SameLine();
+		ImGui::SliderFloat("Interval (s)", &m_checkpoint_interval, 5, 600, "%.0f");
+		if (m_checkpoint_passes > 0) {
+			ImGui::Text("Saved %d passes (%.0f ms)", int(m_checkpoint_passes), m_checkpoint_writer.writeTime());
+		}
+	}
+	if (ImGui::Button("Resume", ImVec2(-1, 0)) && resume(m_checkpoint_filename)) {
+		size[0] = m_render_width;
+		size[1] = m_render_height;
+		samples = float(m_render_perpixel_samples);
+		ray_depth = m_render_ray_depth;
+		deterministic = m_deterministic;
+		seed = m_render_seed;
+	}
+
+
+	ImGui::Separator();
+
+	ImGui::Text("Scene Edit");
+
+	// editing materials/lights keeps the camera, so the hit cache stays valid
+	auto materials = m_scene->materials();
+	if (!materials.empty()) {
+		static int material_index = 0;
+		material_index = std::clamp(material_index, 0, int(materials.size()) - 1);
+		ImGui::SliderInt("Material", &material_index, 0, int(materials.size()) - 1);
+
+		Material &m = *materials[material_index];
+		vec3 diffuse = m.diffuse(), specular = m.specular();
+		float shininess = m.shininess();
+		bool changed = ImGui::ColorEdit3("Diffuse", value_ptr(diffuse));
+		changed |= ImGui::ColorEdit3("Specular", value_ptr(specular));
+		changed |= ImGui::DragFloat("Shininess", &shininess, 0.5f, 1, 10000, "%.1f", 3.f);
+		if (changed) {
+			stop();
+			m.setDiffuse(diffuse);
+			m.setSpecular(specular);
+			m.setShininess(shininess);
+			restartAfterEdit();
+		}
+	}
+
+	auto lights = m_scene->lights();
+	if (!lights.empty()) {
+		static int light_index = 0;
+		light_index = std::clamp(light_index, 0, int(lights.size()) - 1);
+		ImGui::SliderInt("Light", &light_index, 0, int(lights.size()) - 1);
+
+		Light &l = *lights[light_index];
+		vec3 intensity = l.intensity();
+		if (ImGui::DragFloat3("Intensity", value_ptr(intensity), 0.1f, 0, 1000)) {
+			stop();
+			l.setIntensity(intensity);
+			restartAfterEdit();
+		}
+	}
+
+	if (m_reshade_latency > 0) {
+		ImGui::Text("Edit to first frame : %.1f ms (%s)", m_reshade_latency, m_reshade_cached ? "cached hits" : "traced");
+	}
 
 	ImGui::End();
 }
 
 
+void Application::restartAfterEdit() {
+	resetHistory();
+	m_reshade = true;
+	m_edit_time = chrono::steady_clock::now();
+	m_restart_render = true;
+	start();
+}
+
+
+void Application::requestScene(function<bool(SceneFile &)> build) {
+	const auto time_begin = chrono::steady_clock::now();
+	m_scene_loader.load(move(build));
+	m_scene_request_time = time_begin;
+	m_scene_switching = true;
+	m_scene_stall_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+}
+
+
+void Application::updateScene() {
+	const auto time_begin = chrono::steady_clock::now();
+
+	LoadedScene loaded;
+	if (m_scene_loader.poll(loaded)) {
+		m_scene_load_time = loaded.load_time;
+		m_scene_from_cache = loaded.from_cache;
+		if (loaded.scene) {
+			// the gui edits the new scene from now on, the render thread
+			// keeps its handle to the old one until it swaps
+			m_scene = loaded.scene;
+			m_pathtracer = makePathTracer(m_pathtracer_index, m_scene.get());
+			if (loaded.has_camera) m_camera->setPositionOrientation(loaded.camera_position, loaded.camera_yaw, loaded.camera_pitch);
+			m_scene_swap.publish({ m_scene, m_pathtracer });
+		} else {
+			cerr << "Error: Failed to load scene" << endl;
+		}
+	}
+
+	// a finished render has no passes left to swap between
+	if (m_scene_swap.pending() && m_should_exit) {
+		stop();
+		// a new integrator for the same scene keeps the cached hits
+		if (m_render_scene != m_scene.get()) {
+			m_hit_cache.invalidate();
+			resetHistory();
+		}
+		m_restart_render = true;
+		start();
+	}
+
+	if (m_scene_switching) {
+		m_scene_stall_time = std::max(m_scene_stall_time, float((chrono::steady_clock::now() - time_begin) / 1.0ms));
+		if (!m_scene_loader.busy() && !m_scene_swap.pending()) {
+			m_scene_switching = false;
+			m_scene_switch_time = float((chrono::steady_clock::now() - m_scene_request_time) / 1.0ms);
+		}
+	}
+}
+
+
+bool Application::resume(const string &filename) {
+	Checkpoint checkpoint;
+	if (!checkpoint.open(filename)) {
+		cerr << "Error: Failed to open checkpoint " << filename << endl;
+		return false;
+	}
+	const CheckpointState &state = checkpoint.state();
+	if (state.scene_objects != int(m_scene->objects().size()) || state.scene_lights != int(m_scene->lights().size())) {
+		cerr << "Error: Checkpoint " << filename << " was rendered from a different scene" << endl;
+		return false;
+	}
+
+	stop();
+
+	// render settings and view of the checkpoint
+	m_preview_mode = false;
+	glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+	resize(state.width, state.height);
+	m_render_perpixel_samples = state.target_samples;
+	m_render_ray_depth = state.ray_depth;
+	m_deterministic = state.deterministic;
+	m_render_seed = state.seed;
+	m_camera->setPositionOrientation(state.camera_position, state.camera_yaw, state.camera_pitch);
+
+	// copy the buffers out of the mapping
+	const size_t n = m_render_data.size();
+	const float *color = checkpoint.color();
+	for (size_t i = 0; i < n; i++) {
+		m_render_data.write(int(i), { color[4 * i], color[4 * i + 1], color[4 * i + 2], m_frame_time });
+	}
+	copy(checkpoint.moment(), checkpoint.moment() + n, m_render_moment.begin());
+	m_dirty_tiles.markAll();
+
+	// the sums carry on exactly where the checkpoint left them
+	m_accumulation.load(checkpoint.sums(), checkpoint.weights(), checkpoint.counts());
+	// the guides forced on for denoising or reprojection stay out of the selection
+	m_aov_mask = state.user_aov_mask;
+	m_aov_buffer.resize(state.width, state.height, state.aov_mask);
+	if (m_aov_buffer.size() == checkpoint.aovFloats()) {
+		copy(checkpoint.aovs(), checkpoint.aovs() + checkpoint.aovFloats(), m_aov_buffer.data());
+	}
+
+	m_resume_pass = state.passes;
+	m_checkpoint_passes = state.passes;
+	start();
+	return true;
+}
+
+
 void Application::updateCameraMovement(int w, int h) {
 	m_restart_render = false;
 
@@ -469,6 +865,37 @@ void Application::screenshot(const std::string &filename) {
 }
 
 
+void Application::visualizeAOV(AOV a) {
+	const size_t n = m_render_data.size();
+	m_aov_display_data.resize(n);
+
+	// find the range of depths for normalizing
+	float max_depth = 0;
+	if (a == AOV::Depth) {
+		const float *d = m_aov_snapshot.plane(a);
+		for (size_t i = 0; i < n; i++) max_depth = std::max(max_depth, d[i]);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		vec3 c(0);
+		if (AOVBuffer::channels(a) == 3) {
+			c = vec3(m_aov_snapshot.plane(a, 0)[i], m_aov_snapshot.plane(a, 1)[i], m_aov_snapshot.plane(a, 2)[i]);
+			// normals are remapped from [-1, 1]
+			if (a == AOV::Normal) c = c * 0.5f + 0.5f;
+		} else if (a == AOV::Depth) {
+			c = vec3(m_aov_snapshot.plane(a)[i] / std::max(max_depth, 1e-6f));
+		} else {
+			// ids get a pseudo-random color
+			float id = m_aov_snapshot.plane(a)[i];
+			if (id >= 0) c = fract(sin(vec3(id + 1) * vec3(12.9898f, 78.233f, 37.719f)) * 43758.5453f);
+		}
+		// exposure is applied in the display shader, undo it here so the aov shows as-is
+		c = -log(1.f - clamp(c, 0.f, 0.999f)) / std::max(m_exposure, 1e-3f);
+		m_aov_display_data[i] = { c.r, c.g, c.b, m_render_data.read(int(i)).time };
+	}
+}
+
+
 void Application::resize(int w, int h) {
 	// set values (if changed)
 	if (m_render_width != w || m_render_height != h) {
@@ -480,11 +907,51 @@ void Application::resize(int w, int h) {
 		// setup shuffle table
 		m_shuffle_table.resize(w * h);
 		std::iota(m_shuffle_table.begin(), m_shuffle_table.end(), 0);
-		std::shuffle(m_shuffle_table.begin(), m_shuffle_table.end(), minstd_rand());
+		std::shuffle(m_shuffle_table.begin(), m_shuffle_table.end(), PCG32());
+
+		// setup pyramid table, the same shuffle but grouped by level
+		// level 0 : every 8th pixel, level 1 : every 4th, level 2 : every 2nd, level 3 : the rest
+		auto level = [w](int idx) {
+			int x = idx % w, y = idx / w;
+			for (int l = 0; l < preview_levels - 1; l++) {
+				int step = 1 << (preview_levels - 1 - l);
+				if (x % step == 0 && y % step == 0) return l;
+			}
+			return preview_levels - 1;
+		};
+		m_pyramid_table.clear();
+		for (int l = 0; l < preview_levels; l++) {
+			for (int idx : m_shuffle_table) {
+				if (level(idx) == l) m_pyramid_table.push_back(idx);
+			}
+			m_pyramid_level_end[l] = int(m_pyramid_table.size());
+		}
+		m_fill_stamp = vector<atomic<int>>(w * h);
+		for (atomic<int> &stamp : m_fill_stamp) stamp = -1;
+
+		// setup tile table, the same shuffle grouped by the tiles of
+		// m_dirty_tiles (in shuffled order) so a partial pass only
+		// changes a few tiles
+		const int tile = DirtyTiles::default_tile_size, tiles_x = (w + tile - 1) / tile;
+		const int tiles = tiles_x * ((h + tile - 1) / tile);
+		vector<int> tile_rank(tiles), tile_start(tiles + 1, 0);
+		std::iota(tile_rank.begin(), tile_rank.end(), 0);
+		std::shuffle(tile_rank.begin(), tile_rank.end(), PCG32());
+		auto rank = [&](int idx) { return tile_rank[(idx % w) / tile + (idx / w / tile) * tiles_x]; };
+		for (int idx : m_shuffle_table) tile_start[rank(idx) + 1]++;
+		std::partial_sum(tile_start.begin(), tile_start.end(), tile_start.begin());
+		m_tile_table.resize(w * h);
+		for (int idx : m_shuffle_table) m_tile_table[tile_start[rank(idx)]++] = idx;
 	}
 
 	// clear pixel data
-	m_render_data.assign(w*h, {});
+	m_render_data.resize(w*h);
+	m_render_moment.assign(w*h, 0);
+	m_dirty_tiles.resize(w, h);
+	m_accumulation.resize(w, h, m_accumulation_precision);
+	m_aov_buffer.resize(0, 0, 0);
+	m_hit_cache.invalidate();
+	resetHistory();
 }
 
 
@@ -498,11 +965,50 @@ void Application::start() {
 	}
 	// restarting the thread, so ensure image is the right size
 	// (but don't bother clearing it, shuffle index randomization means it basically isnt necessary)
-	m_render_data.resize(m_render_width * m_render_height);
+	if (m_render_data.size() != size_t(m_render_width * m_render_height)) m_render_data.resize(m_render_width * m_render_height);
+	m_render_moment.resize(m_render_data.size());
+	if (m_dirty_tiles.width() != m_render_width || m_dirty_tiles.height() != m_render_height) {
+		m_dirty_tiles.resize(m_render_width, m_render_height);
+	}
+	if (m_frame_scheduler.width() != m_render_width || m_frame_scheduler.height() != m_render_height) {
+		m_frame_scheduler.resize(m_render_width, m_render_height, thread_count());
+	}
+	if (m_accumulation.width() != m_render_width || m_accumulation.height() != m_render_height) {
+		m_accumulation.resize(m_render_width, m_render_height, m_accumulation_precision);
+	}
+	m_denoised_valid = false;
+
+	// the denoiser needs its guides
+	unsigned aov_mask = m_aov_mask;
+	if (m_denoise) aov_mask |= AOVBuffer::bit(AOV::Depth) | AOVBuffer::bit(AOV::Normal) | AOVBuffer::bit(AOV::Albedo);
+	// reprojection needs depth
+	if (m_reproject) aov_mask |= AOVBuffer::bit(AOV::Depth);
+	// a new mask keeps the planes already there (e.g. restored from a checkpoint)
+	if (m_aov_buffer.width() != m_render_width || m_aov_buffer.height() != m_render_height) {
+		m_aov_buffer.resize(m_render_width, m_render_height, aov_mask);
+	} else {
+		m_aov_buffer.setMask(aov_mask);
+	}
+
+	// the gui can change the filename while rendering
+	m_checkpoint_target = m_checkpoint_filename;
+
+	// the thread starts with the newest scene, so nothing is left to swap
+	m_scene_swap.clear();
+	const SceneHandle handle = { m_scene, m_pathtracer };
+
+	// the swap dropped above may have been to another scene than the one
+	// rendered last, whose hits are still in the cache
+	if (m_scene.get() != m_render_scene) {
+		m_hit_cache.invalidate();
+		resetHistory();
+	}
+	m_render_scene = m_scene.get();
+
 	m_should_exit = false;
 	m_sample_pass_count = 0;
 	m_sample_pixel_count = 0;
-	m_raytrace_thread = thread([this]() { runPathTraceIntegrator(); });
+	m_raytrace_thread = thread([this, handle]() { runPathTraceIntegrator(handle); });
 }
 
 void Application::stop() {
@@ -512,23 +1018,59 @@ void Application::stop() {
 
 
 
-void Application::runPathTraceIntegrator() {
+void Application::runPathTraceIntegrator(SceneHandle handle) {
 	
 	// was any rendering done in preview mode?
 	bool was_preview = false;
 
-	// count 'idle' preview frames so we can exit instead of spinning uselessly
-	int idle_preview_frames = 0;
-	int preview_frames = 0;
+	// count 'idle' preview passes so we can exit instead of spinning uselessly
+	int idle_preview_passes = 0;
+
+	// preview frames are planned to the frame budget, each continues the
+	// pixel order where the last one stopped unless the view changed
+	// (passes of the order are counted to vary which pixels come first)
+	int preview_cursor = 0;
+	int preview_pass = 0;
+	bool preview_view_valid = false;
+	struct { vec3 position; float yaw, pitch; } preview_view{ vec3(0), 0, 0 };
+	auto pass_start = chrono::steady_clock::now();
+	float coverage_time[preview_levels] = {};
 
 	// we can't break out of an openmp loop
 	// so we have a variable that gets checked
 	// every few iterations
 	bool cancel_for = false;
 
+	// limit how often intermediate results are denoised and saved
+	auto last_denoise = chrono::steady_clock::now();
+	auto last_checkpoint = chrono::steady_clock::now();
+
+	// a resumed render continues from the pass after its checkpoint
+	int first_pass = m_resume_pass;
+	m_resume_pass = 0;
+
+	// set when a new scene was swapped in, the render starts over with it
+	bool swapped = false;
+
 	do {
+		if (swapped) {
+			swapped = false;
+			first_pass = 0;
+			idle_preview_passes = 0;
+			preview_view_valid = false;
+			// only a new scene changes the primary hits, not a new integrator
+			if (handle.scene.get() != m_render_scene) {
+				m_render_scene = handle.scene.get();
+				m_hit_cache.invalidate();
+				resetHistory();
+			}
+		}
+
 		// stop rendering
-		if (idle_preview_frames > 15) break;
+		if (idle_preview_passes > 15) break;
+
+		Scene &scene = *handle.scene;
+		PathTracer &pathtracer = *handle.pathtracer;
 
 		was_preview = m_preview_mode;
 
@@ -536,75 +1078,437 @@ void Application::runPathTraceIntegrator() {
 		m_end_time = chrono::steady_clock::now() - 1ms;
 		m_start_time = chrono::steady_clock::now();
 
-		// only increment the frame time if last frame was incomplete
-		// prevents 'pulsating' effect when preview is spinning idly
-		if (cancel_for) m_frame_time = float(fmod(m_frame_time + 0.03, 100.0));
+		// use a copy of the camera for the whole frame, the main thread may move it
+		const Camera camera = *m_camera;
+
+		// a new view starts the preview order over
+		bool view_changed = !preview_view_valid || preview_view.position != camera.position() || preview_view.yaw != camera.yaw() || preview_view.pitch != camera.pitch();
+		preview_view = { camera.position(), camera.yaw(), camera.pitch() };
+		preview_view_valid = was_preview;
+		if (view_changed) preview_cursor = 0;
+
+		// only increment the frame time if last frame was incomplete or the
+		// view changed, prevents 'pulsating' effect when preview is spinning idly
+		if (cancel_for || (was_preview && view_changed)) m_frame_time = float(fmod(m_frame_time + 0.03, 100.0));
 
 		cancel_for = false;
 
+		// carry the samples of the last frame over to the new view
+		bool reproject = m_reproject && was_preview && m_aov_buffer.enabled(AOV::Depth);
+		if (reproject) reprojectHistory(camera);
+
+		// the hit cache is only used for still renders (started from the first pass)
+		bool use_cache = m_use_hit_cache && !was_preview && first_pass == 0;
+		if (use_cache) {
+			int cache_samples = std::min(m_hit_cache_samples, m_render_perpixel_samples);
+			if (m_hit_cache.pixels() != int(m_render_data.size()) || m_hit_cache.samples() != cache_samples) {
+				m_hit_cache.resize(int(m_render_data.size()), cache_samples);
+			}
+			// primary visibility changes with the camera
+			if (m_hit_cache_view.position != camera.position() || m_hit_cache_view.yaw != camera.yaw() || m_hit_cache_view.pitch != camera.pitch()) {
+				m_hit_cache.invalidate();
+				m_hit_cache_view = { camera.position(), camera.yaw(), camera.pitch() };
+			}
+		}
+		bool reshade_cached = use_cache && m_hit_cache.valid(0);
+
+		// coarse-to-fine order in preview
+		bool progressive = m_progressive && was_preview;
+		const vector<int> &order = progressive ? m_pyramid_table : (m_tile_order && !was_preview) ? m_tile_table : m_shuffle_table;
+		const int pixels = int(m_render_data.size());
+
+		// preview frames trace what fits in the budget (and are timed for
+		// the next plan), a preview frame that overruns its budget or a still
+		// render that is interrupted gives way to the new view
+		const bool timed = was_preview;
+		FrameScheduler::Plan plan;
+		if (timed) plan = m_frame_scheduler.plan(order, progressive ? 0 : preview_pass * 9001, preview_cursor);
+		const auto deadline = m_start_time + chrono::duration<float, milli>(m_frame_scheduler.budget() * (timed ? FrameScheduler::deadline : 1));
+		float pixel_time = 0;
+		bool pass_complete = false;
+
 		// for each sample
-		for (m_sample_pass_count = 0; m_sample_pass_count < (was_preview ? 1 : m_render_perpixel_samples) && !cancel_for; m_sample_pass_count++) {
+		for (m_sample_pass_count = (was_preview ? 0 : first_pass); m_sample_pass_count < (was_preview ? plan.passes : m_render_perpixel_samples) && !cancel_for; m_sample_pass_count++) {
+
+			// a new scene is only swapped in between passes
+			if (m_scene_swap.take(handle)) {
+				swapped = true;
+				break;
+			}
 
-			m_sample_pixel_count = 0;
+			// the preview order starts a pass
+			if (!was_preview || preview_cursor == 0) {
+				preview_pass++;
+				pass_start = chrono::steady_clock::now();
+				for (int l = 0; l < preview_levels; l++) {
+					m_level_done[l] = 0;
+					coverage_time[l] = 0;
+				}
+			}
+			const int first = was_preview ? preview_cursor : 0;
+			const int last = was_preview ? std::min(first + plan.pixels, pixels) : pixels;
+			const int shuffle_offset = progressive ? 0 : preview_pass * 9001;
+			const auto loop_begin = chrono::steady_clock::now();
+
+			m_sample_pixel_count = first;
 
 			// for each pixel
-			// use 1 fewer threads in preview mode to maintain responsiveness
-#pragma omp parallel for num_threads(std::max(omp_get_max_threads() - was_preview, 1))
-			for (int i = 0; i < int(m_render_data.size()); ++i) {
+			// dynamic so that pixels are (roughly) done in table order
+#pragma omp parallel for schedule(dynamic, 64)
+			for (int i = first; i < last; ++i) {
 				if (!cancel_for) {
-					int idx = m_shuffle_table[(i + preview_frames * 9001) % m_render_data.size()];
+					const auto pixel_begin = timed ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+					int idx = order[(i + shuffle_offset) % pixels];
 
 					// calculate the pixel coordinate
 					vec2 screen_coord(idx % m_render_width, idx / m_render_width);
 
-					// calculate some jitter
-					// glm's random is implemented with rand(), which is terrible
-					static thread_local minstd_rand randgen{std::random_device()()};
-					uniform_real_distribution<float> dist{0, 1};
-					vec2 rand = vec2(dist(randgen), dist(randgen));
-					// reduce jitter for initial samples, improves results for low sample counts
-					rand = (rand - 0.5f) * (1.f - exp(float(m_sample_pass_count) * -0.4f)) + 0.5f;
+					// reuse the primary hit if this sample is cached
+					bool cached = use_cache && m_hit_cache.valid(m_sample_pass_count);
+
+					vec2 rand;
+					if (cached) {
+						rand = m_hit_cache.jitter(m_sample_pass_count, idx);
+					} else {
+						// calculate some jitter
+						if (m_deterministic) {
+							// keyed on the pixel and sample, independent of the thread
+							rand = vec2(
+								counterUniform(m_render_seed, idx, m_sample_pass_count, 0),
+								counterUniform(m_render_seed, idx, m_sample_pass_count, 1)
+							);
+						} else {
+							// a stream per thread
+							static thread_local PCG32 randgen{std::random_device()(), std::random_device()()};
+							randgen.fill(&rand[0], 2);
+						}
+						// reduce jitter for initial samples, improves results for low sample counts
+						rand = (rand - 0.5f) * (1.f - exp(float(m_sample_pass_count) * -0.4f)) + 0.5f;
+					}
 
 
 					// The actual raytracing commands!!!
 					// create the ray and trace the scene
-					Ray ray = m_camera->generateRay(screen_coord + rand);
-					vec3 sample_color = m_pathtracer->sampleRay(ray, m_render_ray_depth);
-
+					Ray ray = camera.generateRay(screen_coord + rand);
+					RayIntersection intersect;
+					if (cached) {
+						intersect = m_hit_cache.load(scene, ray, m_sample_pass_count, idx);
+					} else {
+						intersect = scene.intersect(ray);
+						if (use_cache && m_hit_cache.caches(m_sample_pass_count)) m_hit_cache.store(m_sample_pass_count, idx, rand, intersect);
+					}
+					AOVSample aov;
+					vec3 sample_color = pathtracer.sampleHit(ray, intersect, m_render_ray_depth, aov);
 
 					// mix with the existing color
 					float sample_mix_factor = m_sample_pass_count / float(m_sample_pass_count + 1);
-					vec3 running_mean_color(m_render_data[idx].r, m_render_data[idx].g, m_render_data[idx].b);
-					vec3 final_color = mix(sample_color, running_mean_color, sample_mix_factor);
+					// in preview the history of each pixel is tracked separately
+					if (reproject) {
+						atomic<int> &count = m_history_count[idx];
+
+						// reject the history if it is of a different surface
+						float history_depth = m_aov_buffer.plane(AOV::Depth)[idx];
+						if (abs(history_depth - aov.depth) > 0.05f * std::max(history_depth, aov.depth)) count = 0;
+
+						int n = std::min(count.load(), m_max_history);
+						sample_mix_factor = n / float(n + 1);
+						count++;
+					}
+					vec3 final_color;
+					if (reproject) {
+						const pixel history = m_render_data.read(idx);
+						vec3 running_mean_color(history.r, history.g, history.b);
+						final_color = mix(sample_color, running_mean_color, sample_mix_factor);
+					} else {
+						// the first pass starts the pixel over
+						if (m_sample_pass_count == 0) m_accumulation.reset(idx);
+						m_accumulation.add(idx, sample_color);
+						final_color = m_accumulation.mean(idx);
+					}
+
+					// a traced pixel is stamped before it is written, so an upsampled
+					// fill that checks the stamp after this can't overwrite it
+					const int stamps = preview_levels + 1;
+					if (progressive) m_fill_stamp[idx] = preview_pass * stamps + preview_levels;
 
 					// record final color and increase sample count
-					m_render_data[idx] = {final_color.r, final_color.g, final_color.b, m_frame_time};
+					const pixel final_pixel = {final_color.r, final_color.g, final_color.b, m_frame_time};
+					m_render_data.write(idx, final_pixel);
+					m_dirty_tiles.mark(idx);
 					m_sample_pixel_count++;
 
+					// the variance is tracked through the mean of squared luminance
+					float lum = dot(sample_color, vec3(0.2126f, 0.7152f, 0.0722f));
+					m_render_moment[idx] = mix(lum * lum, m_render_moment[idx], sample_mix_factor);
+
+					// aovs are averaged the same way
+					if (m_aov_buffer.mask()) m_aov_buffer.accumulate(idx, aov, sample_mix_factor);
+
+					if (progressive) {
+						int level = 0;
+						while (level < preview_levels - 1 && i >= m_pyramid_level_end[level]) level++;
+
+						// upsample coarse samples over the rest of their block, unless
+						// the pixel has been traced at a finer level or has history
+						// (the stamp is moved up to this level while holding the pixel,
+						// fills of a pixel only ever get finer)
+						if (level < preview_levels - 1) {
+							const int fill_stamp = preview_pass * stamps + level;
+							int block = 1 << (preview_levels - 1 - level);
+							int x0 = idx % m_render_width, y0 = idx / m_render_width;
+							for (int y = y0; y < std::min(y0 + block, m_render_height); y++) {
+								for (int x = x0; x < std::min(x0 + block, m_render_width); x++) {
+									int q = x + y * m_render_width;
+									auto coarser = [&]() {
+										int stamp = m_fill_stamp[q];
+										do {
+											if (stamp / stamps == preview_pass && stamp % stamps >= level) return false;
+											if (reproject && m_history_count[q] > 0) return false;
+										} while (!m_fill_stamp[q].compare_exchange_weak(stamp, fill_stamp));
+										return true;
+									};
+									if (m_render_data.writeIf(q, final_pixel, coarser)) m_dirty_tiles.mark(q);
+								}
+							}
+						}
+
+						// time until every pixel of the level was traced
+						int level_size = m_pyramid_level_end[level] - (level > 0 ? m_pyramid_level_end[level - 1] : 0);
+						if (++m_level_done[level] == level_size) {
+							coverage_time[level] = float((chrono::steady_clock::now() - pass_start) / 1.0ms);
+						}
+					}
+
+					if (timed) m_frame_scheduler.record(thread_index(), idx, float((chrono::steady_clock::now() - pixel_begin) / 1.0ns));
+
 					// check cancel things every some number of pixels
 					if ((i & 0xFF) == 0) {
 						cancel_for |= m_should_exit;
-						// if preview needs restarting, bail after 30ms to maintain ~30Hz
+						// if preview needs restarting, bail once past the deadline
 						if (m_preview_mode && m_restart_render) {
 							was_preview = true;
-							if (chrono::steady_clock::now() - m_start_time > 30ms) cancel_for = true;
+							if (chrono::steady_clock::now() > deadline) cancel_for = true;
 						}
 					}
 				}
 			}
+
+			// the next preview frame carries on from here (pixels skipped by
+			// a cancelled frame wait for the next pass)
+			if (timed) {
+				const float ms = float((chrono::steady_clock::now() - loop_begin) / 1.0ms);
+				m_frame_scheduler.finishPixels(ms);
+				pixel_time += ms;
+				preview_cursor = (last >= pixels) ? 0 : last;
+				pass_complete |= last >= pixels;
+			}
+
+			// every pixel has now stored this sample
+			if (use_cache && !cancel_for && m_hit_cache.caches(m_sample_pass_count) && !m_hit_cache.valid(m_sample_pass_count)) {
+				m_hit_cache.setValidSamples(m_sample_pass_count + 1);
+			}
+
+			// time from an edit until the whole image has been re-shaded once
+			if (m_reshade && !was_preview && !cancel_for) {
+				m_reshade = false;
+				m_reshade_cached = reshade_cached;
+				m_reshade_latency = float((chrono::steady_clock::now() - m_edit_time) / 1.0ms);
+			}
+
+			bool last_pass = m_sample_pass_count + 1 >= m_render_perpixel_samples;
+
+			// checkpoint completed passes every interval, and always the last pass
+			if (m_checkpoint && !was_preview && !cancel_for) {
+				if (last_pass) m_checkpoint_writer.wait();
+				if (last_pass || chrono::steady_clock::now() - last_checkpoint > chrono::duration<float>(m_checkpoint_interval)) {
+					// if the last one is still being written try again next pass
+					if (writeCheckpoint(camera, scene)) last_checkpoint = chrono::steady_clock::now();
+				}
+			}
+
+			// denoise completed passes, at most once a second unless it is the last pass
+			if (m_denoise && !was_preview && !cancel_for) {
+				if (last_pass || chrono::steady_clock::now() - last_denoise > 1s) {
+					denoise();
+					last_denoise = chrono::steady_clock::now();
+				}
+			}
+
+			// nothing is writing the buffers between passes
+			{
+				lock_guard<mutex> guard(m_save_lock);
+				takeSaveRequest();
+				snapshotAOV();
+			}
 		}
 
 		m_end_time = chrono::steady_clock::now();
-		preview_frames += was_preview;
+		if (timed) m_frame_scheduler.finishFrame(float((m_end_time - m_start_time) / 1.0ms), pixel_time);
+		if (progressive) copy(begin(coverage_time), end(coverage_time), begin(m_coverage_time));
 		if (m_preview_mode && m_restart_render) {
-			idle_preview_frames = 0;
-		} else {
-			idle_preview_frames++;
+			idle_preview_passes = 0;
+		} else if (pass_complete || !timed) {
+			idle_preview_passes++;
 		}
 
 		// exit after proper render or if requested
-	} while ((was_preview || m_preview_mode) && !m_should_exit);
+	} while ((was_preview || m_preview_mode || swapped) && !m_should_exit);
 
 	// we'll abuse this to indicate the thread has exited normally too
+	// (a save requested since the last pass is taken on the way out)
+	lock_guard<mutex> guard(m_save_lock);
+	takeSaveRequest();
+	snapshotAOV();
 	m_should_exit = true;
 }
+
+
+
+void Application::resetHistory() {
+	m_history_count.clear();
+	m_history_camera = nullptr;
+}
+
+
+void Application::reprojectHistory(const Camera &camera) {
+	const int n = int(m_render_data.size());
+	if (int(m_history_count.size()) != n) {
+		m_history_count = vector<atomic<int>>(n);
+		m_history_camera = nullptr;
+	}
+
+	// only if the view changed
+	if (m_history_camera && (m_history_camera->position() != camera.position() || m_history_camera->yaw() != camera.yaw() || m_history_camera->pitch() != camera.pitch())) {
+		float *depth = m_aov_buffer.plane(AOV::Depth);
+		m_reprojector.reproject(*m_history_camera, camera, m_render_width, m_render_height, depth);
+
+		// gather, pixels without history keep their (out of date) color so the
+		// display filter can still fill them in based on their timestamp
+		m_render_data.read(m_reproject_data);
+		vector<atomic<int>> count(n);
+		int kept = 0;
+#pragma omp parallel for reduction(+:kept)
+		for (int i = 0; i < n; i++) {
+			int src = m_reprojector.source(i);
+			if (src >= 0) {
+				const pixel &p = m_reproject_data[src];
+				m_render_data.write(i, { p.r, p.g, p.b, m_frame_time });
+				count[i] = m_history_count[src].load();
+				depth[i] = m_reprojector.depth(i);
+				kept++;
+			} else {
+				depth[i] = 0;
+			}
+		}
+		m_history_count.swap(count);
+		m_reproject_kept = float(kept) / n;
+		m_dirty_tiles.markAll();
+	}
+
+	m_history_camera = make_unique<Camera>(camera);
+}
+
+
+bool Application::writeCheckpoint(const Camera &camera, const Scene &scene) {
+	CheckpointState state;
+	state.width = m_render_width;
+	state.height = m_render_height;
+	state.passes = m_sample_pass_count + 1;
+	state.target_samples = m_render_perpixel_samples;
+	state.ray_depth = m_render_ray_depth;
+	state.deterministic = m_deterministic;
+	state.seed = m_render_seed;
+	state.camera_position = camera.position();
+	state.camera_yaw = camera.yaw();
+	state.camera_pitch = camera.pitch();
+	state.scene_objects = int(scene.objects().size());
+	state.scene_lights = int(scene.lights().size());
+	state.aov_mask = m_aov_buffer.mask();
+	state.user_aov_mask = m_aov_mask;
+
+	static_assert(sizeof(pixel) == 4 * sizeof(float), "pixels are written as 4 floats");
+	m_render_data.read(m_render_snapshot);
+	bool started = m_checkpoint_writer.write(m_checkpoint_target, state,
+		reinterpret_cast<const float *>(m_render_snapshot.data()), m_render_moment.data(), m_accumulation,
+		m_aov_buffer.data(), m_aov_buffer.size());
+	if (started) m_checkpoint_passes = state.passes;
+	return started;
+}
+
+
+void Application::saveImage(const string &filename, const ImageWriteOptions &options) {
+	lock_guard<mutex> guard(m_save_lock);
+	m_save_filename = filename;
+	m_save_options = options;
+	m_save_pending = true;
+
+	// with nothing rendering the buffers can be copied straight away
+	if (!m_raytrace_thread.joinable() || m_should_exit) takeSaveRequest();
+}
+
+
+void Application::snapshotAOV() {
+	// m_save_lock is held by the caller
+	const int shown = m_display_aov;
+	if (shown < 0 || !m_aov_buffer.enabled(AOV(shown))) return;
+	const AOV a = AOV(shown);
+	const int w = m_aov_buffer.width(), h = m_aov_buffer.height();
+	if (m_aov_snapshot.width() != w || m_aov_snapshot.height() != h || m_aov_snapshot.mask() != AOVBuffer::bit(a)) {
+		m_aov_snapshot.resize(w, h, AOVBuffer::bit(a));
+	}
+	copy_n(m_aov_buffer.plane(a), size_t(AOVBuffer::channels(a)) * w * h, m_aov_snapshot.plane(a));
+}
+
+
+void Application::takeSaveRequest() {
+	// m_save_lock is held by the caller
+	if (!m_save_pending) return;
+	m_save_pending = false;
+
+	vector<pixel> color;
+	((m_denoise && m_denoised_valid) ? m_denoised_data : m_render_data).read(color);
+	m_image_writer.write(m_save_filename, m_render_width, m_render_height, &color[0].r, 4, &m_aov_buffer, m_save_options);
+}
+
+
+void Application::denoise() {
+	// guides are only written if denoising was on when the render started
+	if (!m_aov_buffer.enabled(AOV::Depth) || !m_aov_buffer.enabled(AOV::Normal) || !m_aov_buffer.enabled(AOV::Albedo)) return;
+
+	const size_t n = m_render_data.size();
+	const auto time_begin = chrono::steady_clock::now();
+
+	// split the color into planes
+	vector<float> color(3 * n);
+	vector<float> time(n);
+	for (size_t i = 0; i < n; i++) {
+		const pixel p = m_render_data.read(int(i));
+		color[i] = p.r;
+		color[n + i] = p.g;
+		color[2 * n + i] = p.b;
+		time[i] = p.time;
+	}
+
+	Denoiser::Input in;
+	in.width = m_render_width;
+	in.height = m_render_height;
+	for (int c = 0; c < 3; c++) {
+		in.color[c] = color.data() + c * n;
+		in.albedo[c] = m_aov_buffer.plane(AOV::Albedo, c);
+		in.normal[c] = m_aov_buffer.plane(AOV::Normal, c);
+	}
+	in.depth = m_aov_buffer.plane(AOV::Depth);
+
+	float *const out[3] = { color.data(), color.data() + n, color.data() + 2 * n };
+	m_denoiser.denoise(in, out);
+
+	// only reallocated while it is not shown (a new size restarts the render)
+	if (m_denoised_data.size() != n) m_denoised_data.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		m_denoised_data.write(int(i), { color[i], color[n + i], color[2 * n + i], time[i] });
+	}
+	m_denoised_valid = true;
+	m_dirty_tiles.markAll();
+
+	m_denoise_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+}
@@ -3,6 +3,9 @@
 
 // std
 #include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <thread>
 
 // glm
@@ -13,6 +16,17 @@
 #include "scene/path_tracer.hpp"
 #include "scene/scene.hpp"
 #include "scene/camera.hpp"
+#include "render/accumulation.hpp"
+#include "render/aov.hpp"
+#include "render/checkpoint.hpp"
+#include "render/denoiser.hpp"
+#include "render/dirty_tiles.hpp"
+#include "render/frame_buffer.hpp"
+#include "render/frame_scheduler.hpp"
+#include "render/hit_cache.hpp"
+#include "render/image_writer.hpp"
+#include "render/reprojection.hpp"
+#include "render/scene_swap.hpp"
 
 // main application class
 class Application {
@@ -29,14 +43,96 @@ private:
 	int m_render_perpixel_samples = 1;
 	int m_render_ray_depth = 2;
 
+	// deterministic rendering, all random numbers are a function of
+	// (seed, pixel, sample, dimension) so the output is reproducible
+	bool m_deterministic = true;
+	int m_render_seed = 0;
+
 	// render data
 	float m_exposure = 1.0;
-	struct pixel { float r, g, b, time; };
-	std::vector<pixel> m_render_data;
+	using pixel = FramePixel;
+	FrameBuffer m_render_data; // written by the render threads while the display reads it
+	std::vector<pixel> m_render_snapshot; // copy for checkpoints
+	std::vector<float> m_render_moment; // running mean of squared luminance (for the variance)
 	std::vector<int> m_shuffle_table;
+	std::vector<int> m_pyramid_table; // shuffled coarse-to-fine order (1/64, 1/16, 1/4, full)
+	std::vector<int> m_tile_table; // shuffled order, one tile of m_dirty_tiles at a time
+	bool m_tile_order = false; // still renders use m_tile_table
+	int m_pyramid_level_end[4] = { 0, 0, 0, 0 };
 	int m_sample_pass_count = 0;
 	std::atomic<int> m_sample_pixel_count{0};
 
+	// sums of the samples of still renders, m_render_data shows their mean
+	AccumulationPrecision m_accumulation_precision = AccumulationPrecision::Double;
+	AccumulationBuffer m_accumulation;
+
+	// aovs (written in the same pass as the color)
+	unsigned m_aov_mask = 0;
+	AOVBuffer m_aov_buffer;
+	std::atomic<int> m_display_aov{-1}; // show color if < 0
+	AOVBuffer m_aov_snapshot; // planes of the shown aov, copied between passes (under m_save_lock)
+	std::vector<pixel> m_aov_display_data;
+
+	// denoising
+	bool m_denoise = false;
+	Denoiser m_denoiser;
+	FrameBuffer m_denoised_data;
+	std::atomic<bool> m_denoised_valid{false};
+	float m_denoise_time = 0;
+
+	// primary hit cache, lets light/material edits skip primary traversal
+	bool m_use_hit_cache = false;
+	int m_hit_cache_samples = 4;
+	PrimaryHitCache m_hit_cache;
+	struct { glm::vec3 position; float yaw, pitch; } m_hit_cache_view{ glm::vec3(0), 0, 0 };
+
+	// temporal reprojection of samples while the preview camera moves
+	bool m_reproject = true;
+	int m_max_history = 16; // caps the number of samples a pixel remembers
+	Reprojector m_reprojector;
+	std::vector<std::atomic<int>> m_history_count; // read by the fills of other threads
+	std::unique_ptr<Camera> m_history_camera = nullptr; // view the history was rendered from
+	std::vector<pixel> m_reproject_data;
+	float m_reproject_kept = 0; // fraction of pixels that kept their history
+
+	// progressive-resolution preview, traces every 8th, 4th then every 2nd
+	// pixel first, upsampling each one over the pixels not yet traced
+	static constexpr int preview_levels = 4;
+	bool m_progressive = true;
+	std::vector<std::atomic<int>> m_fill_stamp; // pass * 5 + level of what was written to each pixel
+	std::atomic<int> m_level_done[preview_levels];
+	float m_coverage_time[preview_levels] = { 0, 0, 0, 0 }; // ms until each level was complete (last pass)
+
+	// plans preview frames to a frame time, tracing fewer pixels (a lower
+	// resolution) where the view is expensive
+	FrameScheduler m_frame_scheduler;
+	int m_frame_rate = 30; // preview target, Hz
+
+	// re-shading after an edit (only lights/materials changed)
+	bool m_reshade = false;
+	bool m_reshade_cached = false;
+	std::chrono::steady_clock::time_point m_edit_time;
+	float m_reshade_latency = 0; // ms from the edit to the first complete pass
+
+	// checkpoints of long renders, taken between passes
+	bool m_checkpoint = false;
+	float m_checkpoint_interval = 60; // seconds
+	std::string m_checkpoint_filename = "render.checkpoint";
+	std::string m_checkpoint_target; // copy of the filename for the render thread
+	CheckpointWriter m_checkpoint_writer;
+	std::atomic<int> m_checkpoint_passes{0}; // passes in the last checkpoint written
+	int m_resume_pass = 0; // pass the next render starts at (set when resuming)
+
+	// hdr output of the linear color and aovs, encoded in the background
+	// a save while rendering is taken by the render thread between passes
+	// (like a checkpoint) so the aovs aren't copied while being written
+	ImageWriteOptions m_image_options;
+	ImageWriter m_image_writer;
+	std::mutex m_save_lock;
+	bool m_save_pending = false;
+	std::string m_save_filename;
+	ImageWriteOptions m_save_options;
+
 	// render thread and state
 	std::thread m_raytrace_thread;
 	std::atomic<bool> m_should_exit{false};
@@ -50,30 +146,91 @@ private:
 
 	// gl handles
 	GLuint m_filter_prog = 0, m_display_prog = 0;
-	GLuint m_render_texture_back = 0, m_render_texture_front = 0, m_render_texture_filtered = 0, m_screenshot_texture = 0;
-	GLuint m_render_pbo = 0;
+	GLuint m_render_texture = 0, m_render_texture_filtered = 0, m_screenshot_texture = 0;
 	GLuint m_render_fbo = 0, m_screenshot_fbo;
-	GLsync m_sync_render_texture = nullptr;
 
-	// scene
-	Scene m_scene;
+	// display uploads, only the tiles written since the last upload go
+	// through a ring of pbos (persistently mapped where supported)
+	static constexpr int upload_ring_size = 3;
+	DirtyTiles m_dirty_tiles;
+	int m_display_source = -1; // 0 color, 1 denoised, 2 aov
+	GLuint m_upload_pbo[upload_ring_size] = { 0, 0, 0 };
+	pixel *m_upload_mapped[upload_ring_size] = { nullptr, nullptr, nullptr };
+	GLsync m_upload_fence[upload_ring_size] = { nullptr, nullptr, nullptr };
+	bool m_persistent_upload = false;
+	size_t m_upload_capacity = 0; // pixels each pbo holds
+	int m_upload_slot = 0;
+	std::vector<int> m_upload_tiles;
+	float m_upload_time = 0; // ms on the main thread (last frame)
+	size_t m_upload_bytes = 0;
+	int m_upload_tile_count = 0;
+
+	// scene, the render thread has its own handle to the scene it renders
+	// (the old one until it swaps to a new one)
+	std::shared_ptr<Scene> m_scene = std::make_shared<Scene>();
 	std::unique_ptr<Camera> m_camera = nullptr;
-	std::unique_ptr<PathTracer> m_pathtracer = nullptr;
+	std::shared_ptr<PathTracer> m_pathtracer = nullptr;
+	int m_pathtracer_index = 0;
+	const Scene *m_render_scene = nullptr; // the scene the render thread has (only compared)
+
+	// scenes are built in the background and swapped in between passes
+	SceneLoader m_scene_loader;
+	SceneSwap m_scene_swap;
+	std::chrono::steady_clock::time_point m_scene_request_time;
+	bool m_scene_switching = false; // requested, not yet swapped in
+	float m_scene_load_time = -1; // ms to build the last scene
+	bool m_scene_from_cache = false;
+	float m_scene_switch_time = 0; // ms from the request until the render thread swapped
+	float m_scene_stall_time = 0; // longest the gui was blocked by the last switch (ms)
 
 	// updates the cameras position and rotation
 	// if preview mode is enabled
 	void updateCameraMovement(int w, int h);
 
+	// uploads the tiles marked in m_dirty_tiles to the render texture,
+	// read(first, count, out) fetches count pixels of the displayed image
+	// starting at first
+	void uploadTiles(const std::function<void(size_t first, size_t count, pixel *out)> &read);
+
 	// saves a png screenshot of the current rendering
 	void screenshot(const std::string &filename);
 
+	// saves the linear color and aovs, now if the render thread has
+	// finished or otherwise after the pass it is rendering
+	void saveImage(const std::string &filename, const ImageWriteOptions &options);
+
+	// fills m_aov_display_data with a visualization of an aov (from m_aov_snapshot)
+	void visualizeAOV(AOV a);
+
+	// restarts the render after a light or material was changed
+	// (call with the render stopped)
+	void restartAfterEdit();
+
+	// builds a scene in the background, then switches to it
+	void requestScene(std::function<bool(SceneFile &)> build);
+
+	// picks up a scene that finished building and hands it to the render
+	// thread (or restarts the render with it if the thread has finished)
+	void updateScene();
+
+	// continues a render from a checkpoint file
+	bool resume(const std::string &filename);
+
 	// helper functions for running integration
 	void resize(int w, int h);
 	void start();
 	void stop();
 
-	// thread only function
-	void runPathTraceIntegrator();
+	// forget the preview history (scene or shading changed)
+	void resetHistory();
+
+	// thread only functions
+	void runPathTraceIntegrator(SceneHandle handle);
+	void denoise();
+	void reprojectHistory(const Camera &camera);
+	bool writeCheckpoint(const Camera &camera, const Scene &scene);
+	void takeSaveRequest(); // with m_save_lock held
+	void snapshotAOV(); // with m_save_lock held
 
 
 public:
@@ -3,11 +3,23 @@
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#include <vector>
+
+// openmp (if avaliable)
+#ifdef CGRA_HAVE_OPENMP
+#include <omp.h>
+#endif // CGRA_HAVE_OPENMP
 
 // project
 #include "application.hpp"
 #include "opengl.hpp"
 #include "cgra/cgra_gui.hpp"
+#include "render/animation.hpp"
+#include "render/benchmark.hpp"
+#include "render/distributed.hpp"
+#include "render/image_io.hpp"
+#include "scene/mesh.hpp"
+#include "scene/streamed_mesh.hpp"
 
 
 using namespace std;
@@ -26,9 +38,175 @@ void APIENTRY debugCallback(GLenum, GLenum, GLuint, GLenum, GLsizei, const GLcha
 static Application *application_ptr = nullptr;
 
 
+// Reads the options describing a frame for the headless modes
+// (any that aren't given keep their defaults)
+//   --scene <index> --integrator <index> --size <w> <h> --samples <n>
+//   --depth <n> --seed <n> --tile <px> --chunk <samples per job>
+static DistributedFrame parseFrameOptions(int argc, char **argv) {
+	DistributedFrame frame;
+	RenderSettings &s = frame.settings;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		bool one = i + 1 < argc, two = i + 2 < argc;
+		if (arg == "--scene" && one) frame.scene = stoi(argv[++i]);
+		else if (arg == "--integrator" && one) frame.integrator = stoi(argv[++i]);
+		else if (arg == "--size" && two) { s.width = stoi(argv[++i]); s.height = stoi(argv[++i]); }
+		else if (arg == "--samples" && one) s.samples = stoi(argv[++i]);
+		else if (arg == "--depth" && one) s.ray_depth = stoi(argv[++i]);
+		else if (arg == "--seed" && one) s.seed = stoi(argv[++i]);
+		else if (arg == "--tile" && one) frame.tile_size = stoi(argv[++i]);
+		else if (arg == "--chunk" && one) frame.sample_chunk = stoi(argv[++i]);
+	}
+	return frame;
+}
+
+
 // Main program
 // 
-int main() {
+int main(int argc, char **argv) {
+
+	// command line modes that don't need a window
+	// --bench <name> : run a microbenchmark
+	if (argc >= 3 && argv[1] == "--bench"s) {
+		bool passed;
+		if (!runBenchmark(argv[2], passed)) {
+			cerr << "Error: Unknown benchmark " << argv[2] << endl;
+			return 1;
+		}
+		return passed ? 0 : 1;
+	}
+
+	// --convert-mesh <input> <output.mesh> [--brick <triangles>] : builds the BVH for a mesh and writes a binary mesh file
+	// or a bricked mesh file for streaming if the output ends with .bricks
+	if (argc >= 4 && argv[1] == "--convert-mesh"s) {
+		shared_ptr<Mesh> mesh = Mesh::load(argv[2]);
+		if (!mesh) return 1;
+		const string output = argv[3];
+		if (output.size() > 7 && output.substr(output.size() - 7) == ".bricks") {
+			int brick = (argc >= 6 && argv[4] == "--brick"s) ? stoi(argv[5]) : 4096;
+			if (!StreamedMesh::write(*mesh, output, uint32_t(brick))) {
+				cerr << "Error: Failed to write mesh " << output << endl;
+				return 1;
+			}
+			cout << "Wrote " << mesh->triangleCount() << " triangles in bricks of up to " << brick << " to " << output << endl;
+			return 0;
+		}
+		if (!mesh->write(argv[3])) {
+			cerr << "Error: Failed to write mesh " << argv[3] << endl;
+			return 1;
+		}
+		cout << "Wrote " << mesh->triangleCount() << " triangles, " << mesh->nodeCount() << " BVH nodes to " << argv[3] << endl;
+		return 0;
+	}
+
+	// distributed rendering (frame options as in parseFrameOptions)
+	// --worker <host> <port> [--threads <n>] : render jobs for a coordinator
+	// --coordinator <port> <workers> <output> [--bind <address>] [--timeout <seconds>] : render a frame with
+	// remote workers to a png, listening on loopback unless bound to another address
+	// --scaling <max workers> : time a frame with 1..max local worker processes
+	if (argc >= 4 && argv[1] == "--worker"s) {
+#ifdef CGRA_HAVE_OPENMP
+		for (int i = 4; i + 1 < argc; i++) {
+			if (argv[i] == "--threads"s) omp_set_num_threads(stoi(argv[i + 1]));
+		}
+#endif // CGRA_HAVE_OPENMP
+		return runWorker(argv[2], stoi(argv[3])) ? 0 : 1;
+	}
+	if (argc >= 5 && argv[1] == "--coordinator"s) {
+		DistributedFrame frame = parseFrameOptions(argc, argv);
+		string address = "127.0.0.1";
+		Coordinator coordinator;
+		for (int i = 5; i + 1 < argc; i++) {
+			if (argv[i] == "--bind"s) address = argv[i + 1];
+			else if (argv[i] == "--timeout"s) coordinator.setTimeout(stod(argv[i + 1]));
+		}
+		if (!coordinator.listen(stoi(argv[2]), address)) {
+			cerr << "Error: Could not listen on " << address << ":" << argv[2] << endl;
+			return 1;
+		}
+		cout << "Waiting for " << argv[3] << " workers on " << address << ":" << coordinator.port() << endl;
+
+		vector<float> image;
+		Coordinator::Stats stats;
+		if (!coordinator.render(stoi(argv[3]), frame, image, &stats)) {
+			cerr << "Error: Render failed" << endl;
+			return 1;
+		}
+		cout << "Rendered " << stats.jobs << " jobs in " << stats.seconds << " s" << endl;
+		if (!writePNG(argv[4], frame.settings.width, frame.settings.height, image.data())) {
+			cerr << "Error: Failed to write image " << argv[4] << endl;
+			return 1;
+		}
+		return 0;
+	}
+	if (argc >= 3 && argv[1] == "--scaling"s) {
+		return runScalingTest(argv[0], stoi(argv[2]), parseFrameOptions(argc, argv)) ? 0 : 1;
+	}
+
+	// --animate <frames> <output> [--keys <file>] [--batch <frames in flight>] [--writers <threads>] [--filter <name> [<radius>]] [--compare]
+	// renders an animation to <output>_0000.png etc. (frame options as above)
+	// without a key file the camera dollies forward while panning
+	// --filter is box, tent, gaussian, mitchell or blackman-harris (each has a default radius)
+	// --compare also renders the frames as independent runs (to <output>_independent_0000.png etc.)
+	// and prints the speedup
+	if (argc >= 4 && argv[1] == "--animate"s) {
+		DistributedFrame frame = parseFrameOptions(argc, argv);
+		AnimationSettings settings;
+		settings.scene = frame.scene;
+		settings.integrator = frame.integrator;
+		settings.render = frame.settings;
+		settings.tile_size = frame.tile_size;
+		settings.frames = stoi(argv[2]);
+		settings.output = argv[3];
+
+		Animation animation;
+		bool compare = false;
+		for (int i = 4; i < argc; i++) {
+			string arg = argv[i];
+			if (arg == "--keys" && i + 1 < argc) {
+				if (!animation.load(argv[++i])) return 1;
+			}
+			else if (arg == "--batch" && i + 1 < argc) settings.frames_in_flight = stoi(argv[++i]);
+			else if (arg == "--writers" && i + 1 < argc) settings.writer_threads = stoi(argv[++i]);
+			else if (arg == "--filter" && i + 1 < argc) {
+				FilterType type = Filter::parse(argv[++i]);
+				if (type == FilterType::Count) {
+					cerr << "Error: Unknown filter " << argv[i] << endl;
+					return 1;
+				}
+				float radius = Filter::defaultRadius(type);
+				if (i + 1 < argc && argv[i + 1][0] != '-') radius = stof(argv[++i]);
+				settings.filter = Filter(type, radius);
+			}
+			else if (arg == "--compare") compare = true;
+		}
+		if (animation.duration() <= 0) {
+			animation.addCameraKey({ 0, { 0, 0, 0 }, -0.2f, 0 });
+			animation.addCameraKey({ 1, { 0, 0.2f, -1 }, 0, -0.05f });
+			animation.addCameraKey({ 2, { 0, 0, -2 }, 0.2f, 0 });
+		}
+
+		AnimationStats stats;
+		if (!renderAnimation(animation, settings, &stats)) return 1;
+		cout << "Rendered " << settings.frames << " frames in " << stats.seconds << " s ("
+			<< settings.frames_in_flight << " in flight)" << endl;
+		for (int f = 0; f < settings.frames; f++) {
+			float previous = f > 0 ? stats.frame_ms[f - 1] : 0;
+			cout << "  frame " << f << " : done at " << stats.frame_ms[f] << " ms (+" << std::max(stats.frame_ms[f] - previous, 0.f) << " ms)" << endl;
+		}
+
+		if (compare) {
+			// its own frames, so the ones just rendered aren't overwritten
+			AnimationSettings independent_settings = settings;
+			independent_settings.output += "_independent";
+			AnimationStats independent;
+			if (!renderAnimationIndependent(animation, independent_settings, &independent)) return 1;
+			cout << "Independent runs : " << independent.seconds << " s ("
+				<< independent.seconds / settings.frames * 1000 << " ms/frame), speedup "
+				<< independent.seconds / stats.seconds << endl;
+		}
+		return 0;
+	}
 
 	// Initialize the GLFW library
 	if (!glfwInit()) {
@@ -0,0 +1,153 @@
+
+// std
+#include <algorithm>
+
+// project
+#include "accumulation.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+void AccumulationBuffer::resize(int w, int h, AccumulationPrecision precision) {
+	m_width = w;
+	m_height = h;
+	m_precision = precision;
+
+	const size_t n = size_t(w) * h;
+	const bool doubles = precision == AccumulationPrecision::Double;
+	m_sum.assign(doubles ? 0 : 3 * n, 0.f);
+	m_compensation.assign(precision == AccumulationPrecision::Kahan ? 3 * n : 0, 0.f);
+	m_sum_double.assign(doubles ? 3 * n : 0, 0.0);
+	m_weight.assign(n, 0.0);
+	m_count.assign(n, 0);
+}
+
+
+void AccumulationBuffer::clear() {
+	fill(m_sum.begin(), m_sum.end(), 0.f);
+	fill(m_compensation.begin(), m_compensation.end(), 0.f);
+	fill(m_sum_double.begin(), m_sum_double.end(), 0.0);
+	fill(m_weight.begin(), m_weight.end(), 0.0);
+	fill(m_count.begin(), m_count.end(), 0);
+}
+
+
+void AccumulationBuffer::reset(int idx) {
+	for (int c = 0; c < 3; c++) {
+		const size_t i = plane(c) + idx;
+		if (m_precision == AccumulationPrecision::Double) {
+			m_sum_double[i] = 0;
+		} else {
+			m_sum[i] = 0;
+			if (m_precision == AccumulationPrecision::Kahan) m_compensation[i] = 0;
+		}
+	}
+	m_weight[idx] = 0;
+	m_count[idx] = 0;
+}
+
+
+void AccumulationBuffer::add(int idx, const vec3 &sample, float weight) {
+	addSum(idx, dvec3(sample) * double(weight), weight, 1);
+}
+
+
+void AccumulationBuffer::addSum(int idx, const dvec3 &sum, double weight, uint32_t count) {
+	for (int c = 0; c < 3; c++) {
+		const size_t i = plane(c) + idx;
+		switch (m_precision) {
+		case AccumulationPrecision::Double:
+			m_sum_double[i] += sum[c];
+			break;
+		case AccumulationPrecision::Kahan: {
+			// the low bits lost by the last addition are carried into the next one
+			const float y = float(sum[c]) - m_compensation[i];
+			const float t = m_sum[i] + y;
+			m_compensation[i] = (t - m_sum[i]) - y;
+			m_sum[i] = t;
+			break;
+		}
+		default:
+			m_sum[i] += float(sum[c]);
+		}
+	}
+	m_weight[idx] += weight;
+	m_count[idx] += count;
+}
+
+
+dvec3 AccumulationBuffer::sum(int idx) const {
+	dvec3 s;
+	for (int c = 0; c < 3; c++) {
+		const size_t i = plane(c) + idx;
+		if (m_precision == AccumulationPrecision::Double) s[c] = m_sum_double[i];
+		else if (m_precision == AccumulationPrecision::Kahan) s[c] = double(m_sum[i]) - m_compensation[i];
+		else s[c] = m_sum[i];
+	}
+	return s;
+}
+
+
+vec3 AccumulationBuffer::mean(int idx) const {
+	const double w = m_weight[idx];
+	return (w != 0) ? vec3(sum(idx) / w) : vec3(0);
+}
+
+
+bool AccumulationBuffer::merge(const AccumulationBuffer &other) {
+	if (other.m_width != m_width || other.m_height != m_height) return false;
+	const int n = m_width * m_height;
+#pragma omp parallel for schedule(static)
+	for (int p = 0; p < n; p++) addSum(p, other.sum(p), other.m_weight[p], other.m_count[p]);
+	return true;
+}
+
+
+void AccumulationBuffer::resolve(float *rgb) const {
+	const int n = m_width * m_height;
+#pragma omp parallel for schedule(static)
+	for (int p = 0; p < n; p++) {
+		const vec3 m = mean(p);
+		for (int c = 0; c < 3; c++) rgb[3 * size_t(p) + c] = m[c];
+	}
+}
+
+
+void AccumulationBuffer::readSums(double *sums) const {
+	const int n = m_width * m_height;
+#pragma omp parallel for schedule(static)
+	for (int p = 0; p < n; p++) {
+		const dvec3 s = sum(p);
+		for (int c = 0; c < 3; c++) sums[plane(c) + p] = s[c];
+	}
+}
+
+
+void AccumulationBuffer::load(const double *sums, const double *weights, const uint32_t *counts) {
+	const size_t n = size_t(m_width) * m_height;
+	switch (m_precision) {
+	case AccumulationPrecision::Double:
+		copy(sums, sums + 3 * n, m_sum_double.begin());
+		break;
+	case AccumulationPrecision::Kahan:
+		// the rounding of the float sum goes into the compensation (sum = m_sum - m_compensation)
+		for (size_t i = 0; i < 3 * n; i++) {
+			m_sum[i] = float(sums[i]);
+			m_compensation[i] = float(double(m_sum[i]) - sums[i]);
+		}
+		break;
+	default:
+		for (size_t i = 0; i < 3 * n; i++) m_sum[i] = float(sums[i]);
+	}
+	copy(weights, weights + n, m_weight.begin());
+	copy(counts, counts + n, m_count.begin());
+}
+
+
+size_t AccumulationBuffer::bytes() const {
+	return m_sum.size() * sizeof(float) + m_compensation.size() * sizeof(float)
+		+ m_sum_double.size() * sizeof(double) + m_weight.size() * sizeof(double)
+		+ m_count.size() * sizeof(uint32_t);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+
+// how the sums of an AccumulationBuffer are kept
+enum class AccumulationPrecision {
+	Float, // plain float sums, the error grows with the sample count
+	Kahan, // float sums with a compensation term (twice the memory)
+	Double // double sums
+};
+
+
+// Per pixel weighted sums of color samples, with their total weight
+// and sample count, stored as planes indexed like the framebuffer
+// (x + y*width). Unlike a running mean the sums can be merged exactly,
+// so partial results from other threads, tiles or machines (or an
+// earlier session) combine into the same mean as one long render.
+//
+// Different pixels can be added to from different threads at once,
+// a single pixel only from one thread at a time.
+class AccumulationBuffer {
+private:
+	int m_width = 0, m_height = 0;
+	AccumulationPrecision m_precision = AccumulationPrecision::Double;
+	std::vector<float> m_sum; // 3 planes (Float and Kahan)
+	std::vector<float> m_compensation; // 3 planes (Kahan)
+	std::vector<double> m_sum_double; // 3 planes (Double)
+	std::vector<double> m_weight;
+	std::vector<uint32_t> m_count;
+
+	size_t plane(int channel) const { return size_t(channel) * m_width * m_height; }
+
+public:
+	AccumulationBuffer() { }
+
+	// reallocates (and clears) the buffer
+	void resize(int w, int h, AccumulationPrecision precision = AccumulationPrecision::Double);
+
+	// zero every pixel
+	void clear();
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	AccumulationPrecision precision() const { return m_precision; }
+
+	// zero a single pixel
+	void reset(int idx);
+
+	// adds a sample with a weight (e.g. of a reconstruction filter)
+	void add(int idx, const glm::vec3 &sample, float weight = 1);
+
+	// adds an already weighted sum of count samples (e.g. a mean times its weight)
+	void addSum(int idx, const glm::dvec3 &sum, double weight, uint32_t count);
+
+	// weighted mean of the samples so far, black if there are none
+	glm::vec3 mean(int idx) const;
+	glm::dvec3 sum(int idx) const;
+	double weight(int idx) const { return m_weight[idx]; }
+	uint32_t count(int idx) const { return m_count[idx]; }
+
+	// adds every pixel of another buffer of the same size into this one
+	// returns false if the sizes differ
+	bool merge(const AccumulationBuffer &other);
+
+	// writes the mean of every pixel to rgb (3 floats per pixel)
+	void resolve(float *rgb) const;
+
+	// the raw planes, for saving and restoring the buffer exactly
+	// sums are 3 planes of doubles whatever the precision (compensated for Kahan)
+	void readSums(double *sums) const;
+	const double * weights() const { return m_weight.data(); }
+	const uint32_t * counts() const { return m_count.data(); }
+
+	// replaces every pixel with the given planes (laid out as above)
+	void load(const double *sums, const double *weights, const uint32_t *counts);
+
+	// memory used by the planes
+	size_t bytes() const;
+};
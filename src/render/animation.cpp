@@ -0,0 +1,287 @@
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "animation.hpp"
+#include "image_io.hpp"
+#include "image_writer.hpp"
+#include "scene/scene_object.hpp"
+#include "scene/shape.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	template <typename T>
+	T catmullRom(const T &p0, const T &p1, const T &p2, const T &p3, float u) {
+		float u2 = u * u, u3 = u2 * u;
+		return 0.5f * ((2.f * p1) + (p2 - p0) * u + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * u2 + (3.f * p1 - p0 - 3.f * p2 + p3) * u3);
+	}
+
+	// finds the 4 keys (clamped at the ends) around a time, and how far it is between the middle two
+	// keys must be sorted by time and not empty
+	template <typename Key>
+	void segment(const vector<Key> &keys, float time, int k[4], float &u) {
+		const int n = int(keys.size());
+		int i = 0;
+		while (i + 1 < n && keys[i + 1].time <= time) i++;
+		k[0] = std::max(i - 1, 0);
+		k[1] = i;
+		k[2] = std::min(i + 1, n - 1);
+		k[3] = std::min(i + 2, n - 1);
+		float span = keys[k[2]].time - keys[k[1]].time;
+		u = span > 0 ? glm::clamp((time - keys[k[1]].time) / span, 0.f, 1.f) : 0.f;
+	}
+
+	// the base scene with the animated objects moved to where they are at a time
+	// everything else (shapes, materials, lights) is shared with the base scene
+	Scene frameScene(const Scene &base, const Animation &animation, float time) {
+		auto objects = base.objects();
+		for (size_t i = 0; i < objects.size(); i++) {
+			mat4 transform;
+			if (animation.objectTransform(int(i), time, transform)) {
+				auto shape = make_shared<TransformedShape>(objects[i]->shape(), transform);
+				objects[i] = make_shared<SceneObject>(shape, objects[i]->material());
+			}
+		}
+		return Scene(objects, base.lights());
+	}
+
+	float frameTime(const Animation &animation, const AnimationSettings &settings, int frame) {
+		return animation.duration() * frame / float(std::max(settings.frames - 1, 1));
+	}
+
+	string frameFilename(const AnimationSettings &settings, int frame) {
+		ostringstream oss;
+		oss << settings.output << "_" << setw(4) << setfill('0') << frame << ".png";
+		return oss.str();
+	}
+}
+
+
+bool Animation::load(const string &filename) {
+	ifstream file(filename);
+	if (!file) {
+		cerr << "Error: Could not open animation " << filename << endl;
+		return false;
+	}
+
+	string line;
+	for (int line_number = 1; getline(file, line); line_number++) {
+		line = line.substr(0, line.find('#'));
+		istringstream ss(line);
+		string type;
+		if (!(ss >> type)) continue;
+
+		bool ok = false;
+		if (type == "camera") {
+			CameraKey key;
+			ok = bool(ss >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch);
+			if (ok) addCameraKey(key);
+		} else if (type == "object") {
+			int id;
+			ObjectKey key;
+			ok = bool(ss >> id >> key.time >> key.translation.x >> key.translation.y >> key.translation.z
+				>> key.rotation.x >> key.rotation.y >> key.rotation.z >> key.scale);
+			if (ok) addObjectKey(id, key);
+		} else if (type == "pivot") {
+			int id;
+			vec3 pivot;
+			ok = bool(ss >> id >> pivot.x >> pivot.y >> pivot.z);
+			if (ok) setPivot(id, pivot);
+		}
+
+		if (!ok) {
+			cerr << "Error: " << filename << ":" << line_number << " : could not read '" << line << "'" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+void Animation::addCameraKey(const CameraKey &key) {
+	auto it = upper_bound(m_camera_keys.begin(), m_camera_keys.end(), key.time, [](float t, const CameraKey &k) { return t < k.time; });
+	m_camera_keys.insert(it, key);
+}
+
+
+void Animation::addObjectKey(int object, const ObjectKey &key) {
+	vector<ObjectKey> &keys = m_tracks[object].keys;
+	auto it = upper_bound(keys.begin(), keys.end(), key.time, [](float t, const ObjectKey &k) { return t < k.time; });
+	keys.insert(it, key);
+}
+
+
+void Animation::setPivot(int object, const vec3 &pivot) {
+	m_tracks[object].pivot = pivot;
+}
+
+
+float Animation::duration() const {
+	float d = m_camera_keys.empty() ? 0 : m_camera_keys.back().time;
+	for (const auto &track : m_tracks) {
+		if (!track.second.keys.empty()) d = std::max(d, track.second.keys.back().time);
+	}
+	return d;
+}
+
+
+void Animation::cameraAt(float time, Camera &camera) const {
+	if (m_camera_keys.empty()) return;
+	int k[4];
+	float u;
+	segment(m_camera_keys, time, k, u);
+	const CameraKey &k0 = m_camera_keys[k[0]], &k1 = m_camera_keys[k[1]], &k2 = m_camera_keys[k[2]], &k3 = m_camera_keys[k[3]];
+	camera.setPositionOrientation(
+		catmullRom(k0.position, k1.position, k2.position, k3.position, u),
+		catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, u),
+		catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, u)
+	);
+}
+
+
+bool Animation::objectTransform(int object, float time, mat4 &transform) const {
+	auto it = m_tracks.find(object);
+	if (it == m_tracks.end() || it->second.keys.empty()) return false;
+	const Track &track = it->second;
+
+	int k[4];
+	float u;
+	segment(track.keys, time, k, u);
+	const ObjectKey &k0 = track.keys[k[0]], &k1 = track.keys[k[1]], &k2 = track.keys[k[2]], &k3 = track.keys[k[3]];
+	vec3 translation = catmullRom(k0.translation, k1.translation, k2.translation, k3.translation, u);
+	vec3 rotation = catmullRom(k0.rotation, k1.rotation, k2.rotation, k3.rotation, u);
+	float scale = catmullRom(k0.scale, k1.scale, k2.scale, k3.scale, u);
+
+	transform = translate(mat4(1), translation + track.pivot);
+	transform = rotate(transform, rotation.z, vec3(0, 0, 1));
+	transform = rotate(transform, rotation.y, vec3(0, 1, 0));
+	transform = rotate(transform, rotation.x, vec3(1, 0, 0));
+	transform = glm::scale(transform, vec3(scale));
+	transform = translate(transform, -track.pivot);
+	return true;
+}
+
+
+bool renderAnimation(const Animation &animation, const AnimationSettings &settings, AnimationStats *stats) {
+	const auto time_begin = chrono::steady_clock::now();
+	const RenderSettings &rs = settings.render;
+	const int tile = std::max(settings.tile_size, 1);
+	const int tiles_x = (rs.width + tile - 1) / tile, tiles_y = (rs.height + tile - 1) / tile;
+	const int tiles = tiles_x * tiles_y;
+	const int in_flight = std::max(settings.frames_in_flight, 1);
+
+	// built once for every frame
+	const Scene base = makeScene(settings.scene);
+	unique_ptr<Renderer> shared_renderer;
+	if (!animation.animatesObjects()) shared_renderer = make_unique<Renderer>(base, settings.integrator);
+
+	vector<float> frame_ms(settings.frames, 0);
+	ImageQueue output(settings.writer_threads, in_flight);
+
+	for (int first = 0; first < settings.frames; first += in_flight) {
+		const int count = std::min(in_flight, settings.frames - first);
+
+		// setup this batch of frames
+		vector<unique_ptr<Renderer>> renderers(count);
+		vector<Renderer *> frame_renderer(count, shared_renderer.get());
+		vector<Camera> cameras(count);
+		vector<unique_ptr<Film>> films(count);
+		vector<vector<float>> images(count);
+		unique_ptr<atomic<int>[]> tiles_left(new atomic<int>[count]);
+		for (int f = 0; f < count; f++) {
+			const float time = frameTime(animation, settings, first + f);
+			if (!shared_renderer) {
+				renderers[f] = make_unique<Renderer>(frameScene(base, animation, time), settings.integrator);
+				frame_renderer[f] = renderers[f].get();
+			}
+			cameras[f].setImageSize({ rs.width, rs.height });
+			animation.cameraAt(time, cameras[f]);
+			films[f] = make_unique<Film>(rs.width, rs.height, settings.filter);
+			images[f].resize(3 * size_t(rs.width) * rs.height);
+			tiles_left[f] = tiles;
+		}
+
+		// tiles of all frames in one loop, earlier frames first
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int j = 0; j < count * tiles; j++) {
+			const int f = j / tiles, t = j % tiles;
+			const int x = (t % tiles_x) * tile, y = (t / tiles_x) * tile;
+			const int w = std::min(tile, rs.width - x), h = std::min(tile, rs.height - y);
+
+			static thread_local FilmTile film_tile;
+			frame_renderer[f]->renderTile(cameras[f], rs, *films[f], x, y, w, h, 0, rs.samples, film_tile);
+			films[f]->mergeTile(film_tile);
+
+			// the last tile resolves the frame
+			if (--tiles_left[f] == 0) {
+				films[f]->resolve(images[f].data());
+				frame_ms[first + f] = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+			}
+		}
+
+		// written while the next batch renders, unless the writers are a
+		// whole queue behind
+		for (int f = 0; f < count; f++) {
+			output.push(frameFilename(settings, first + f), rs.width, rs.height, move(images[f]));
+		}
+	}
+	const bool written = output.finish();
+
+	if (stats) {
+		stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - time_begin).count();
+		stats->frame_ms = frame_ms;
+	}
+	return written;
+}
+
+
+bool renderAnimationIndependent(const Animation &animation, const AnimationSettings &settings, AnimationStats *stats) {
+	const auto time_begin = chrono::steady_clock::now();
+	const RenderSettings &rs = settings.render;
+	vector<float> frame_ms(settings.frames, 0);
+	bool ok = true;
+
+	for (int f = 0; f < settings.frames; f++) {
+		const float time = frameTime(animation, settings, f);
+
+		// everything from scratch, like a separate run would
+		Renderer renderer(frameScene(makeScene(settings.scene), animation, time), settings.integrator);
+		Camera camera;
+		camera.setImageSize({ rs.width, rs.height });
+		animation.cameraAt(time, camera);
+
+		Film film(rs.width, rs.height, settings.filter);
+		renderer.render(camera, rs, film, settings.tile_size);
+		vector<float> image(3 * size_t(rs.width) * rs.height);
+		film.resolve(image.data());
+		frame_ms[f] = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+
+		const string filename = frameFilename(settings, f);
+		if (!writePNG(filename, rs.width, rs.height, image.data())) {
+			cerr << "Error: Failed to write " << filename << endl;
+			ok = false;
+		}
+	}
+
+	if (stats) {
+		stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - time_begin).count();
+		stats->frame_ms = frame_ms;
+	}
+	return ok;
+}
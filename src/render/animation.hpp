@@ -0,0 +1,101 @@
+#pragma once
+
+// std
+#include <map>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "renderer.hpp"
+#include "scene/camera.hpp"
+
+
+struct CameraKey {
+	float time = 0;
+	glm::vec3 position{ 0 };
+	float yaw = 0, pitch = 0;
+};
+
+
+// transform applied to an object on top of where the scene put it
+// (scale, then rotation by euler angles xyz, both about the pivot)
+struct ObjectKey {
+	float time = 0;
+	glm::vec3 translation{ 0 };
+	glm::vec3 rotation{ 0 };
+	float scale = 1;
+};
+
+
+// Keyframed camera path and object transforms, interpolated with
+// Catmull-Rom splines (clamped at the ends).
+//
+// Text format, one key per line ('#' starts a comment) :
+//   camera <time> <x> <y> <z> <yaw> <pitch>
+//   object <id> <time> <tx> <ty> <tz> <rx> <ry> <rz> <scale>
+//   pivot <id> <x> <y> <z>
+class Animation {
+private:
+	struct Track {
+		glm::vec3 pivot{ 0 };
+		std::vector<ObjectKey> keys;
+	};
+
+	std::vector<CameraKey> m_camera_keys;
+	std::map<int, Track> m_tracks; // by object id
+
+public:
+	// returns false if the file can't be read or has a malformed line
+	bool load(const std::string &filename);
+
+	// keys can be added in any order
+	void addCameraKey(const CameraKey &key);
+	void addObjectKey(int object, const ObjectKey &key);
+	void setPivot(int object, const glm::vec3 &pivot);
+
+	// time of the last key
+	float duration() const;
+
+	bool animatesObjects() const { return !m_tracks.empty(); }
+
+	// sets the camera's position and orientation at a time
+	void cameraAt(float time, Camera &camera) const;
+
+	// object to world transform of an animated object at a time
+	// returns false if the object isn't animated
+	bool objectTransform(int object, float time, glm::mat4 &transform) const;
+};
+
+
+struct AnimationSettings {
+	int scene = 4;
+	int integrator = 2;
+	RenderSettings render;
+	int frames = 24;
+	int frames_in_flight = 4; // frames rendered at the same time
+	int writer_threads = 2;   // threads saving finished frames
+	int tile_size = 32;
+	Filter filter; // reconstruction filter, a box over each pixel by default
+	std::string output = "frame"; // frames are written to <output>_0000.png etc.
+};
+
+
+struct AnimationStats {
+	double seconds = 0;
+	std::vector<float> frame_ms; // time from the start until each frame was rendered
+};
+
+
+// Renders every frame of an animation. The scene is built once, frames
+// where objects move get a shallow copy that shares its shapes and
+// materials. Tiles of several frames are rendered at once (so no threads
+// idle at the end of a frame) while the previous frames are written out
+// through an ImageQueue.
+bool renderAnimation(const Animation &animation, const AnimationSettings &settings, AnimationStats *stats = nullptr);
+
+// The same frames rendered one after the other, each with its own scene,
+// as separate runs would (for comparison)
+bool renderAnimationIndependent(const Animation &animation, const AnimationSettings &settings, AnimationStats *stats = nullptr);
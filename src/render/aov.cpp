@@ -0,0 +1,107 @@
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "aov.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+int AOVBuffer::channels(AOV a) {
+	switch (a) {
+	case AOV::Depth: return 1;
+	case AOV::Normal: return 3;
+	case AOV::Albedo: return 3;
+	case AOV::MaterialID: return 1;
+	case AOV::ObjectID: return 1;
+	case AOV::Direct: return 3;
+	case AOV::Indirect: return 3;
+	default: return 0;
+	}
+}
+
+
+const char * AOVBuffer::name(AOV a) {
+	switch (a) {
+	case AOV::Depth: return "Depth";
+	case AOV::Normal: return "Normal";
+	case AOV::Albedo: return "Albedo";
+	case AOV::MaterialID: return "Material ID";
+	case AOV::ObjectID: return "Object ID";
+	case AOV::Direct: return "Direct";
+	case AOV::Indirect: return "Indirect";
+	default: return "";
+	}
+}
+
+
+void AOVBuffer::resize(int w, int h, unsigned mask) {
+	m_width = w;
+	m_height = h;
+	m_mask = mask;
+
+	// lay out the enabled planes one after another
+	int planes = 0;
+	for (int i = 0; i < int(AOV::Count); i++) {
+		m_offset[i] = -1;
+		if (enabled(AOV(i))) {
+			m_offset[i] = planes;
+			planes += channels(AOV(i));
+		}
+	}
+
+	m_data.assign(size_t(planes) * w * h, 0);
+}
+
+
+void AOVBuffer::setMask(unsigned mask) {
+	if (mask == m_mask) return;
+	AOVBuffer old;
+	swap(old.m_data, m_data);
+	old.m_width = m_width;
+	old.m_height = m_height;
+	old.m_mask = m_mask;
+	copy(begin(m_offset), end(m_offset), begin(old.m_offset));
+
+	resize(m_width, m_height, mask);
+	const size_t n = size_t(m_width) * m_height;
+	for (int i = 0; i < int(AOV::Count); i++) {
+		const AOV a = AOV(i);
+		if (!enabled(a) || !old.enabled(a)) continue;
+		copy(old.plane(a), old.plane(a) + channels(a) * n, plane(a));
+	}
+}
+
+
+void AOVBuffer::clear() {
+	fill(m_data.begin(), m_data.end(), 0.f);
+}
+
+
+void AOVBuffer::accumulate(int idx, const AOVSample &s, float mix_factor) {
+	const size_t n = size_t(m_width) * m_height;
+
+	auto blend = [&](AOV a, const float *values) {
+		if (!enabled(a)) return;
+		float *p = m_data.data() + m_offset[int(a)] * n + idx;
+		for (int c = 0; c < channels(a); c++, p += n) {
+			*p = mix(values[c], *p, mix_factor);
+		}
+	};
+
+	auto keep_first = [&](AOV a, float value) {
+		if (!enabled(a) || mix_factor > 0) return;
+		m_data[m_offset[int(a)] * n + idx] = value;
+	};
+
+	blend(AOV::Depth, &s.depth);
+	blend(AOV::Normal, &s.normal[0]);
+	blend(AOV::Albedo, &s.albedo[0]);
+	keep_first(AOV::MaterialID, s.material_id);
+	keep_first(AOV::ObjectID, s.object_id);
+	blend(AOV::Direct, &s.direct[0]);
+	blend(AOV::Indirect, &s.indirect[0]);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+
+// Arbitrary output variables (AOVs) that the integrators can
+// write alongside the color in the same pass
+enum class AOV {
+	Depth,      // distance to the primary hit
+	Normal,     // world-space normal of the primary hit
+	Albedo,     // diffuse color of the primary hit
+	MaterialID, // index of the material in the scene
+	ObjectID,   // index of the object in the scene
+	Direct,     // light arriving directly from the light sources
+	Indirect,   // everything else (ambient, reflections)
+	Count
+};
+
+
+// Values of every AOV for a single sample, filled in by the
+// integrators. Fields are left at their defaults on a miss.
+struct AOVSample {
+	float depth = 0;
+	glm::vec3 normal{ 0 };
+	glm::vec3 albedo{ 0 };
+	float material_id = -1;
+	float object_id = -1;
+	glm::vec3 direct{ 0 };
+	glm::vec3 indirect{ 0 };
+};
+
+
+// Planar float buffers for the enabled AOVs. Every plane is
+// indexed the same way as the main framebuffer (x + y*width)
+// and all planes share a single allocation.
+class AOVBuffer {
+private:
+	int m_width = 0, m_height = 0;
+	unsigned m_mask = 0;
+	int m_offset[int(AOV::Count)];
+	std::vector<float> m_data;
+
+public:
+	AOVBuffer() { resize(0, 0, 0); }
+
+	// bit for an AOV in the enabled mask
+	static constexpr unsigned bit(AOV a) { return 1u << unsigned(a); }
+
+	// number of float channels (planes) an AOV uses
+	static int channels(AOV a);
+
+	// display name of an AOV
+	static const char * name(AOV a);
+
+	// reallocates (and clears) the buffers for the given size and enabled mask
+	void resize(int w, int h, unsigned mask);
+
+	// changes the enabled mask at the same size, the planes of AOVs that
+	// stay enabled keep their values, newly enabled ones start at zero
+	void setMask(unsigned mask);
+
+	// zero all planes
+	void clear();
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	unsigned mask() const { return m_mask; }
+	bool enabled(AOV a) const { return m_mask & bit(a); }
+
+	// returns the plane of a channel of an AOV or nullptr if not enabled
+	float * plane(AOV a, int channel = 0) {
+		return enabled(a) ? m_data.data() + size_t(m_offset[int(a)] + channel) * m_width * m_height : nullptr;
+	}
+	const float * plane(AOV a, int channel = 0) const {
+		return enabled(a) ? m_data.data() + size_t(m_offset[int(a)] + channel) * m_width * m_height : nullptr;
+	}
+
+	// all planes as one contiguous array (for saving and loading)
+	float * data() { return m_data.data(); }
+	const float * data() const { return m_data.data(); }
+	size_t size() const { return m_data.size(); }
+
+	// blends a sample into the running mean at pixel index idx
+	// using the same mix factor as the color (n/(n+1))
+	// ids are not averaged, they are kept from the first sample
+	void accumulate(int idx, const AOVSample &s, float mix_factor);
+};
@@ -0,0 +1,1443 @@
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// glm
+#include <glm/gtc/constants.hpp>
+
+// stb
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+// platform
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// project
+#include "benchmark.hpp"
+#include "accumulation.hpp"
+#include "dirty_tiles.hpp"
+#include "film.hpp"
+#include "frame_buffer.hpp"
+#include "frame_scheduler.hpp"
+#include "image_io.hpp"
+#include "image_writer.hpp"
+#include "random.hpp"
+#include "renderer.hpp"
+#include "scene_swap.hpp"
+#include "scene/camera.hpp"
+#include "scene/material.hpp"
+#include "scene/mesh.hpp"
+#include "scene/path_tracer.hpp"
+#include "scene/scene_file.hpp"
+#include "scene/scene_object.hpp"
+#include "scene/shape.hpp"
+#include "scene/streamed_mesh.hpp"
+#include "scene/texture.hpp"
+#include "scene/texture_cache.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	// times fn (which should fill out with n values) and prints the throughput
+	void report(const string &name, vector<float> &out, const function<void()> &fn) {
+		const size_t n = out.size();
+		fn(); // warm up
+		auto begin = chrono::steady_clock::now();
+		fn();
+		double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count();
+
+		// use the output so it can't be optimized away
+		volatile float sink = 0;
+		for (float f : out) sink = sink + f;
+
+		cout << "  " << left << setw(40) << name << fixed << setprecision(3)
+			<< n / ns << " samples/ns  (" << ns / n << " ns/sample)" << endl;
+	}
+
+
+	void benchmarkRandom() {
+		const size_t n = size_t(1) << 24;
+		vector<float> out(n);
+
+		cout << "Uniform floats, " << n << " samples, single thread" << endl;
+
+		report("minstd_rand + uniform_real_distribution", out, [&]() {
+			minstd_rand gen{ 1 };
+			uniform_real_distribution<float> dist{ 0, 1 };
+			for (size_t i = 0; i < n; i++) out[i] = dist(gen);
+		});
+
+		report("PCG32", out, [&]() {
+			PCG32 gen{ 1 };
+			gen.fill(out.data(), n);
+		});
+
+		report("Xoroshiro128+", out, [&]() {
+			Xoroshiro128Plus gen{ 1 };
+			gen.fill(out.data(), n);
+		});
+
+		report("Philox4x32-10", out, [&]() {
+			Philox4x32 gen{ 1 };
+			gen.fill(out.data(), n);
+		});
+
+		report("counterUniform (stateless hash)", out, [&]() {
+			// 2 dimensions per pixel sample like the camera jitter
+			for (size_t i = 0; i < n; i += 2) counterUniform(1, uint32_t(i / 2), 0, 0, out.data() + i, 2);
+		});
+	}
+
+
+	// a big scene file of n random spheres
+	void writeSphereScene(const string &filename, int n) {
+		ofstream out(filename);
+		PCG32 gen{ 1 };
+		for (int m = 0; m < 16; m++) {
+			out << "material_chroma m" << m << " " << gen.nextFloat() << " " << gen.nextFloat() << " " << gen.nextFloat() << " 10 0.5 0\n";
+		}
+		for (int i = 0; i < n; i++) {
+			out << "sphere m" << (i % 16) << " " << 100 * gen.nextFloat() << " " << 100 * gen.nextFloat() << " " << 100 * gen.nextFloat()
+				<< " " << gen.nextFloat() << "\n";
+		}
+		out << "point_light 0 50 0 100 100 100 0.05 0.05 0.05\n";
+	}
+
+
+	void benchmarkSceneFile() {
+		const int n = 200000;
+		const string filename = "bench.scene";
+
+		writeSphereScene(filename, n);
+		remove((filename + ".cache").c_str());
+
+		cout << "Scene file with " << n << " spheres" << endl;
+
+		auto time = [&](const string &name, bool use_cache) {
+			auto begin = chrono::steady_clock::now();
+			SceneFile file;
+			bool ok = loadSceneFile(filename, file, use_cache);
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			cout << "  " << left << setw(40) << name << fixed << setprecision(1) << ms << " ms"
+				<< (ok ? "" : "  (failed)") << (file.from_cache ? "  (from cache)" : "") << endl;
+		};
+
+		time("text parse", false);
+		time("text parse + cache write", true);
+		time("cached load", true);
+
+		remove(filename.c_str());
+		remove((filename + ".cache").c_str());
+	}
+
+
+	// asks the OS to drop a file from the page cache, returns false if it can't
+	bool evictFile(const string &filename) {
+#ifndef _WIN32
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		fdatasync(fd);
+		bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		::close(fd);
+		return ok;
+#else
+		(void) filename;
+		return false;
+#endif
+	}
+
+
+	// a unit sphere with bumps, 2 * rings * segments triangles
+	void bumpySphere(int rings, int segments, vector<vec3> &positions, vector<uint32_t> &indices) {
+		positions.clear();
+		indices.clear();
+		for (int r = 0; r <= rings; r++) {
+			float theta = pi<float>() * r / rings;
+			for (int s = 0; s < segments; s++) {
+				float phi = 2 * pi<float>() * s / segments;
+				float radius = 1 + 0.05f * sin(40 * theta) * sin(40 * phi);
+				positions.push_back(radius * vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)));
+			}
+		}
+		for (int r = 0; r < rings; r++) {
+			for (int s = 0; s < segments; s++) {
+				uint32_t a = r * segments + s, b = r * segments + (s + 1) % segments;
+				for (uint32_t i : { a, b, b + segments, a, b + segments, a + segments }) indices.push_back(i);
+			}
+		}
+	}
+
+
+	// rays from all around towards the center, the same every time
+	vector<Ray> raysAtCenter(int n) {
+		vector<Ray> rays(n);
+		PCG32 gen{ 1 };
+		for (Ray &ray : rays) {
+			vec3 d = normalize(vec3(gen.nextFloat(), gen.nextFloat(), gen.nextFloat()) - 0.5f);
+			ray = Ray(-3.f * d, d);
+		}
+		return rays;
+	}
+
+
+	void benchmarkMesh() {
+		const int rings = 500, segments = 1000;
+		const string obj_filename = "bench.obj", mesh_filename = "bench.mesh";
+		{
+			vector<vec3> positions;
+			vector<uint32_t> indices;
+			bumpySphere(rings, segments, positions, indices);
+			ofstream out(obj_filename);
+			for (const vec3 &p : positions) out << "v " << p.x << " " << p.y << " " << p.z << "\n";
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				out << "f " << indices[i] + 1 << " " << indices[i + 1] + 1 << " " << indices[i + 2] + 1 << "\n";
+			}
+		}
+
+		const int n = 1 << 16;
+		const vector<Ray> rays = raysAtCenter(n);
+
+		vector<float> distances(n);
+		auto trace = [&](Mesh &mesh) {
+			for (int i = 0; i < n; i++) distances[i] = mesh.intersect(rays[i]).m_distance;
+		};
+
+		auto time = [&](const string &name, const function<shared_ptr<Mesh>()> &load) {
+			auto begin = chrono::steady_clock::now();
+			shared_ptr<Mesh> mesh = load();
+			double load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			if (!mesh) {
+				cout << "  " << left << setw(40) << name << "failed" << endl;
+				return mesh;
+			}
+			trace(*mesh);
+			double total_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			cout << "  " << left << setw(40) << name << fixed << setprecision(1)
+				<< load_ms << " ms load, " << total_ms << " ms with " << n << " rays" << endl;
+			return mesh;
+		};
+
+		cout << "Mesh with " << 2 * rings * segments << " triangles" << endl;
+
+		shared_ptr<Mesh> built = time("obj parse + BVH build", [&]() { return Mesh::loadOBJ(obj_filename); });
+		if (!built || !built->write(mesh_filename)) {
+			cerr << "Error: Failed to write " << mesh_filename << endl;
+			return;
+		}
+		vector<float> expected = distances;
+		built.reset();
+
+		if (evictFile(mesh_filename)) {
+			time("mapped, cold (not in page cache)", [&]() { return Mesh::loadBinary(mesh_filename); });
+		} else {
+			cout << "  (can't evict the file from the page cache for a cold load)" << endl;
+		}
+		time("mapped, warm", [&]() { return Mesh::loadBinary(mesh_filename); });
+
+		if (distances != expected) cerr << "Error: The mapped mesh gives different hits" << endl;
+
+		remove(obj_filename.c_str());
+		remove(mesh_filename.c_str());
+	}
+
+
+	void benchmarkStreaming() {
+		const string filename = "bench.bricks";
+		const int n = 1 << 16, batch = 1 << 14;
+		const vector<Ray> rays = raysAtCenter(n);
+
+		// reference hits with everything in memory
+		vector<float> expected(n);
+		size_t total = 0;
+		uint32_t brick_count = 0;
+		{
+			vector<vec3> positions;
+			vector<uint32_t> indices;
+			bumpySphere(500, 1000, positions, indices);
+			Mesh mesh(std::move(positions), {}, std::move(indices));
+			for (int i = 0; i < n; i++) expected[i] = mesh.intersect(rays[i]).m_distance;
+			if (!StreamedMesh::write(mesh, filename)) {
+				cerr << "Error: Failed to write " << filename << endl;
+				return;
+			}
+			shared_ptr<StreamedMesh> streamed = StreamedMesh::open(filename);
+			if (!streamed) return;
+			total = streamed->totalBytes();
+			brick_count = streamed->brickCount();
+		}
+
+		cout << "Streamed mesh with 1000000 triangles, " << brick_count << " bricks, "
+			<< fixed << setprecision(1) << total / 1048576.0 << " MB, " << n << " rays" << endl;
+		cout << "  " << left << setw(12) << "budget" << setw(28) << "one at a time" << "batches of " << batch << endl;
+
+		for (float fraction : { 1.f, 0.5f, 0.25f, 0.1f, 0.02f }) {
+			// traced twice so the cache is warmed by the first
+			auto run = [&](bool batched, BrickCache::Stats &stats) {
+				evictFile(filename);
+				shared_ptr<StreamedMesh> mesh = StreamedMesh::open(filename, size_t(fraction * total));
+				vector<float> distances(n);
+				vector<RayIntersection> hits;
+				auto begin = chrono::steady_clock::now();
+				for (int pass = 0; pass < 2; pass++) {
+					if (pass == 1) begin = chrono::steady_clock::now();
+					for (int first = 0; first < n; first += batch) {
+						if (batched) {
+							vector<Ray> slice(rays.begin() + first, rays.begin() + first + batch);
+							mesh->intersect(slice, hits);
+							for (int i = 0; i < batch; i++) distances[first + i] = hits[i].m_distance;
+						} else {
+							for (int i = first; i < first + batch; i++) distances[i] = mesh->intersect(rays[i]).m_distance;
+						}
+					}
+				}
+				double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+				stats = mesh->cache().stats();
+				if (distances != expected) cerr << "Error: The streamed mesh gives different hits" << endl;
+				return n / seconds / 1e6;
+			};
+
+			BrickCache::Stats single, batched;
+			double single_rate = run(false, single), batched_rate = run(true, batched);
+			auto describe = [](double rate, const BrickCache::Stats &stats) {
+				ostringstream oss;
+				oss << fixed << setprecision(2) << rate << " Mrays/s, " << stats.loads << " loads";
+				return oss.str();
+			};
+			cout << "  " << setw(12) << (to_string(int(fraction * 100)) + "%")
+				<< setw(28) << describe(single_rate, single) << describe(batched_rate, batched) << endl;
+		}
+
+		remove(filename.c_str());
+	}
+
+
+	// the texture storage before it was mipmapped, for comparison
+	// (linear floats, nearest lookups, wrapping each channel)
+	struct LinearTexture {
+		ivec2 size;
+		vector<float> data;
+
+		float texel(float x, float y, int n) const {
+			int mx = int(floor(x)) % size.x;
+			mx += (mx < 0) ? size.x : 0;
+			int my = int(floor(y)) % size.y;
+			my += (my < 0) ? size.y : 0;
+			return data.at(n + (mx + my * size.x) * 3);
+		}
+
+		vec3 sample(const vec2 &uv) const {
+			vec2 p = uv * vec2(size) + vec2(0.5f);
+			return vec3(texel(p.x, p.y, 0), texel(p.x, p.y, 1), texel(p.x, p.y, 2));
+		}
+	};
+
+
+	void benchmarkTexture() {
+		const int size = 2048;
+		const size_t n = size_t(1) << 22;
+
+		// noise on top of stripes, so nothing is constant
+		vector<float> rgb(size_t(size) * size * 3);
+		PCG32 gen{ 1 };
+		for (size_t i = 0; i < rgb.size(); i++) rgb[i] = 0.5f + 0.25f * sin(0.05f * float(i % (3 * size))) + 0.25f * gen.nextFloat();
+
+		LinearTexture linear{ ivec2(size), rgb };
+		Texture rgba8(size, size, rgb.data(), TextureFormat::RGBA8);
+		Texture rgba16f(size, size, rgb.data(), TextureFormat::RGBA16F);
+
+		// coherent : scanlines over a rotated, slightly minified view
+		// random : uniform over the texture
+		vector<vec2> coherent(n), random(n);
+		const int width = 2048;
+		for (size_t i = 0; i < n; i++) {
+			vec2 p = vec2(float(i % width), float(i / width)) / float(width);
+			coherent[i] = 1.5f * vec2(0.8f * p.x - 0.6f * p.y, 0.6f * p.x + 0.8f * p.y);
+			random[i] = vec2(gen.nextFloat(), gen.nextFloat());
+		}
+		const float footprint = 1.5f / width;
+
+		cout << "Texture sampling, " << size << "x" << size << ", " << n << " samples, single thread" << endl;
+		cout << "  memory per megapixel : linear float " << fixed << setprecision(2) << linear.data.size() * sizeof(float) / double(size * size)
+			<< " MB, rgba8 + mips " << rgba8.bytes() / double(size * size)
+			<< " MB, rgba16f + mips " << rgba16f.bytes() / double(size * size) << " MB" << endl;
+
+		vector<float> out(n);
+		for (int pattern = 0; pattern < 2; pattern++) {
+			const vector<vec2> &uv = pattern == 0 ? coherent : random;
+			cout << (pattern == 0 ? " coherent" : " random") << endl;
+			report("linear float, nearest (old)", out, [&]() {
+				for (size_t i = 0; i < n; i++) out[i] = linear.sample(uv[i]).x;
+			});
+			for (const Texture *t : { &rgba8, &rgba16f }) {
+				const string format = (t == &rgba8) ? "rgba8" : "rgba16f";
+				report(format + " tiled, nearest", out, [&]() {
+					for (size_t i = 0; i < n; i++) out[i] = t->sampleNearest(uv[i]).x;
+				});
+				report(format + " tiled, bilinear", out, [&]() {
+					for (size_t i = 0; i < n; i++) out[i] = t->sample(uv[i]).x;
+				});
+				report(format + " tiled, trilinear", out, [&]() {
+					for (size_t i = 0; i < n; i++) out[i] = t->sample(uv[i], footprint).x;
+				});
+			}
+		}
+	}
+
+
+	// a large textured ground plane seen at a grazing angle, sampled at the
+	// base level and at the level picked by the ray differentials
+	void benchmarkTextureLOD() {
+		const int size = 4096, width = 320, height = 240, samples = 4, reference_samples = 64;
+
+		// checks with noise, repeating every unit of the ground
+		vector<float> rgb(size_t(size) * size * 3);
+		PCG32 gen{ 1 };
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				float check = ((x / 256 + y / 256) % 2) ? 0.8f : 0.2f;
+				for (int c = 0; c < 3; c++) rgb[3 * (x + size_t(y) * size) + c] = check + 0.2f * (gen.nextFloat() - 0.5f);
+			}
+		}
+		Texture texture(size, size, rgb.data());
+
+		auto material = make_shared<Material>(vec3(1), vec3(0), 1.f);
+		Scene scene({ make_shared<SceneObject>(make_shared<AABB>(vec3(0, -1, 0), vec3(1000, 0.01f, 1000)), material) }, {});
+		Camera camera;
+		camera.setImageSize({ width, height });
+		camera.setPositionOrientation({ 0, 1, 0 }, 0.3f, 0.15f);
+
+		// the hits of every jittered sample (so only the lookups are timed)
+		struct Hit {
+			vec2 uv, duvdx, duvdy;
+			bool valid;
+		};
+		auto trace = [&](int n) {
+			vector<Hit> hits(size_t(width) * height * n);
+			PCG32 jitter{ 7 };
+			for (int p = 0; p < width * height; p++) {
+				for (int s = 0; s < n; s++) {
+					Ray ray = camera.generateRay(vec2(p % width, p / width) + vec2(jitter.nextFloat(), jitter.nextFloat()) - 0.5f);
+					RayIntersection i = scene.intersect(ray);
+					hits[size_t(p) * n + s] = { i.m_uv_coord, i.m_duvdx, i.m_duvdy, i.m_valid };
+				}
+			}
+			return hits;
+		};
+		const vector<Hit> hits = trace(samples), reference_hits = trace(reference_samples);
+
+		// a box filtered reference, from many base level samples per pixel
+		vector<vec3> reference(size_t(width) * height, vec3(0));
+		for (size_t p = 0; p < reference.size(); p++) {
+			for (int s = 0; s < reference_samples; s++) {
+				const Hit &h = reference_hits[p * reference_samples + s];
+				if (h.valid) reference[p] += texture.sample(h.uv) / float(reference_samples);
+			}
+		}
+
+		cout << "Textured ground plane, " << size << "x" << size << " texture (" << texture.levels() << " levels), "
+			<< width << "x" << height << " pixels, " << samples << " samples per pixel" << endl;
+		cout << "  " << left << setw(28) << "" << setw(16) << "ns/lookup" << setw(20) << "sample std dev" << "error vs reference" << endl;
+
+		auto run = [&](const string &name, bool lod) {
+			vector<vec3> colors(hits.size(), vec3(0));
+			auto lookup = [&]() {
+				for (size_t i = 0; i < hits.size(); i++) {
+					const Hit &h = hits[i];
+					if (h.valid) colors[i] = lod ? texture.sample(h.uv, h.duvdx, h.duvdy) : texture.sample(h.uv);
+				}
+			};
+			lookup(); // warm up
+			auto begin = chrono::steady_clock::now();
+			lookup();
+			double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / hits.size();
+
+			// noise between the samples of a pixel, and how far their mean is from the reference
+			double variance = 0, error = 0;
+			for (size_t p = 0; p < reference.size(); p++) {
+				vec3 mean(0);
+				for (int s = 0; s < samples; s++) mean += colors[p * samples + s] / float(samples);
+				for (int s = 0; s < samples; s++) variance += dot(colors[p * samples + s] - mean, colors[p * samples + s] - mean) / (3.0 * samples);
+				error += dot(mean - reference[p], mean - reference[p]) / 3.0;
+			}
+			cout << "  " << setw(28) << name << fixed << setprecision(1) << setw(16) << ns << setprecision(4)
+				<< setw(20) << sqrt(variance / reference.size()) << sqrt(error / reference.size()) << " rms" << endl;
+		};
+		run("base level (bilinear)", false);
+		run("differentials (trilinear)", true);
+	}
+
+
+	// runs fn in a child process (so each run starts from the same memory
+	// use) and returns its peak resident set in MB, or 0 if unsupported
+	double peakResidentMB(const function<void()> &fn) {
+#ifndef _WIN32
+		cout.flush();
+		pid_t pid = fork();
+		if (pid == 0) {
+			fn();
+			cout.flush();
+			_exit(0);
+		}
+		int status;
+		rusage usage;
+		if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) return 0;
+		return usage.ru_maxrss / 1024.0;
+#else
+		fn();
+		return 0;
+#endif
+	}
+
+
+	// a scene's worth of texture references to image files, many of them
+	// shared, loaded eagerly one by one and through the texture cache
+	void benchmarkTextureCache() {
+		const int files = 200, references = 600, size = 512;
+
+		vector<string> filenames;
+		vector<uint8_t> img(size_t(size) * size * 3);
+		for (int f = 0; f < files; f++) {
+			for (int y = 0; y < size; y++) {
+				for (int x = 0; x < size; x++) {
+					for (int c = 0; c < 3; c++) img[3 * (x + size_t(y) * size) + c] = uint8_t((x * (c + 1) + y * (f % 7 + 1) + 13 * f) & 0xff);
+				}
+			}
+			filenames.push_back("bench_texture_" + to_string(f) + ".png");
+			stbi_write_png(filenames.back().c_str(), size, size, 3, img.data(), size * 3);
+		}
+		vector<uint8_t>().swap(img);
+
+		// each material picks one of the files, so most are used more than once
+		vector<string> used;
+		PCG32 gen{ 3 };
+		for (int r = 0; r < references; r++) used.push_back(filenames[gen() % files]);
+
+		cout << references << " texture references to " << files << " files of " << size << "x" << size << endl;
+		cout << "  " << left << setw(28) << "" << setw(14) << "startup ms" << setw(16) << "peak RSS MB" << "decodes" << endl;
+
+		auto row = [&](const string &name, const function<size_t()> &load) {
+			// the child reports its time and decodes through a file
+			const string result = "bench_texture_result";
+			double mb = peakResidentMB([&]() {
+				auto begin = chrono::steady_clock::now();
+				size_t decodes = load();
+				double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+				ofstream(result) << ms << " " << decodes;
+			});
+			double ms = 0;
+			size_t decodes = 0;
+			ifstream(result) >> ms >> decodes;
+			remove(result.c_str());
+			cout << "  " << setw(28) << name << fixed << setprecision(1) << setw(14) << ms << setw(16);
+			if (mb > 0) cout << mb; else cout << "n/a";
+			cout << decodes << endl;
+		};
+
+		row("eager, one by one", [&]() {
+			// what materials did before, each decoding its own copy
+			vector<shared_ptr<Texture>> textures;
+			for (const string &f : used) textures.push_back(make_shared<Texture>(f));
+			return textures.size();
+		});
+		row("cache, on first use", [&]() {
+			TextureCache cache;
+			for (const string &f : used) cache.get(f);
+			return size_t(cache.stats().decodes);
+		});
+		row("cache, parallel preload", [&]() {
+			TextureCache cache;
+			cache.preload(used);
+			return size_t(cache.stats().decodes);
+		});
+		row("cache, 64 MB budget", [&]() {
+			TextureCache cache(size_t(64) << 20);
+			cache.preload(used);
+			return size_t(cache.stats().decodes);
+		});
+
+		for (const string &f : filenames) remove(f.c_str());
+	}
+
+
+	// material evaluation of hits in runs on the same material (like
+	// neighbouring camera rays), one at a time and in batches, with a
+	// batch small enough to stay in cache (evaluated over and over)
+	void benchmarkMaterial() {
+		const size_t n = size_t(1) << 12, repeats = 1024;
+		vector<float> out(n * repeats);
+
+		vector<float> rgb(size_t(1024) * 1024 * 3);
+		PCG32 gen{ 1 };
+		for (float &f : rgb) f = gen.nextFloat();
+		auto texture = make_shared<Texture>(1024, 1024, rgb.data());
+
+		vector<shared_ptr<Material>> constant, textured;
+		for (int m = 0; m < 4; m++) {
+			constant.push_back(make_shared<Material>(vec3(0.1f * m), vec3(0.5f), 10.f));
+			textured.push_back(make_shared<Material>(vec3(0.1f * m), vec3(0.5f), 10.f));
+			textured.back()->setDiffuseTexture(texture, 2);
+		}
+
+		cout << "Material evaluation, " << n << " hits in runs of 16 on 4 materials, " << repeats << " times, single thread" << endl;
+
+		vector<RayIntersection> hits(n);
+		vector<MaterialSample> samples(n);
+		auto run = [&](const string &name, const vector<shared_ptr<Material>> &materials) {
+			for (size_t i = 0; i < n; i++) {
+				hits[i].m_valid = true;
+				hits[i].m_material = materials[(i / 16) % materials.size()].get();
+				hits[i].m_uv_coord = vec2(gen.nextFloat(), gen.nextFloat());
+				hits[i].m_duvdx = vec2(0.002f, 0);
+				hits[i].m_duvdy = vec2(0, 0.002f);
+			}
+			report(name + ", one at a time", out, [&]() {
+				for (size_t r = 0; r < repeats; r++) {
+					for (size_t i = 0; i < n; i++) samples[i] = hits[i].m_material->evaluate(hits[i]);
+					out[r * n + r % n] = samples[r % n].diffuse.x;
+				}
+			});
+			report(name + ", batch", out, [&]() {
+				for (size_t r = 0; r < repeats; r++) {
+					Material::evaluate(hits.data(), n, samples.data());
+					out[r * n + r % n] = samples[r % n].diffuse.x;
+				}
+			});
+		};
+		run("constant", constant);
+		run("textured", textured);
+	}
+
+
+	// the mean of many samples per pixel, kept as a running mean (what the
+	// application did before) and as sums of each precision
+	void benchmarkAccumulation() {
+		const int pixels = 64, samples = 1 << 20, parts = 8;
+
+		// the same noisy samples for every pixel, scaled so the pixels differ
+		vector<float> noise(samples);
+		PCG32 gen{ 1 };
+		for (float &f : noise) f = 2 * gen.nextFloat() * gen.nextFloat();
+		auto sample = [&](int p, int s) { return noise[s] * (1 + 0.1f * p); };
+
+		vector<long double> exact(pixels, 0);
+		for (int p = 0; p < pixels; p++) {
+			for (int s = 0; s < samples; s++) exact[p] += sample(p, s);
+			exact[p] /= samples;
+		}
+
+		cout << "Mean of " << samples << " samples for " << pixels << " pixels, single thread" << endl;
+		cout << "  " << left << setw(24) << "" << setw(14) << "ns/sample" << "max relative error" << endl;
+
+		auto row = [&](const string &name, const function<float(int)> &mean, const function<void()> &accumulate) {
+			auto begin = chrono::steady_clock::now();
+			accumulate();
+			double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / (double(pixels) * samples);
+			double error = 0;
+			for (int p = 0; p < pixels; p++) error = std::max(error, double(abs(mean(p) - exact[p]) / exact[p]));
+			cout << "  " << setw(24) << name << fixed << setprecision(2) << setw(14) << ns << scientific << setprecision(2) << error << endl;
+		};
+
+		vector<float> running(pixels, 0);
+		row("running mean (float)", [&](int p) { return running[p]; }, [&]() {
+			for (int p = 0; p < pixels; p++) {
+				for (int s = 0; s < samples; s++) running[p] = mix(sample(p, s), running[p], s / float(s + 1));
+			}
+		});
+
+		const pair<string, AccumulationPrecision> precisions[] = {
+			{ "float sums", AccumulationPrecision::Float },
+			{ "Kahan sums", AccumulationPrecision::Kahan },
+			{ "double sums", AccumulationPrecision::Double }
+		};
+		for (const auto &precision : precisions) {
+			AccumulationBuffer buffer;
+			buffer.resize(pixels, 1, precision.second);
+			row(precision.first, [&](int p) { return buffer.mean(p).x; }, [&]() {
+				for (int p = 0; p < pixels; p++) {
+					for (int s = 0; s < samples; s++) buffer.add(p, vec3(sample(p, s)));
+				}
+			});
+		}
+
+		// the samples split into parts (like tiles of a distributed render) and merged
+		AccumulationBuffer merged;
+		merged.resize(pixels, 1);
+		row("double, merged parts", [&](int p) { return merged.mean(p).x; }, [&]() {
+			for (int part = 0; part < parts; part++) {
+				AccumulationBuffer buffer;
+				buffer.resize(pixels, 1);
+				for (int p = 0; p < pixels; p++) {
+					for (int s = part; s < samples; s += parts) buffer.add(p, vec3(sample(p, s)));
+				}
+				merged.merge(buffer);
+			}
+		});
+		cout << defaultfloat;
+	}
+
+
+	// splatting random samples into a film tile with each filter and
+	// radius, against writing each sample to its own pixel only
+	void benchmarkFilm() {
+		const int size = 32, n = 1 << 22;
+		vector<vec2> positions(n);
+		PCG32 gen{ 1 };
+		for (vec2 &p : positions) p = vec2(gen.nextFloat(), gen.nextFloat()) * float(size);
+
+		cout << "Splatting " << n << " samples into a " << size << "x" << size << " tile, single thread" << endl;
+		cout << "  " << left << setw(18) << "" << "ns/sample by radius" << endl;
+		const float radii[] = { 0.5f, 1, 1.5f, 2, 3 };
+		cout << "  " << setw(18) << "";
+		for (float r : radii) cout << setw(10) << r;
+		cout << endl;
+
+		// own pixel only, like the application and Renderer::renderTile
+		{
+			vector<float> sum(3 * size * size, 0.f), weight(size * size, 0.f);
+			auto begin = chrono::steady_clock::now();
+			for (const vec2 &p : positions) {
+				const int i = std::min(int(p.x), size - 1) + std::min(int(p.y), size - 1) * size;
+				for (int c = 0; c < 3; c++) sum[3 * i + c] += 0.5f;
+				weight[i] += 1;
+			}
+			double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / n;
+			volatile float sink = sum[0] + weight[0];
+			(void) sink;
+			cout << "  " << setw(18) << "own pixel" << fixed << setprecision(2) << ns << endl;
+		}
+
+		for (int t = 0; t < int(FilterType::Count); t++) {
+			cout << "  " << setw(18) << Filter::name(FilterType(t));
+			for (float r : radii) {
+				Film film(size, size, Filter(FilterType(t), r));
+				FilmTile tile;
+				film.startTile(0, 0, size, size, tile);
+				auto begin = chrono::steady_clock::now();
+				for (const vec2 &p : positions) tile.addSample(p, vec3(0.5f));
+				double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / n;
+				film.mergeTile(tile);
+				cout << fixed << setprecision(2) << setw(10) << ns;
+			}
+			cout << endl;
+		}
+		cout << defaultfloat;
+	}
+
+	// saving a 1080p render with its aovs in each format, and how long
+	// the background writer holds up the caller
+	void benchmarkHDR() {
+		const int w = 1920, h = 1080;
+		const size_t n = size_t(w) * h;
+
+		// smooth shading with noise, like a render after a few passes
+		vector<float> color(4 * n);
+		AOVBuffer aovs;
+		aovs.resize(w, h, AOVBuffer::bit(AOV::Depth) | AOVBuffer::bit(AOV::Normal) | AOVBuffer::bit(AOV::Albedo) | AOVBuffer::bit(AOV::ObjectID));
+		PCG32 gen{ 1 };
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				const size_t i = x + size_t(y) * w;
+				const vec3 base = vec3(x / float(w), y / float(h), 0.5f) * 4.f;
+				for (int c = 0; c < 3; c++) color[4 * i + c] = base[c] * (0.8f + 0.4f * gen.nextFloat());
+				aovs.plane(AOV::Depth)[i] = 5 + 10 * y / float(h);
+				const vec3 normal = normalize(vec3(x - w / 2, y - h / 2, 500));
+				for (int c = 0; c < 3; c++) {
+					aovs.plane(AOV::Normal, c)[i] = normal[c];
+					aovs.plane(AOV::Albedo, c)[i] = 0.25f * (1 + c + ((x / 64 + y / 64) & 1));
+				}
+				aovs.plane(AOV::ObjectID)[i] = float((x / 256) + 8 * (y / 256));
+			}
+		}
+		vector<float> rgb(3 * n);
+		for (size_t i = 0; i < n; i++) {
+			for (int c = 0; c < 3; c++) rgb[3 * i + c] = color[4 * i + c];
+		}
+
+		auto fileSize = [](const string &filename) {
+			ifstream in(filename, ios::binary | ios::ate);
+			return in ? double(in.tellg()) : 0.0;
+		};
+
+		cout << "Saving a " << w << "x" << h << " image" << endl;
+		cout << "  " << left << setw(36) << "" << setw(12) << "ms" << "MB" << endl;
+		auto row = [&](const string &name, const string &filename, const function<void()> &fn) {
+			auto begin = chrono::steady_clock::now();
+			fn();
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			cout << "  " << setw(36) << name << fixed << setprecision(1) << setw(12) << ms
+				<< setprecision(2) << fileSize(filename) / (1024 * 1024) << endl;
+			remove(filename.c_str());
+		};
+
+		row("png (8 bit, tone mapped)", "bench.png", [&]() { writePNG("bench.png", w, h, rgb.data()); });
+		row("pfm", "bench.pfm", [&]() { writePFM("bench.pfm", w, h, rgb.data()); });
+
+		vector<ImageChannel> channels;
+		for (int c = 0; c < 3; c++) channels.push_back({ string(1, "RGB"[c]), rgb.data() + c, 3 });
+		const pair<string, EXROptions> options[] = {
+			{ "exr half", { EXRPixelType::Half, false } },
+			{ "exr half zip", { EXRPixelType::Half, true } },
+			{ "exr float", { EXRPixelType::Float, false } },
+			{ "exr float zip", { EXRPixelType::Float, true } }
+		};
+		for (const auto &o : options) {
+			row(o.first, "bench.exr", [&]() { writeEXR("bench.exr", w, h, channels, o.second); });
+		}
+
+		// through the writer, with the aovs as layers and as parts
+		for (bool multipart : { false, true }) {
+			ImageWriteOptions write_options;
+			write_options.multipart = multipart;
+			ImageWriter writer;
+			// warm up, so the staging area is allocated like it is after the first save
+			writer.write("bench", w, h, color.data(), 4, &aovs, write_options);
+			writer.wait();
+
+			double blocked = 0;
+			row(multipart ? "writer, half zip + aovs as parts" : "writer, half zip + aovs as layers", "bench.exr", [&]() {
+				auto begin = chrono::steady_clock::now();
+				writer.write("bench", w, h, color.data(), 4, &aovs, write_options);
+				blocked = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+				writer.wait();
+			});
+			cout << "    " << setw(34) << "caller blocked for" << fixed << setprecision(1) << blocked << endl;
+		}
+		cout << defaultfloat;
+	}
+
+	// saving a sequence of 4k frames as pngs, stb_image_write against
+	// the parallel encoder, and through the writer queue
+	// small flat images are checked first, their matches run to the end
+	// of the data (run under asan to catch reads past it)
+	bool benchmarkPNG() {
+		// (black, so dithering leaves every byte zero)
+		int bad = 0;
+		for (int h = 1; h <= 5; h++) {
+			for (int w = 1; w < 40; w++) {
+				const vector<float> flat(3 * size_t(w) * h, 0.f);
+				vector<unsigned char> png;
+				encodePNG(w, h, flat.data(), 1, png);
+				int dw, dh, dn;
+				unsigned char *decoded = stbi_load_from_memory(png.data(), int(png.size()), &dw, &dh, &dn, 3);
+				bool ok = decoded && dw == w && dh == h;
+				for (int i = 0; ok && i < 3 * w * h; i++) ok = decoded[i] == 0;
+				if (decoded) stbi_image_free(decoded);
+				bad += !ok;
+			}
+		}
+		cout << "Flat images 1-39 x 1-5 : " << (bad ? to_string(bad) + " decoded wrong" : string("ok")) << endl;
+		if (bad) cerr << "Error: encodePNG wrote images that don't decode to their pixels" << endl;
+
+		const int w = 3840, h = 2160, frames = 8;
+		const size_t n = size_t(w) * h;
+
+		// smooth shading with noise, like a render after a few passes
+		vector<float> rgb(3 * n);
+		PCG32 gen{ 1 };
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				const vec3 base = vec3(x / float(w), y / float(h), 0.5f) * (((x / 256 + y / 256) & 1) ? 2.f : 0.5f);
+				for (int c = 0; c < 3; c++) rgb[3 * (x + size_t(y) * w) + c] = base[c] * (0.9f + 0.2f * gen.nextFloat());
+			}
+		}
+
+		auto fileSize = [](const string &filename) {
+			ifstream in(filename, ios::binary | ios::ate);
+			return in ? double(in.tellg()) : 0.0;
+		};
+
+		cout << "Saving " << frames << " " << w << "x" << h << " frames as pngs" << endl;
+		cout << "  " << left << setw(36) << "" << setw(12) << "ms/frame" << setw(12) << "frames/s" << "MB" << endl;
+		auto row = [&](const string &name, const function<void()> &fn) {
+			auto begin = chrono::steady_clock::now();
+			fn();
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() / frames;
+			cout << "  " << setw(36) << name << fixed << setprecision(1) << setw(12) << ms << setprecision(2) << setw(12) << 1000 / ms
+				<< fileSize("bench_0.png") / (1024 * 1024) << endl;
+			for (int f = 0; f < frames; f++) remove(("bench_" + to_string(f) + ".png").c_str());
+		};
+
+		// how the frames were written before, tone mapped with a pow and
+		// exp per value and saved with stb_image_write one after another
+		row("stb_image_write, sequential", [&]() {
+			vector<unsigned char> data(3 * n);
+			for (int f = 0; f < frames; f++) {
+				for (size_t i = 0; i < 3 * n; i++) data[i] = (unsigned char)(std::round(255 * pow(1 - exp(-std::max(rgb[i], 0.f)), 0.45f)));
+				stbi_write_png(("bench_" + to_string(f) + ".png").c_str(), w, h, 3, data.data(), w * 3);
+			}
+		});
+
+		row("writePNG, sequential", [&]() {
+			for (int f = 0; f < frames; f++) writePNG("bench_" + to_string(f) + ".png", w, h, rgb.data());
+		});
+
+		for (int threads : { 1, 2, 4 }) {
+			row("ImageQueue, " + to_string(threads) + " writer threads", [&]() {
+				ImageQueue queue(threads, 4);
+				for (int f = 0; f < frames; f++) queue.push("bench_" + to_string(f) + ".png", w, h, rgb);
+				queue.finish();
+			});
+		}
+		cout << defaultfloat;
+		return bad == 0;
+	}
+
+	// the cpu side of the display upload at 4k, copying the whole frame
+	// every display frame against copying only the tiles written since
+	// the last one (pixels are written in shuffled order, like a render)
+	void benchmarkUpload() {
+		const int w = 3840, h = 2160, frames = 20;
+		const int n = w * h;
+		vector<vec4> image(n, vec4(0.5f)), pbo(n);
+		vector<int> order(n);
+		for (int i = 0; i < n; i++) order[i] = i;
+		PCG32 gen{ 1 };
+		for (int i = n - 1; i > 0; i--) swap(order[i], order[gen() % uint32_t(i + 1)]);
+
+		DirtyTiles dirty;
+		dirty.resize(w, h);
+		vector<int> tiles;
+
+		// the same order grouped by tile, like the application's tile order
+		vector<int> tiled;
+		{
+			vector<vector<int>> by_tile(dirty.tiles());
+			for (int idx : order) {
+				const int t = (idx % w) / dirty.tileSize() + (idx / w / dirty.tileSize()) * ((w + dirty.tileSize() - 1) / dirty.tileSize());
+				by_tile[t].push_back(idx);
+			}
+			vector<int> tile_order(dirty.tiles());
+			for (int t = 0; t < dirty.tiles(); t++) tile_order[t] = t;
+			for (int t = dirty.tiles() - 1; t > 0; t--) swap(tile_order[t], tile_order[gen() % uint32_t(t + 1)]);
+			for (int t : tile_order) tiled.insert(tiled.end(), by_tile[t].begin(), by_tile[t].end());
+		}
+
+		cout << "Display upload of a " << w << "x" << h << " frame (16 bytes/pixel), main thread" << endl;
+		cout << "  " << left << setw(28) << "pixels written per frame" << setw(16) << "full ms" << setw(16) << "full MB" << setw(16) << "tiles ms" << setw(16) << "tiles MB" << "tiles" << endl;
+		for (int mode = 0; mode < 2; mode++)
+		for (int written : { 0, 1000, 10000, 100000, 1000000 }) {
+			const vector<int> &writes = mode ? tiled : order;
+			if (written == 0 && mode) continue;
+			double full_ms = 0, tile_ms = 0, tile_bytes = 0;
+			size_t tile_count = 0;
+			dirty.collect(tiles);
+			for (int f = 0; f < frames; f++) {
+				// the render threads' writes since the last frame
+				for (int i = 0; i < written; i++) {
+					const int idx = writes[(size_t(f) * written + i) % n];
+					image[idx] = vec4(float(f));
+					dirty.mark(idx);
+				}
+
+				auto begin = chrono::steady_clock::now();
+				copy(image.begin(), image.end(), pbo.begin());
+				full_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+
+				// the same choice as Application::uploadTiles
+				begin = chrono::steady_clock::now();
+				dirty.collect(tiles);
+				if (tiles.size() * 2 > size_t(dirty.tiles())) {
+					copy(image.begin(), image.end(), pbo.begin());
+					tile_bytes += double(n) * sizeof(vec4);
+				} else {
+					size_t offset = 0;
+					for (int t : tiles) {
+						int x, y, tw, th;
+						dirty.rect(t, x, y, tw, th);
+						for (int row = 0; row < th; row++) {
+							const vec4 *src = image.data() + x + size_t(y + row) * w;
+							copy(src, src + tw, pbo.data() + offset + size_t(row) * tw);
+						}
+						offset += size_t(tw) * th;
+					}
+					tile_bytes += double(offset) * sizeof(vec4);
+				}
+				tile_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+				tile_count += tiles.size();
+			}
+			const double mb = 1024.0 * 1024.0 * frames;
+			cout << "  " << setw(28) << (to_string(written) + (mode ? " (tile order)" : "")) << fixed << setprecision(2) << setw(16) << full_ms / frames << setw(16) << double(n) * sizeof(vec4) * frames / mb
+				<< setw(16) << tile_ms / frames << setw(16) << tile_bytes / mb << tile_count / frames << "/" << dirty.tiles() << endl;
+		}
+
+		// what marking adds to every pixel a render thread writes
+		auto begin = chrono::steady_clock::now();
+		for (int i = 0; i < n; i++) image[order[i]] = vec4(1);
+		const double plain = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / n;
+		begin = chrono::steady_clock::now();
+		for (int i = 0; i < n; i++) {
+			image[order[i]] = vec4(2);
+			dirty.mark(order[i]);
+		}
+		const double marked = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / n;
+		cout << "  pixel write " << plain << " ns, with the mark " << marked << " ns" << endl;
+		cout << defaultfloat;
+	}
+
+	// what the handoff to the display costs the render threads: single
+	// writes and reads at 4k, then traced frames written by every core
+	// while another thread keeps reading the whole frame like the display,
+	// then a check of the progressive preview's upsampling fills (no pixel
+	// read torn, no traced pixel overwritten by a coarser fill)
+	bool benchmarkFrameBuffer() {
+		{
+			const int n = 3840 * 2160;
+			vector<int> order(n);
+			for (int i = 0; i < n; i++) order[i] = i;
+			PCG32 gen{ 1 };
+			for (int i = n - 1; i > 0; i--) swap(order[i], order[gen() % uint32_t(i + 1)]);
+
+			vector<FramePixel> plain(n), copied(n);
+			FrameBuffer shared;
+			shared.resize(n);
+
+			auto time = [&](const function<void()> &fn) {
+				auto begin = chrono::steady_clock::now();
+				fn();
+				return chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count();
+			};
+			const double plain_write = time([&]() { for (int i = 0; i < n; i++) plain[order[i]] = { 1, 2, 3, 4 }; }) / n;
+			const double shared_write = time([&]() { for (int i = 0; i < n; i++) shared.write(order[i], { 1, 2, 3, 4 }); }) / n;
+			const double plain_read = time([&]() { copied = plain; }) / 1e6;
+			const double shared_read = time([&]() { shared.read(copied); }) / 1e6;
+
+			cout << "Pixel handoff, 3840x2160, single thread" << endl;
+			cout << "  " << left << setw(28) << "" << setw(24) << "scattered write ns" << "whole frame read ms" << endl;
+			cout << "  " << setw(28) << "plain vector" << fixed << setprecision(2) << setw(24) << plain_write << plain_read << endl;
+			cout << "  " << setw(28) << "frame buffer" << setw(24) << shared_write << shared_read << endl;
+			cout << defaultfloat;
+		}
+
+		Scene scene = Scene::cornellBoxScene();
+		CorePathTracer tracer(&scene);
+		const int width = 640, height = 360, n = width * height, frames = 4;
+		const int threads = std::max(int(thread::hardware_concurrency()), 1);
+		Camera camera;
+		camera.setImageSize({ width, height });
+
+		vector<FramePixel> plain(n);
+		FrameBuffer shared;
+		shared.resize(n);
+
+		// frames traced by every core taking 64 pixels at a time (like the
+		// render loop), returns ms per frame
+		auto render = [&](const function<void(int, const FramePixel &)> &write) {
+			auto begin = chrono::steady_clock::now();
+			for (int f = 0; f < frames; f++) {
+				atomic<int> next{ 0 };
+				vector<thread> workers;
+				for (int t = 0; t < threads; t++) {
+					workers.emplace_back([&, f]() {
+						for (int i0 = next.fetch_add(64); i0 < n; i0 = next.fetch_add(64)) {
+							for (int i = i0; i < std::min(i0 + 64, n); i++) {
+								AOVSample aov;
+								vec3 c = tracer.sampleRay(camera.generateRay(vec2(i % width, i / width) + 0.5f), 2, aov);
+								write(i, { c.r, c.g, c.b, float(f) });
+							}
+						}
+					});
+				}
+				for (thread &worker : workers) worker.join();
+			}
+			return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() / frames;
+		};
+
+		cout << "Traced " << width << "x" << height << " frames, " << threads << " render threads" << endl;
+		cout << "  " << left << setw(36) << "" << setw(16) << "ms/frame" << setw(16) << "Mpixels/s" << "display reads" << endl;
+		auto row = [&](const string &name, double ms, int reads) {
+			cout << "  " << setw(36) << name << fixed << setprecision(2) << setw(16) << ms << setw(16) << n / ms / 1000 << reads << endl;
+			cout << defaultfloat;
+		};
+		row("plain vector, no display", render([&](int i, const FramePixel &p) { plain[i] = p; }), 0);
+		row("frame buffer, no display", render([&](int i, const FramePixel &p) { shared.write(i, p); }), 0);
+
+		// a display thread reading whole frames as fast as it can, every
+		// pixel it gets has to be from a single write
+		shared.resize(n);
+		atomic<bool> done{ false };
+		int reads = 0;
+		size_t torn = 0;
+		thread display([&]() {
+			vector<FramePixel> frame;
+			while (!done) {
+				shared.read(frame);
+				for (const FramePixel &p : frame) torn += !(p.r == p.g && p.g == p.b && p.b == p.time);
+				reads++;
+			}
+		});
+		const double ms = render([&](int i, const FramePixel &p) {
+			// the same value four times, different for every write
+			const float v = p.time * 8 + float(i % 7 + 1);
+			shared.write(i, { v, v, v, v });
+		});
+		done = true;
+		display.join();
+		row("frame buffer, display reading", ms, reads);
+		cout << "  torn pixels read: " << torn << endl;
+
+		// the preview's coarse-to-fine order (every 8th, 4th, 2nd pixel then
+		// the rest) with each traced pixel filled over the rest of its block,
+		// stamped with pass * 5 + level like the application does
+		const int levels = 4, stamps = levels + 1, passes = 200;
+		const int fill_width = 256, fill_height = 128, fill_n = fill_width * fill_height;
+		auto level = [&](int idx) {
+			const int x = idx % fill_width, y = idx / fill_width;
+			for (int l = 0; l < levels - 1; l++) {
+				const int step = 1 << (levels - 1 - l);
+				if (x % step == 0 && y % step == 0) return l;
+			}
+			return levels - 1;
+		};
+		vector<int> pyramid, level_end(levels);
+		{
+			vector<int> shuffled(fill_n);
+			for (int i = 0; i < fill_n; i++) shuffled[i] = i;
+			PCG32 gen{ 2 };
+			for (int i = fill_n - 1; i > 0; i--) swap(shuffled[i], shuffled[gen() % uint32_t(i + 1)]);
+			for (int l = 0; l < levels; l++) {
+				for (int idx : shuffled) if (level(idx) == l) pyramid.push_back(idx);
+				level_end[l] = int(pyramid.size());
+			}
+		}
+
+		FrameBuffer fill_buffer;
+		fill_buffer.resize(fill_n);
+		vector<atomic<int>> fill_stamp(fill_n);
+		for (atomic<int> &stamp : fill_stamp) stamp = -1;
+
+		// pixels are (source pixel, pass, traced, checksum)
+		const int fill_threads = std::max(threads, 8);
+		size_t fill_torn = 0, overwritten = 0;
+		atomic<bool> fill_done{ false };
+		thread fill_display([&]() {
+			vector<FramePixel> frame;
+			while (!fill_done) {
+				fill_buffer.read(frame);
+				for (const FramePixel &p : frame) fill_torn += p.r + p.g + p.b != p.time;
+			}
+		});
+		for (int pass = 1; pass <= passes; pass++) {
+			atomic<int> next{ 0 };
+			vector<thread> workers;
+			for (int t = 0; t < fill_threads; t++) {
+				workers.emplace_back([&]() {
+					for (int i0 = next.fetch_add(64); i0 < fill_n; i0 = next.fetch_add(64)) {
+						for (int i = i0; i < std::min(i0 + 64, fill_n); i++) {
+							const int idx = pyramid[i];
+							const FramePixel traced = { float(idx), float(pass), 1, float(idx + pass + 1) };
+							fill_stamp[idx] = pass * stamps + levels;
+							fill_buffer.write(idx, traced);
+
+							int l = 0;
+							while (l < levels - 1 && i >= level_end[l]) l++;
+							if (l == levels - 1) continue;
+							const FramePixel filled = { float(idx), float(pass), 0, float(idx + pass) };
+							const int block = 1 << (levels - 1 - l);
+							const int x0 = idx % fill_width, y0 = idx / fill_width;
+							for (int y = y0; y < std::min(y0 + block, fill_height); y++) {
+								for (int x = x0; x < std::min(x0 + block, fill_width); x++) {
+									const int q = x + y * fill_width;
+									fill_buffer.writeIf(q, filled, [&]() {
+										int stamp = fill_stamp[q];
+										do {
+											if (stamp / stamps == pass && stamp % stamps >= l) return false;
+										} while (!fill_stamp[q].compare_exchange_weak(stamp, pass * stamps + l));
+										return true;
+									});
+								}
+							}
+						}
+					}
+				});
+			}
+			for (thread &worker : workers) worker.join();
+
+			// every pixel was traced this pass, so each has to hold its own sample
+			for (int q = 0; q < fill_n; q++) {
+				const FramePixel p = fill_buffer.read(q);
+				overwritten += !(p.r == q && p.g == pass && p.b == 1);
+			}
+		}
+		fill_done = true;
+		fill_display.join();
+		cout << "Progressive fills, " << fill_width << "x" << fill_height << ", " << passes << " passes, " << fill_threads << " threads" << endl;
+		cout << "  torn pixels read: " << fill_torn << ", traced pixels overwritten: " << overwritten << endl;
+
+		const bool ok = torn == 0 && fill_torn == 0 && overwritten == 0;
+		if (!ok) cerr << "Error: The frame buffer handoff lost or tore pixels" << endl;
+		return ok;
+	}
+
+
+	// how long the gui thread is blocked when switching to a big scene
+	// while a render thread is running: stopping the render and building
+	// the scene on the gui thread, against building it in the background
+	// and swapping it in between passes
+	void benchmarkSceneSwap() {
+		const int n = 200000;
+		const string filename = "bench_swap.scene";
+		writeSphereScene(filename, n);
+
+		const int width = 160, height = 90;
+		Camera camera;
+		camera.setImageSize({ width, height });
+		auto cornellBox = []() {
+			SceneHandle handle;
+			handle.scene = make_shared<Scene>(Scene::cornellBoxScene());
+			handle.pathtracer = makePathTracer(1, handle.scene.get());
+			return handle;
+		};
+		auto build = [&](SceneFile &file) { return loadSceneFile(filename, file, false); };
+
+		// passes of a small frame, checking for an exit every row like the
+		// render loop and for a new scene between passes
+		SceneSwap swap;
+		atomic<bool> exit{ false };
+		atomic<int> passes{ 0 };
+		auto render = [&](SceneHandle handle) {
+			while (!exit) {
+				swap.take(handle);
+				for (int y = 0; y < height && !exit; y++) {
+					for (int x = 0; x < width; x++) handle.pathtracer->sampleRay(camera.generateRay(vec2(x, y) + 0.5f), 2);
+				}
+				passes++;
+			}
+		};
+
+		cout << "Switching to a scene of " << n << " spheres (text, no cache) while rendering " << width << "x" << height << " passes" << endl;
+		cout << "  " << left << setw(28) << "" << setw(20) << "gui blocked ms" << setw(20) << "switch ms" << "old scene passes" << endl;
+
+		// stop, build on the gui thread, restart
+		{
+			thread renderer(render, cornellBox());
+			this_thread::sleep_for(200ms);
+			const auto begin = chrono::steady_clock::now();
+			exit = true;
+			renderer.join();
+			SceneFile file;
+			build(file);
+			SceneHandle handle;
+			handle.scene = make_shared<Scene>(move(file.scene));
+			handle.pathtracer = makePathTracer(1, handle.scene.get());
+			exit = false;
+			renderer = thread(render, handle);
+			const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			cout << "  " << setw(28) << "stop and build" << fixed << setprecision(2) << setw(20) << ms << setw(20) << ms << 0 << endl;
+			exit = true;
+			renderer.join();
+			exit = false;
+		}
+
+		// build in the background, the gui polls once a frame (60 Hz)
+		{
+			SceneLoader loader;
+			thread renderer(render, cornellBox());
+			this_thread::sleep_for(200ms);
+			auto begin = chrono::steady_clock::now();
+			loader.load(build);
+			double blocked = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			const int passes_before = passes;
+			bool published = false;
+			while (!published || swap.pending()) {
+				this_thread::sleep_for(16ms);
+				const auto frame = chrono::steady_clock::now();
+				LoadedScene loaded;
+				if (loader.poll(loaded)) {
+					swap.publish({ loaded.scene, makePathTracer(1, loaded.scene.get()) });
+					published = true;
+				}
+				blocked = std::max(blocked, chrono::duration<double, milli>(chrono::steady_clock::now() - frame).count());
+			}
+			const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+			cout << "  " << setw(28) << "background and swap" << fixed << setprecision(2) << setw(20) << blocked << setw(20) << ms << passes - passes_before << endl;
+			exit = true;
+			renderer.join();
+		}
+		cout << defaultfloat;
+
+		remove(filename.c_str());
+	}
+
+
+	// preview frames of a moving camera, stopping a frame 30 ms in (the
+	// old preview) against planning frames to a budget, with the scene
+	// getting more expensive (deeper rays) halfway through
+	void benchmarkSchedule() {
+		const int width = 640, height = 360, n = width * height;
+		const int frames = 120;
+		Scene scene = Scene::cornellBoxScene();
+		unique_ptr<PathTracer> pathtracer = makePathTracer(1, &scene);
+		Camera camera;
+		camera.setImageSize({ width, height });
+
+		vector<int> order(n);
+		iota(order.begin(), order.end(), 0);
+		shuffle(order.begin(), order.end(), PCG32());
+
+		auto trace = [&](int frame, int idx) {
+			const int depth = (frame < frames / 2) ? 1 : 4;
+			return pathtracer->sampleRay(camera.generateRay(vec2(idx % width, idx / width) + 0.5f), depth);
+		};
+		auto move = [&](int frame) { camera.setPositionOrientation(vec3(sin(frame * 0.1f), 0, 20), 0.05f * sin(frame * 0.1f), 0); };
+
+		cout << "Preview frames of the cornell box at " << width << "x" << height << ", moving every frame, ray depth 1 then 4 (1 thread)" << endl;
+		cout << "  " << left << setw(24) << "" << setw(12) << "p50 ms" << setw(12) << "p95 ms" << setw(12) << "p99 ms" << setw(16) << "over target" << "traced (depth 1 / 4)" << endl;
+		auto row = [&](const string &name, float target, vector<float> times, const vector<int> &traced) {
+			int over = 0;
+			for (float t : times) over += t > target * 1.1f;
+			double traced_a = 0, traced_b = 0;
+			for (int f = 0; f < frames; f++) (f < frames / 2 ? traced_a : traced_b) += traced[f];
+			sort(times.begin(), times.end());
+			auto p = [&](int q) { return times[std::min(size_t(q * times.size() / 100), times.size() - 1)]; };
+			cout << "  " << setw(24) << name << fixed << setprecision(1) << setw(12) << p(50) << setw(12) << p(95) << setw(12) << p(99);
+			cout << setw(16) << (to_string(over) + "/" + to_string(frames)) << traced_a / (n * frames / 2) * 100 << "% / " << traced_b / (n * frames / 2) * 100 << "%" << endl;
+			cout << defaultfloat;
+		};
+
+		// checking the time every 256 pixels and stopping after 30 ms
+		{
+			vector<float> times;
+			vector<int> traced;
+			for (int f = 0; f < frames; f++) {
+				move(f);
+				const auto begin = chrono::steady_clock::now();
+				int i = 0;
+				for (; i < n; i++) {
+					trace(f, order[(i + f * 9001) % n]);
+					if ((i & 0xFF) == 0 && chrono::steady_clock::now() - begin > 30ms) break;
+				}
+				times.push_back(float((chrono::steady_clock::now() - begin) / 1.0ms));
+				traced.push_back(std::min(i + 1, n));
+			}
+			row("stop after 30 ms", 30, times, traced);
+		}
+
+		// the scheduler, a frame traces what is predicted to fit (and stops
+		// past the deadline like a preview frame whose view moved)
+		for (float rate : { 30.f, 60.f }) {
+			FrameScheduler scheduler;
+			scheduler.resize(width, height, 1);
+			scheduler.setBudget(1000 / rate);
+			vector<float> times;
+			vector<int> traced;
+			for (int f = 0; f < frames; f++) {
+				move(f);
+				const auto begin = chrono::steady_clock::now();
+				const FrameScheduler::Plan plan = scheduler.plan(order, f * 9001, 0);
+				const auto deadline = begin + chrono::duration<float, milli>(scheduler.budget() * FrameScheduler::deadline);
+				const auto loop_begin = chrono::steady_clock::now();
+				int i = 0;
+				for (; i < plan.pixels; i++) {
+					const auto pixel_begin = chrono::steady_clock::now();
+					const int idx = order[(i + f * 9001) % n];
+					trace(f, idx);
+					scheduler.record(0, idx, float((chrono::steady_clock::now() - pixel_begin) / 1.0ns));
+					if ((i & 0xFF) == 0 && chrono::steady_clock::now() > deadline) {
+						i++;
+						break;
+					}
+				}
+				const float pixel_ms = float((chrono::steady_clock::now() - loop_begin) / 1.0ms);
+				scheduler.finishPixels(pixel_ms);
+				const float ms = float((chrono::steady_clock::now() - begin) / 1.0ms);
+				scheduler.finishFrame(ms, pixel_ms);
+				times.push_back(ms);
+				traced.push_back(i);
+			}
+			ostringstream name;
+			name << "scheduled, " << rate << " Hz";
+			row(name.str(), scheduler.budget(), times, traced);
+		}
+	}
+}
+
+
+bool runBenchmark(const string &name, bool &passed) {
+	passed = true;
+	if (name == "rng") {
+		benchmarkRandom();
+		return true;
+	}
+	if (name == "scene") {
+		benchmarkSceneFile();
+		return true;
+	}
+	if (name == "mesh") {
+		benchmarkMesh();
+		return true;
+	}
+	if (name == "stream") {
+		benchmarkStreaming();
+		return true;
+	}
+	if (name == "texture") {
+		benchmarkTexture();
+		return true;
+	}
+	if (name == "lod") {
+		benchmarkTextureLOD();
+		return true;
+	}
+	if (name == "textures") {
+		benchmarkTextureCache();
+		return true;
+	}
+	if (name == "material") {
+		benchmarkMaterial();
+		return true;
+	}
+	if (name == "accumulate") {
+		benchmarkAccumulation();
+		return true;
+	}
+	if (name == "film") {
+		benchmarkFilm();
+		return true;
+	}
+	if (name == "hdr") {
+		benchmarkHDR();
+		return true;
+	}
+	if (name == "png") {
+		passed = benchmarkPNG();
+		return true;
+	}
+	if (name == "upload") {
+		benchmarkUpload();
+		return true;
+	}
+	if (name == "framebuffer") {
+		passed = benchmarkFrameBuffer();
+		return true;
+	}
+	if (name == "swap") {
+		benchmarkSceneSwap();
+		return true;
+	}
+	if (name == "schedule") {
+		benchmarkSchedule();
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// std
+#include <string>
+
+
+// Microbenchmarks for parts of the render pipeline that can run
+// without a window. Run with "--bench <name>" on the command line.
+// Returns false if there is no benchmark with that name, passed is
+// false if a benchmark that checks its results got a wrong one.
+bool runBenchmark(const std::string &name, bool &passed);
@@ -0,0 +1,190 @@
+
+// std
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// project
+#include "checkpoint.hpp"
+
+
+using namespace std;
+
+
+namespace {
+
+	const char magic[8] = { 'R', 'T', 'C', 'H', 'K', 'P', 'T', 0 };
+	const uint32_t version = 3;
+
+	// sections are page aligned for mapping
+	const uint64_t alignment = 4096;
+
+	uint64_t align(uint64_t x) {
+		return (x + alignment - 1) / alignment * alignment;
+	}
+
+	// on-disk header, fixed size fields only
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t width, height;
+		uint32_t passes;
+		uint32_t target_samples;
+		int32_t ray_depth;
+		uint32_t deterministic;
+		int32_t seed;
+		float camera[5]; // position, yaw, pitch
+		uint32_t scene_objects, scene_lights;
+		uint32_t aov_mask, user_aov_mask;
+		uint64_t color_offset;
+		uint64_t moment_offset;
+		uint64_t sum_offset;
+		uint64_t weight_offset;
+		uint64_t count_offset;
+		uint64_t aov_offset;
+		uint64_t aov_floats;
+		uint64_t file_size;
+	};
+}
+
+
+bool CheckpointWriter::write(const string &filename, const CheckpointState &state,
+	const float *color, const float *moment, const AccumulationBuffer &accumulation,
+	const float *aovs, size_t aov_floats) {
+	if (m_busy) return false;
+	if (m_thread.joinable()) m_thread.join();
+
+	const auto time_begin = chrono::steady_clock::now();
+	const uint64_t n = uint64_t(state.width) * state.height;
+
+	Header h;
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = version;
+	h.width = state.width;
+	h.height = state.height;
+	h.passes = state.passes;
+	h.target_samples = state.target_samples;
+	h.ray_depth = state.ray_depth;
+	h.deterministic = state.deterministic;
+	h.seed = state.seed;
+	h.camera[0] = state.camera_position.x;
+	h.camera[1] = state.camera_position.y;
+	h.camera[2] = state.camera_position.z;
+	h.camera[3] = state.camera_yaw;
+	h.camera[4] = state.camera_pitch;
+	h.scene_objects = state.scene_objects;
+	h.scene_lights = state.scene_lights;
+	h.aov_mask = state.aov_mask;
+	h.user_aov_mask = state.user_aov_mask;
+	h.color_offset = align(sizeof(Header));
+	h.moment_offset = align(h.color_offset + 4 * n * sizeof(float));
+	h.sum_offset = align(h.moment_offset + n * sizeof(float));
+	h.weight_offset = align(h.sum_offset + 3 * n * sizeof(double));
+	h.count_offset = align(h.weight_offset + n * sizeof(double));
+	h.aov_offset = align(h.count_offset + n * sizeof(uint32_t));
+	h.aov_floats = aov_floats;
+	h.file_size = h.aov_offset + aov_floats * sizeof(float);
+
+	// the staging buffer is an image of the file, this copy is
+	// the only part that holds up the render
+	m_staging.resize(h.file_size);
+	char *data = m_staging.data();
+	memcpy(data, &h, sizeof(Header));
+	memcpy(data + h.color_offset, color, 4 * n * sizeof(float));
+	memcpy(data + h.moment_offset, moment, n * sizeof(float));
+	accumulation.readSums(reinterpret_cast<double *>(data + h.sum_offset));
+	memcpy(data + h.weight_offset, accumulation.weights(), n * sizeof(double));
+	memcpy(data + h.count_offset, accumulation.counts(), n * sizeof(uint32_t));
+	if (aov_floats) memcpy(data + h.aov_offset, aovs, aov_floats * sizeof(float));
+
+	m_busy = true;
+	m_thread = thread([this, filename, time_begin]() {
+		// write to a temporary and swap it in, so a crash mid-write
+		// leaves the previous checkpoint intact
+		const string temp = filename + ".tmp";
+		bool ok = false;
+		{
+			ofstream out(temp, ios::binary | ios::trunc);
+			ok = bool(out.write(m_staging.data(), streamsize(m_staging.size())));
+		}
+		if (ok) {
+#ifdef _WIN32
+			// rename doesn't replace existing files on windows
+			remove(filename.c_str());
+#endif
+			ok = rename(temp.c_str(), filename.c_str()) == 0;
+		}
+		if (!ok) fprintf(stderr, "Error: Failed to write checkpoint %s\n", filename.c_str());
+
+		m_write_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+		m_busy = false;
+	});
+
+	return true;
+}
+
+
+void CheckpointWriter::wait() {
+	if (m_thread.joinable()) m_thread.join();
+}
+
+
+bool Checkpoint::open(const string &filename) {
+	close();
+	if (!m_file.open(filename)) return false;
+
+	// validate before pointing into the file
+	Header h;
+	if (m_file.size() < sizeof(Header)) {
+		close();
+		return false;
+	}
+	memcpy(&h, m_file.data(), sizeof(Header));
+	const uint64_t n = uint64_t(h.width) * h.height;
+	if (memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version
+		|| h.file_size != m_file.size()
+		|| h.color_offset + 4 * n * sizeof(float) > h.moment_offset
+		|| h.moment_offset + n * sizeof(float) > h.sum_offset
+		|| h.sum_offset + 3 * n * sizeof(double) > h.weight_offset
+		|| h.weight_offset + n * sizeof(double) > h.count_offset
+		|| h.count_offset + n * sizeof(uint32_t) > h.aov_offset
+		|| h.aov_offset + h.aov_floats * sizeof(float) > h.file_size) {
+		close();
+		return false;
+	}
+
+	m_state.width = h.width;
+	m_state.height = h.height;
+	m_state.passes = h.passes;
+	m_state.target_samples = h.target_samples;
+	m_state.ray_depth = h.ray_depth;
+	m_state.deterministic = h.deterministic != 0;
+	m_state.seed = h.seed;
+	m_state.camera_position = glm::vec3(h.camera[0], h.camera[1], h.camera[2]);
+	m_state.camera_yaw = h.camera[3];
+	m_state.camera_pitch = h.camera[4];
+	m_state.scene_objects = h.scene_objects;
+	m_state.scene_lights = h.scene_lights;
+	m_state.aov_mask = h.aov_mask;
+	m_state.user_aov_mask = h.user_aov_mask;
+
+	m_color = reinterpret_cast<const float *>(m_file.data() + h.color_offset);
+	m_moment = reinterpret_cast<const float *>(m_file.data() + h.moment_offset);
+	m_sums = reinterpret_cast<const double *>(m_file.data() + h.sum_offset);
+	m_weights = reinterpret_cast<const double *>(m_file.data() + h.weight_offset);
+	m_counts = reinterpret_cast<const uint32_t *>(m_file.data() + h.count_offset);
+	m_aovs = reinterpret_cast<const float *>(m_file.data() + h.aov_offset);
+	m_aov_floats = size_t(h.aov_floats);
+	return true;
+}
+
+
+void Checkpoint::close() {
+	m_file.close();
+	m_state = CheckpointState();
+	m_color = m_moment = m_aovs = nullptr;
+	m_sums = m_weights = nullptr;
+	m_counts = nullptr;
+	m_aov_floats = 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "accumulation.hpp"
+#include "mapped_file.hpp"
+
+
+// Everything needed to continue a render, other than the buffers.
+// Checkpoints are only taken between passes, so every pixel has
+// exactly 'passes' samples. The sampler state is the seed and the
+// pass count (random numbers are keyed on them when deterministic).
+struct CheckpointState {
+	int width = 0, height = 0;
+	int passes = 0;         // completed passes
+	int target_samples = 0; // samples per pixel the render was started with
+	int ray_depth = 0;
+	bool deterministic = true;
+	int seed = 0;
+	glm::vec3 camera_position{ 0 };
+	float camera_yaw = 0, camera_pitch = 0;
+	int scene_objects = 0, scene_lights = 0; // sanity check that the scene matches
+	unsigned aov_mask = 0;      // aovs in the checkpoint (including denoise/reprojection guides)
+	unsigned user_aov_mask = 0; // aovs the user asked for
+};
+
+
+// Writes checkpoints on a background thread. The buffers are copied
+// into a staging area first so the render can keep going while the
+// file is written.
+//
+// File layout (native endian, page aligned sections so they can be
+// used straight out of a memory mapping) :
+//   header
+//   color   : width*height pixels of 4 floats (r, g, b, time)
+//   moment  : width*height floats, running mean of squared luminance
+//   sums    : 3 planes of width*height doubles, the accumulated sums
+//   weights : width*height doubles, the accumulated weights
+//   counts  : width*height uint32s, the accumulated sample counts
+//   aovs    : the planes of the AOVBuffer
+class CheckpointWriter {
+private:
+	std::thread m_thread;
+	std::atomic<bool> m_busy{false};
+	std::vector<char> m_staging;
+	std::atomic<float> m_write_time{0};
+
+public:
+	CheckpointWriter() { }
+	~CheckpointWriter() { wait(); }
+
+	CheckpointWriter(const CheckpointWriter&) = delete;
+	CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+	// starts writing a checkpoint to filename (replacing it once complete)
+	// returns false without doing anything if the last write is still going
+	bool write(const std::string &filename, const CheckpointState &state,
+		const float *color, const float *moment, const AccumulationBuffer &accumulation,
+		const float *aovs, size_t aov_floats);
+
+	// blocks until the current write (if any) finishes
+	void wait();
+
+	bool busy() const { return m_busy; }
+
+	// ms the last write took (including the copy)
+	float writeTime() const { return m_write_time; }
+};
+
+
+// A checkpoint file opened for resuming. The buffers point into
+// a memory mapping of the file and stay valid until it is closed.
+class Checkpoint {
+private:
+	MappedFile m_file;
+	CheckpointState m_state;
+	const float *m_color = nullptr;
+	const float *m_moment = nullptr;
+	const double *m_sums = nullptr;
+	const double *m_weights = nullptr;
+	const uint32_t *m_counts = nullptr;
+	const float *m_aovs = nullptr;
+	size_t m_aov_floats = 0;
+
+public:
+	// maps and validates a checkpoint, returns false if it isn't one
+	bool open(const std::string &filename);
+	void close();
+
+	const CheckpointState & state() const { return m_state; }
+	const float * color() const { return m_color; }
+	const float * moment() const { return m_moment; }
+	const double * sums() const { return m_sums; }
+	const double * weights() const { return m_weights; }
+	const uint32_t * counts() const { return m_counts; }
+	const float * aovs() const { return m_aovs; }
+	size_t aovFloats() const { return m_aov_floats; }
+};
@@ -0,0 +1,142 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// project
+#include "denoiser.hpp"
+
+
+using namespace std;
+
+
+namespace {
+
+	// 1D B3-spline kernel, the 5x5 kernel is the outer product
+	const float kernel[5] = { 1 / 16.f, 1 / 4.f, 3 / 8.f, 1 / 4.f, 1 / 16.f };
+
+	// cheap approximation of exp(-x) for x >= 0 (truncated series in the denominator)
+	// unlike std::exp this vectorizes without -ffast-math
+	inline float fastExpNeg(float x) {
+		return 1 / (1 + x * (1 + x * (0.5f + x * (1 / 6.f))));
+	}
+
+	inline float luminance(float r, float g, float b) {
+		return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+	}
+}
+
+
+void Denoiser::denoise(const Input &in, float *const out[3]) {
+	const int w = in.width, h = in.height;
+	const size_t n = size_t(w) * h;
+	if (n == 0) return;
+
+	m_ping.resize(3 * n);
+	m_pong.resize(3 * n);
+
+	// demodulate albedo so that texture detail isn't blurred
+	// only the (smoother) irradiance is filtered
+	for (int c = 0; c < 3; c++) {
+		const float *color = in.color[c];
+		const float *albedo = in.albedo[c];
+		float *irr = m_ping.data() + c * n;
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < int(n); i++) {
+			irr[i] = color[i] / std::max(albedo[i], 0.01f);
+		}
+	}
+
+	float *src = m_ping.data();
+	float *dst = m_pong.data();
+
+	for (int iter = 0; iter < m_settings.iterations; iter++) {
+		const int step = 1 << iter;
+
+		// tighten the color edge-stopping as the image gets smoother
+		const float color_phi = m_settings.color_phi * exp2f(float(iter - m_settings.iterations + 1));
+		const float normal_phi = m_settings.normal_phi;
+		const float albedo_phi = m_settings.albedo_phi;
+		const float depth_phi = m_settings.depth_phi / step;
+
+#pragma omp parallel
+		{
+			// per-thread row accumulators
+			vector<float> acc(4 * size_t(w));
+			float *acc_r = acc.data(), *acc_g = acc_r + w, *acc_b = acc_g + w, *acc_w = acc_b + w;
+
+#pragma omp for schedule(static)
+			for (int y = 0; y < h; y++) {
+				fill(acc.begin(), acc.end(), 0.f);
+
+				const size_t row = size_t(y) * w;
+				const float *pr = src + row, *pg = src + n + row, *pb = src + 2 * n + row;
+				const float *pnx = in.normal[0] + row, *pny = in.normal[1] + row, *pnz = in.normal[2] + row;
+				const float *par = in.albedo[0] + row, *pag = in.albedo[1] + row, *pab = in.albedo[2] + row;
+				const float *pz = in.depth + row;
+
+				// taps are the outer loops so the inner loop runs over
+				// contiguous pixels of a row and can be vectorized
+				for (int ky = -2; ky <= 2; ky++) {
+					const int qy = y + ky * step;
+					if (qy < 0 || qy >= h) continue;
+
+					for (int kx = -2; kx <= 2; kx++) {
+						const int dx = kx * step;
+						const int x0 = std::max(0, -dx), x1 = std::min(w, w - dx);
+						const float k = kernel[ky + 2] * kernel[kx + 2];
+
+						const size_t qrow = size_t(qy) * w + dx;
+						const float *qr = src + qrow, *qg = src + n + qrow, *qb = src + 2 * n + qrow;
+						const float *qnx = in.normal[0] + qrow, *qny = in.normal[1] + qrow, *qnz = in.normal[2] + qrow;
+						const float *qar = in.albedo[0] + qrow, *qag = in.albedo[1] + qrow, *qab = in.albedo[2] + qrow;
+						const float *qz = in.depth + qrow;
+
+#pragma omp simd
+						for (int x = x0; x < x1; x++) {
+							float lp = luminance(pr[x], pg[x], pb[x]);
+							float lq = luminance(qr[x], qg[x], qb[x]);
+							float e_color = color_phi * fabsf(lp - lq) / (lp + lq + 0.01f);
+
+							float ndot = pnx[x] * qnx[x] + pny[x] * qny[x] + pnz[x] * qnz[x];
+							float e_normal = normal_phi * std::max(0.f, 1 - ndot);
+
+							float e_albedo = albedo_phi * (fabsf(par[x] - qar[x]) + fabsf(pag[x] - qag[x]) + fabsf(pab[x] - qab[x]));
+
+							float e_depth = depth_phi * fabsf(pz[x] - qz[x]) / (std::max(pz[x], qz[x]) + 0.001f);
+
+							float wgt = k * fastExpNeg(e_color + e_normal + e_albedo + e_depth);
+							acc_r[x] += wgt * qr[x];
+							acc_g[x] += wgt * qg[x];
+							acc_b[x] += wgt * qb[x];
+							acc_w[x] += wgt;
+						}
+					}
+				}
+
+				float *dr = dst + row, *dg = dst + n + row, *db = dst + 2 * n + row;
+#pragma omp simd
+				for (int x = 0; x < w; x++) {
+					float inv = 1 / acc_w[x];
+					dr[x] = acc_r[x] * inv;
+					dg[x] = acc_g[x] * inv;
+					db[x] = acc_b[x] * inv;
+				}
+			}
+		}
+
+		swap(src, dst);
+	}
+
+	// remodulate albedo
+	for (int c = 0; c < 3; c++) {
+		const float *albedo = in.albedo[c];
+		const float *irr = src + c * n;
+		float *o = out[c];
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < int(n); i++) {
+			o[i] = irr[i] * std::max(albedo[i], 0.01f);
+		}
+	}
+}
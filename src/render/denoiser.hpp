@@ -0,0 +1,51 @@
+#pragma once
+
+// std
+#include <vector>
+
+
+// Edge-aware a-trous wavelet denoiser that runs on the CPU.
+// Filters a noisy color image guided by the albedo, normal and
+// depth of the primary hit so that geometric and texture edges
+// are preserved. All images are planar float arrays of w*h
+// values (one array per channel) so that the inner loops
+// vectorize. Doesn't depend on OpenGL, so it can also be used
+// on headless output.
+class Denoiser {
+public:
+	struct Settings {
+		// number of a-trous passes, the filter radius doubles every pass
+		int iterations = 5;
+
+		// edge-stopping sensitivities (larger values preserve more edges)
+		float color_phi = 4.0f;
+		float normal_phi = 64.0f;
+		float albedo_phi = 32.0f;
+		float depth_phi = 8.0f;
+	};
+
+	// non-owning view of the input images, each array is w*h floats
+	struct Input {
+		int width = 0, height = 0;
+		const float *color[3] = { nullptr, nullptr, nullptr };
+		const float *albedo[3] = { nullptr, nullptr, nullptr };
+		const float *normal[3] = { nullptr, nullptr, nullptr };
+		const float *depth = nullptr;
+	};
+
+private:
+	Settings m_settings;
+
+	// ping-pong buffers for the filtered irradiance (3 planes each)
+	std::vector<float> m_ping, m_pong;
+
+public:
+	Denoiser() { }
+	Denoiser(const Settings &settings) : m_settings(settings) { }
+
+	Settings & settings() { return m_settings; }
+
+	// denoises the input, writing w*h floats into each of the output planes
+	// output may alias the input color planes
+	void denoise(const Input &in, float *const out[3]);
+};
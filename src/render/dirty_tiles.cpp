@@ -0,0 +1,42 @@
+
+// std
+#include <algorithm>
+
+// project
+#include "dirty_tiles.hpp"
+
+
+using namespace std;
+
+
+void DirtyTiles::resize(int w, int h, int tile_size) {
+	m_width = w;
+	m_height = h;
+	m_tile_size = std::max(tile_size, 1);
+	m_tiles_x = (w + m_tile_size - 1) / m_tile_size;
+	m_tiles_y = (h + m_tile_size - 1) / m_tile_size;
+	m_dirty.reset(new atomic<uint8_t>[tiles()]);
+	markAll();
+}
+
+
+void DirtyTiles::markAll() {
+	for (int t = 0; t < tiles(); t++) m_dirty[t].store(1, memory_order_release);
+}
+
+
+void DirtyTiles::collect(vector<int> &tiles) {
+	tiles.clear();
+	for (int t = 0; t < this->tiles(); t++) {
+		// the common case is clean, skip the exchange for those
+		if (m_dirty[t].load(memory_order_relaxed) && m_dirty[t].exchange(0, memory_order_acquire)) tiles.push_back(t);
+	}
+}
+
+
+void DirtyTiles::rect(int tile, int &x, int &y, int &w, int &h) const {
+	x = (tile % m_tiles_x) * m_tile_size;
+	y = (tile / m_tiles_x) * m_tile_size;
+	w = std::min(m_tile_size, m_width - x);
+	h = std::min(m_tile_size, m_height - y);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+// Which square tiles of an image were written since they were last
+// collected. Render threads mark pixels as they write them (a single
+// store, no locking), the display collects the marked tiles and only
+// uploads those.
+class DirtyTiles {
+public:
+	static constexpr int default_tile_size = 64;
+
+private:
+	int m_width = 0, m_height = 0;
+	int m_tile_size = default_tile_size;
+	int m_tiles_x = 0, m_tiles_y = 0;
+	std::unique_ptr<std::atomic<uint8_t>[]> m_dirty;
+
+public:
+	DirtyTiles() { }
+
+	// reallocates the marks, every tile starts out dirty
+	void resize(int w, int h, int tile_size = default_tile_size);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	int tileSize() const { return m_tile_size; }
+	int tiles() const { return m_tiles_x * m_tiles_y; }
+
+	// marks the tile of the pixel at index idx (x + y*width), the
+	// pixel has to be written before it is marked
+	void mark(int idx) {
+		const int x = idx % m_width, y = idx / m_width;
+		m_dirty[x / m_tile_size + (y / m_tile_size) * m_tiles_x].store(1, std::memory_order_release);
+	}
+
+	// marks every tile (e.g. when every pixel was rewritten)
+	void markAll();
+
+	// replaces tiles with the tiles marked since the last call, clearing
+	// their marks, pixels written before they were marked can be read
+	void collect(std::vector<int> &tiles);
+
+	// pixels [x, x + w) by [y, y + h) of a tile
+	void rect(int tile, int &x, int &y, int &w, int &h) const;
+};
@@ -0,0 +1,291 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// project
+#include "distributed.hpp"
+#include "accumulation.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	// protocol, all messages are fixed size structs in native byte order
+	//   worker -> coordinator : Hello
+	//   coordinator -> worker : DistributedFrame
+	//   coordinator -> worker : Job, worker -> coordinator : Result + floats (repeated)
+	//   coordinator -> worker : Job with id < 0 when the frame is done
+	const uint32_t magic = 0x57445452; // "RTDW"
+	const uint32_t version = 1;
+
+	struct Hello {
+		uint32_t magic;
+		uint32_t version;
+	};
+
+	struct Job {
+		int32_t id;
+		int32_t x, y, w, h;
+		int32_t s0, s1;
+	};
+
+	struct Result {
+		int32_t id;
+		uint32_t floats;
+	};
+
+	static_assert(is_trivially_copyable<DistributedFrame>::value, "frames are sent as raw bytes");
+
+	// limits on what a worker accepts from the socket
+	const int max_size = 16384, max_samples = 1 << 20, max_depth = 64;
+
+	bool validFrame(const DistributedFrame &frame) {
+		const RenderSettings &s = frame.settings;
+		return frame.scene >= 0 && frame.scene < builtin_scenes
+			&& frame.integrator >= 0 && frame.integrator < builtin_integrators
+			&& s.width > 0 && s.width <= max_size && s.height > 0 && s.height <= max_size
+			&& s.samples > 0 && s.samples <= max_samples
+			&& s.ray_depth >= 0 && s.ray_depth <= max_depth
+			&& std::isfinite(frame.camera_position.x) && std::isfinite(frame.camera_position.y) && std::isfinite(frame.camera_position.z)
+			&& std::isfinite(frame.camera_yaw) && std::isfinite(frame.camera_pitch);
+	}
+
+	// the tile and sample range have to lie within the frame
+	bool validJob(const Job &job, const DistributedFrame &frame) {
+		const RenderSettings &s = frame.settings;
+		return job.x >= 0 && job.y >= 0 && job.w > 0 && job.h > 0
+			&& job.w <= s.width - job.x && job.h <= s.height - job.y
+			&& job.s0 >= 0 && job.s0 < job.s1 && job.s1 <= s.samples;
+	}
+
+	// splits the frame into tiles for each range of samples
+	// sample ranges are the outer loop so the image converges evenly
+	vector<Job> makeJobs(const DistributedFrame &frame) {
+		const RenderSettings &s = frame.settings;
+		const int chunk = frame.sample_chunk > 0 ? frame.sample_chunk : s.samples;
+		const int tile = std::max(frame.tile_size, 1);
+		vector<Job> jobs;
+		for (int s0 = 0; s0 < s.samples; s0 += chunk) {
+			for (int y = 0; y < s.height; y += tile) {
+				for (int x = 0; x < s.width; x += tile) {
+					Job j;
+					j.id = int32_t(jobs.size());
+					j.x = x;
+					j.y = y;
+					j.w = std::min(tile, s.width - x);
+					j.h = std::min(tile, s.height - y);
+					j.s0 = s0;
+					j.s1 = std::min(s0 + chunk, s.samples);
+					jobs.push_back(j);
+				}
+			}
+		}
+		return jobs;
+	}
+}
+
+
+bool Coordinator::listen(int port, const string &address) {
+	m_listener = Socket::listen(port, address);
+	return m_listener.valid();
+}
+
+
+bool Coordinator::render(int workers, const DistributedFrame &frame, vector<float> &image, Stats *stats) {
+	if (!m_listener.valid() || workers < 1) return false;
+
+	// wait for everyone before starting the clock
+	vector<Socket> connections;
+	while (int(connections.size()) < workers) {
+		Socket s = m_listener.accept();
+		if (!s.valid()) return false;
+		// a peer that connects but never says hello times out
+		s.setReceiveTimeout(m_timeout);
+		Hello hello;
+		if (!s.recvAll(&hello, sizeof(hello)) || hello.magic != magic || hello.version != version) continue;
+		connections.push_back(std::move(s));
+	}
+
+	const auto time_begin = chrono::steady_clock::now();
+
+	const vector<Job> jobs = makeJobs(frame);
+	const int width = frame.settings.width;
+	const size_t n = size_t(width) * frame.settings.height;
+
+	// the returned means weighted by their number of samples
+	AccumulationBuffer accumulation;
+	accumulation.resize(width, frame.settings.height);
+
+	mutex lock;
+	condition_variable job_available;
+	size_t next = 0;
+	vector<int> retry; // jobs of workers that disconnected
+	int done = 0;
+	vector<int> jobs_per_worker(workers, 0);
+
+	auto serve = [&](int worker) {
+		Socket &s = connections[worker];
+		if (!s.sendAll(&frame, sizeof(frame))) return;
+
+		vector<float> tile;
+		while (true) {
+			// next job, or wait in case another worker fails
+			Job job;
+			{
+				unique_lock<mutex> guard(lock);
+				job_available.wait(guard, [&]() { return next < jobs.size() || !retry.empty() || done == int(jobs.size()); });
+				if (!retry.empty()) {
+					job = jobs[retry.back()];
+					retry.pop_back();
+				} else if (next < jobs.size()) {
+					job = jobs[next++];
+				} else {
+					break;
+				}
+			}
+
+			Result result;
+			tile.resize(3 * size_t(job.w) * job.h);
+			bool ok = s.sendAll(&job, sizeof(job))
+				&& s.recvAll(&result, sizeof(result))
+				&& result.id == job.id && result.floats == tile.size()
+				&& s.recvAll(tile.data(), tile.size() * sizeof(float));
+			if (!ok) {
+				// hand the job to someone else
+				// (a stalled worker is dropped so it can't send a late result)
+				cerr << "Error: Lost worker " << worker << endl;
+				s.close();
+				lock_guard<mutex> guard(lock);
+				retry.push_back(job.id);
+				job_available.notify_all();
+				return;
+			}
+
+			// merge, weighted by the samples in the result
+			const int samples = job.s1 - job.s0;
+			lock_guard<mutex> guard(lock);
+			for (int ty = 0; ty < job.h; ty++) {
+				for (int tx = 0; tx < job.w; tx++) {
+					const size_t t = size_t(tx + ty * job.w);
+					const int p = (job.x + tx) + (job.y + ty) * width;
+					const dvec3 mean(tile[3 * t], tile[3 * t + 1], tile[3 * t + 2]);
+					accumulation.addSum(p, mean * double(samples), samples, uint32_t(samples));
+				}
+			}
+			jobs_per_worker[worker]++;
+			if (++done == int(jobs.size())) job_available.notify_all();
+		}
+
+		// tell the worker we're finished
+		Job end{ -1, 0, 0, 0, 0, 0, 0 };
+		s.sendAll(&end, sizeof(end));
+	};
+
+	vector<thread> threads;
+	for (int w = 0; w < workers; w++) threads.emplace_back(serve, w);
+	for (thread &t : threads) t.join();
+
+	if (done != int(jobs.size())) return false;
+
+	image.resize(3 * n);
+	accumulation.resolve(image.data());
+
+	if (stats) {
+		stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - time_begin).count();
+		stats->jobs = int(jobs.size());
+		stats->jobs_per_worker = jobs_per_worker;
+	}
+	return true;
+}
+
+
+bool runWorker(const string &host, int port) {
+	Socket s = Socket::connect(host, port);
+	if (!s.valid()) {
+		cerr << "Error: Could not connect to " << host << ":" << port << endl;
+		return false;
+	}
+
+	Hello hello{ magic, version };
+	DistributedFrame frame;
+	if (!s.sendAll(&hello, sizeof(hello)) || !s.recvAll(&frame, sizeof(frame))) return false;
+	if (!validFrame(frame)) {
+		cerr << "Error: Received an invalid frame from " << host << ":" << port << endl;
+		return false;
+	}
+
+	Renderer renderer(makeScene(frame.scene), frame.integrator);
+	Camera camera;
+	camera.setImageSize({ frame.settings.width, frame.settings.height });
+	camera.setPositionOrientation(frame.camera_position, frame.camera_yaw, frame.camera_pitch);
+
+	vector<float> tile;
+	while (true) {
+		Job job;
+		if (!s.recvAll(&job, sizeof(job))) return false;
+		if (job.id < 0) return true;
+		if (!validJob(job, frame)) {
+			cerr << "Error: Received an invalid job from " << host << ":" << port << endl;
+			return false;
+		}
+
+		tile.resize(3 * size_t(job.w) * job.h);
+		renderer.renderTile(camera, frame.settings, job.x, job.y, job.w, job.h, job.s0, job.s1, tile.data());
+
+		Result result{ job.id, uint32_t(tile.size()) };
+		if (!s.sendAll(&result, sizeof(result)) || !s.sendAll(tile.data(), tile.size() * sizeof(float))) return false;
+	}
+}
+
+
+bool runScalingTest(const string &exe_path, int max_workers, const DistributedFrame &frame) {
+	const RenderSettings &s = frame.settings;
+	cout << "Distributed render " << s.width << "x" << s.height << ", " << s.samples << " samples, "
+		<< frame.tile_size << "px tiles, 1 thread per worker" << endl;
+
+	double base_time = 0;
+	for (int workers = 1; workers <= max_workers; workers++) {
+		Coordinator coordinator;
+		if (!coordinator.listen(0)) {
+			cerr << "Error: Could not listen for workers" << endl;
+			return false;
+		}
+
+		// each worker is a separate process on this machine
+		const string command = "\"" + exe_path + "\" --worker 127.0.0.1 " + to_string(coordinator.port()) + " --threads 1";
+		vector<thread> processes;
+		for (int w = 0; w < workers; w++) {
+			processes.emplace_back([command]() { std::system(command.c_str()); });
+		}
+
+		vector<float> image;
+		Coordinator::Stats stats;
+		bool ok = coordinator.render(workers, frame, image, &stats);
+		for (thread &p : processes) p.join();
+		if (!ok) {
+			cerr << "Error: Render with " << workers << " workers failed" << endl;
+			return false;
+		}
+
+		if (workers == 1) base_time = stats.seconds;
+		const double speedup = base_time / stats.seconds;
+		auto range = minmax_element(stats.jobs_per_worker.begin(), stats.jobs_per_worker.end());
+		cout << "  " << setw(2) << workers << " workers : " << fixed << setprecision(3) << stats.seconds << " s"
+			<< "  speedup " << setprecision(2) << speedup
+			<< "  efficiency " << setprecision(0) << 100 * speedup / workers << "%"
+			<< "  (" << *range.first << "-" << *range.second << " jobs each)" << endl;
+	}
+	return true;
+}
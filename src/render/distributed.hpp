@@ -0,0 +1,62 @@
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// project
+#include "renderer.hpp"
+#include "socket.hpp"
+
+
+// A frame to be rendered by several processes. The coordinator
+// sends this to every worker, so it only holds plain values
+// (the scene and integrator are the builtin ones by index).
+struct DistributedFrame {
+	int scene = 4;
+	int integrator = 2;
+	RenderSettings settings;
+	glm::vec3 camera_position{ 0 };
+	float camera_yaw = 0, camera_pitch = 0;
+	int tile_size = 32;
+	int sample_chunk = 0; // samples per job, 0 for all of them
+};
+
+
+// Splits a frame into jobs (a tile and a range of samples) and hands
+// them out to worker processes connected over TCP. A thread per worker
+// keeps it busy, the jobs of a worker that disconnects or stops
+// responding are handed to the others. Results are merged weighted by
+// their sample count.
+class Coordinator {
+private:
+	Socket m_listener;
+	double m_timeout = 60;
+
+public:
+	struct Stats {
+		double seconds = 0;
+		int jobs = 0;
+		std::vector<int> jobs_per_worker;
+	};
+
+	// starts listening for workers on a local address (loopback unless
+	// given, "0.0.0.0" for all interfaces), port 0 picks a free port
+	bool listen(int port, const std::string &address = "127.0.0.1");
+
+	// a worker that sends nothing for this long is treated as lost
+	void setTimeout(double seconds) { m_timeout = seconds; }
+	int port() const { return m_listener.port(); }
+
+	// waits for the given number of workers to connect then renders the
+	// frame into image (3 floats per pixel), false if it couldn't be finished
+	bool render(int workers, const DistributedFrame &frame, std::vector<float> &image, Stats *stats = nullptr);
+};
+
+
+// connects to a coordinator and renders jobs until the frame is done
+bool runWorker(const std::string &host, int port);
+
+// renders a frame with 1..max_workers local worker processes (started from
+// the executable at exe_path) and prints the speedup and scaling efficiency
+bool runScalingTest(const std::string &exe_path, int max_workers, const DistributedFrame &frame);
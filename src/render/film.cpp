@@ -0,0 +1,159 @@
+
+// std
+#include <algorithm>
+#include <cmath>
+
+// glm
+#include <glm/gtc/constants.hpp>
+
+// project
+#include "film.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	// floor without a library call
+	int fastFloor(float x) {
+		const int i = int(x);
+		return i - (x < float(i));
+	}
+}
+
+
+Filter::Filter(FilterType type, float radius) : m_type(type), m_radius(glm::clamp(radius, 0.01f, max_radius)) {
+	// entries are sampled at their centers
+	m_table_scale = table_size / m_radius;
+	for (int i = 0; i < table_size; i++) m_table[i] = evaluate1D((i + 0.5f) / m_table_scale);
+}
+
+
+float Filter::evaluate1D(float x) const {
+	const float r = m_radius;
+	switch (m_type) {
+	case FilterType::Tent:
+		return std::max(r - x, 0.f);
+	case FilterType::Gaussian: {
+		// shifted down to reach zero at the radius
+		const float sigma = r / 3;
+		auto g = [&](float d) { return exp(-d * d / (2 * sigma * sigma)); };
+		return std::max(g(x) - g(r), 0.f);
+	}
+	case FilterType::Mitchell: {
+		// B = C = 1/3, stretched from [0, 2] over the radius
+		const float B = 1.f / 3, C = 1.f / 3;
+		const float t = 2 * x / r;
+		if (t >= 2) return 0;
+		if (t >= 1) return ((-B - 6 * C) * t * t * t + (6 * B + 30 * C) * t * t + (-12 * B - 48 * C) * t + (8 * B + 24 * C)) / 6;
+		return ((12 - 9 * B - 6 * C) * t * t * t + (-18 + 12 * B + 6 * C) * t * t + (6 - 2 * B)) / 6;
+	}
+	case FilterType::BlackmanHarris: {
+		// the window over [-radius, radius]
+		const float t = 0.5f + 0.5f * x / r;
+		const float w = two_pi<float>() * t;
+		return 0.35875f - 0.48829f * cos(w) + 0.14128f * cos(2 * w) - 0.01168f * cos(3 * w);
+	}
+	default:
+		return 1;
+	}
+}
+
+
+const char * Filter::name(FilterType type) {
+	switch (type) {
+	case FilterType::Box: return "box";
+	case FilterType::Tent: return "tent";
+	case FilterType::Gaussian: return "gaussian";
+	case FilterType::Mitchell: return "mitchell";
+	case FilterType::BlackmanHarris: return "blackman-harris";
+	default: return "";
+	}
+}
+
+
+float Filter::defaultRadius(FilterType type) {
+	switch (type) {
+	case FilterType::Tent: return 1;
+	case FilterType::Gaussian: return 1.5f;
+	case FilterType::Mitchell: return 2;
+	case FilterType::BlackmanHarris: return 2;
+	default: return 0.5f;
+	}
+}
+
+
+FilterType Filter::parse(const string &name) {
+	for (int i = 0; i < int(FilterType::Count); i++) {
+		if (name == Filter::name(FilterType(i))) return FilterType(i);
+	}
+	return FilterType::Count;
+}
+
+
+void FilmTile::addSample(const vec2 &position, const vec3 &color) {
+	// pixels whose centers are within the radius, relative to the tile
+	const float r = m_filter->radius();
+	const vec2 p = position - 0.5f - vec2(m_x0, m_y0);
+	const int x0 = std::max(-fastFloor(r - p.x), 0), x1 = std::min(fastFloor(p.x + r), m_width - 1);
+	const int y0 = std::max(-fastFloor(r - p.y), 0), y1 = std::min(fastFloor(p.y + r), m_height - 1);
+
+	// the filter is separable, so the weights of each column and row are looked up once
+	const int reach = 2 * int(Filter::max_radius) + 1;
+	float wx[reach], wy[reach];
+	for (int x = x0; x <= x1; x++) wx[x - x0] = m_filter->weight(x - p.x);
+	for (int y = y0; y <= y1; y++) wy[y - y0] = m_filter->weight(y - p.y);
+
+	const vec4 value(color, 1);
+	for (int y = y0; y <= y1; y++) {
+		vec4 *row = &m_sum[size_t(y) * m_width];
+		uint32_t *count = &m_count[size_t(y) * m_width];
+		for (int x = x0; x <= x1; x++) {
+			row[x] += (wx[x - x0] * wy[y - y0]) * value;
+			count[x]++;
+		}
+	}
+}
+
+
+Film::Film(int width, int height, const Filter &filter, AccumulationPrecision precision)
+	: m_width(width), m_height(height), m_filter(filter) {
+	m_pixels.resize(width, height, precision);
+}
+
+
+void Film::startTile(int x, int y, int w, int h, FilmTile &tile) const {
+	// samples near the edge of the tile reach the pixels around it
+	const int reach = int(ceil(m_filter.radius() - 0.5f));
+	tile.m_filter = &m_filter;
+	tile.m_x0 = std::max(x - reach, 0);
+	tile.m_y0 = std::max(y - reach, 0);
+	tile.m_width = std::min(x + w + reach, m_width) - tile.m_x0;
+	tile.m_height = std::min(y + h + reach, m_height) - tile.m_y0;
+
+	const size_t n = size_t(tile.m_width) * tile.m_height;
+	tile.m_sum.assign(n, vec4(0));
+	tile.m_count.assign(n, 0);
+}
+
+
+void Film::mergeTile(const FilmTile &tile) {
+	// short compared to rendering the tile, so threads rarely wait here
+	lock_guard<mutex> guard(m_lock);
+	for (int y = 0; y < tile.m_height; y++) {
+		for (int x = 0; x < tile.m_width; x++) {
+			const size_t i = size_t(x) + size_t(y) * tile.m_width;
+			if (tile.m_count[i] == 0) continue;
+			const vec4 &sum = tile.m_sum[i];
+			m_pixels.addSum((tile.m_x0 + x) + (tile.m_y0 + y) * m_width, dvec3(sum), sum.w, tile.m_count[i]);
+		}
+	}
+}
+
+
+void Film::clear() {
+	lock_guard<mutex> guard(m_lock);
+	m_pixels.clear();
+}
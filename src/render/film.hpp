@@ -0,0 +1,119 @@
+#pragma once
+
+// std
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "accumulation.hpp"
+
+
+enum class FilterType { Box, Tent, Gaussian, Mitchell, BlackmanHarris, Count };
+
+
+// Separable reconstruction filter, the weight of a sample for a pixel
+// is f(dx) * f(dy) of their offset. f is tabulated over [0, radius] so
+// every filter costs the same to evaluate.
+class Filter {
+public:
+	static constexpr float max_radius = 8;
+
+private:
+	static constexpr int table_size = 64;
+
+	FilterType m_type = FilterType::Box;
+	float m_radius = 0.5f;
+	float m_table_scale = 0; // table entries per pixel
+	float m_table[table_size];
+
+	// f at a distance x in [0, radius]
+	float evaluate1D(float x) const;
+
+public:
+	// a box over the pixel
+	Filter() : Filter(FilterType::Box, 0.5f) { }
+
+	// radius in pixels (up to max_radius), a box of radius 0.5 is the
+	// same as no filter
+	Filter(FilterType type, float radius);
+
+	FilterType type() const { return m_type; }
+	float radius() const { return m_radius; }
+
+	// f of an offset along one axis
+	float weight(float d) const {
+		const float x = std::abs(d) * m_table_scale;
+		return (x < table_size) ? m_table[int(x)] : 0;
+	}
+
+	float weight(float dx, float dy) const { return weight(dx) * weight(dy); }
+
+	// display name (also the name used on the command line)
+	static const char * name(FilterType type);
+
+	// a typical radius for each filter
+	static float defaultRadius(FilterType type);
+
+	// the filter with a name, Count if there is none
+	static FilterType parse(const std::string &name);
+};
+
+
+// Samples of part of the film, splatted by a single thread without any
+// locking (with the pixels around the part the filter reaches into) and
+// merged into the film once the part is done.
+class FilmTile {
+private:
+	friend class Film;
+
+	const Filter *m_filter = nullptr;
+	int m_x0 = 0, m_y0 = 0, m_width = 0, m_height = 0; // pixels covered
+	std::vector<glm::vec4> m_sum; // weighted color and the weight, together so a splat touches one cache line per pixel
+	std::vector<uint32_t> m_count;
+
+public:
+	FilmTile() { }
+
+	// adds a sample at a position on the film (pixel (x, y) is centered
+	// at (x + 0.5, y + 0.5)) to every pixel in reach of the filter
+	void addSample(const glm::vec2 &position, const glm::vec3 &color);
+};
+
+
+// Image made of filtered samples. Every sample is splatted into all the
+// pixels in reach of the filter, each pixel is the weighted mean of the
+// samples it got.
+class Film {
+private:
+	int m_width = 0, m_height = 0;
+	Filter m_filter;
+	AccumulationBuffer m_pixels;
+	std::mutex m_lock;
+
+public:
+	Film(int width, int height, const Filter &filter = Filter(),
+		AccumulationPrecision precision = AccumulationPrecision::Double);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	const Filter & filter() const { return m_filter; }
+	const AccumulationBuffer & pixels() const { return m_pixels; }
+
+	// an empty tile for samples inside the pixels [x, x + w) by [y, y + h)
+	// (reused tiles keep their memory)
+	void startTile(int x, int y, int w, int h, FilmTile &tile) const;
+
+	// adds the samples of a finished tile, can be called from several threads
+	void mergeTile(const FilmTile &tile);
+
+	// zero every pixel
+	void clear();
+
+	// writes the mean of every pixel to rgb (3 floats per pixel)
+	void resolve(float *rgb) const { m_pixels.resolve(rgb); }
+};
@@ -0,0 +1,27 @@
+
+// project
+#include "frame_buffer.hpp"
+
+
+using namespace std;
+
+
+void FrameBuffer::resize(size_t n) {
+	m_size = n;
+	m_slots.reset(new Slot[n]);
+	for (size_t i = 0; i < n; i++) {
+		m_slots[i].sequence.store(0, memory_order_relaxed);
+		for (atomic<float> &v : m_slots[i].value) v.store(0, memory_order_relaxed);
+	}
+}
+
+
+void FrameBuffer::read(size_t first, size_t count, FramePixel *out) const {
+	for (size_t i = 0; i < count; i++) out[i] = read(int(first + i));
+}
+
+
+void FrameBuffer::read(vector<FramePixel> &out) const {
+	out.resize(m_size);
+	read(0, m_size, out.data());
+}
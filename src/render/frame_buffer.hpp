@@ -0,0 +1,100 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+// a pixel of the render, its color and the frame time it was written at
+struct FramePixel { float r, g, b, time; };
+
+
+// Pixels that render threads write while the display (or anything else)
+// reads them. Every pixel has a sequence number that is odd while it is
+// being written. Readers never hold up a writer, they read the pixel
+// again if its sequence number changed in the meantime, so every pixel
+// read is the result of exactly one write (never half of two).
+//
+// Writes to the same pixel from different threads at once are allowed,
+// they happen one after the other.
+class FrameBuffer {
+private:
+	struct Slot {
+		std::atomic<uint32_t> sequence;
+		std::atomic<float> value[4];
+	};
+
+	size_t m_size = 0;
+	std::unique_ptr<Slot[]> m_slots;
+
+	// makes the sequence number odd if no one else is writing the pixel
+	static bool claim(Slot &s, uint32_t &sequence) {
+		sequence = s.sequence.load(std::memory_order_relaxed);
+		return !(sequence & 1) && s.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	// stores the pixel and makes the sequence number even again (a reader
+	// that sees any of the values also sees the odd sequence number)
+	static void publish(Slot &s, uint32_t sequence, const FramePixel &p) {
+		s.value[0].store(p.r, std::memory_order_release);
+		s.value[1].store(p.g, std::memory_order_release);
+		s.value[2].store(p.b, std::memory_order_release);
+		s.value[3].store(p.time, std::memory_order_release);
+		s.sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+public:
+	FrameBuffer() { }
+
+	// reallocates the buffer, every pixel starts out zero
+	void resize(size_t n);
+
+	size_t size() const { return m_size; }
+
+	// writes a pixel, waiting for a write from another thread to finish
+	void write(int idx, const FramePixel &p) {
+		Slot &s = m_slots[idx];
+		uint32_t sequence;
+		while (!claim(s, sequence)) std::this_thread::yield();
+		publish(s, sequence, p);
+	}
+
+	// writes a pixel if condition() holds, checked once no other thread is
+	// writing the pixel (so a write that follows the condition turning false
+	// is never overwritten), returns whether it was written
+	template <typename Condition>
+	bool writeIf(int idx, const FramePixel &p, Condition condition) {
+		Slot &s = m_slots[idx];
+		uint32_t sequence;
+		while (!claim(s, sequence)) std::this_thread::yield();
+		if (!condition()) {
+			// nothing changed, readers can keep what they read
+			s.sequence.store(sequence, std::memory_order_release);
+			return false;
+		}
+		publish(s, sequence, p);
+		return true;
+	}
+
+	FramePixel read(int idx) const {
+		const Slot &s = m_slots[idx];
+		for (;;) {
+			const uint32_t sequence = s.sequence.load(std::memory_order_acquire);
+			const FramePixel p = {
+				s.value[0].load(std::memory_order_acquire), s.value[1].load(std::memory_order_acquire),
+				s.value[2].load(std::memory_order_acquire), s.value[3].load(std::memory_order_acquire)
+			};
+			if (!(sequence & 1) && s.sequence.load(std::memory_order_relaxed) == sequence) return p;
+			std::this_thread::yield();
+		}
+	}
+
+	// reads count pixels starting at index first
+	void read(size_t first, size_t count, FramePixel *out) const;
+
+	// reads every pixel into out (resized to fit)
+	void read(std::vector<FramePixel> &out) const;
+};
@@ -0,0 +1,132 @@
+
+// std
+#include <algorithm>
+
+// project
+#include "frame_scheduler.hpp"
+
+
+using namespace std;
+
+
+FrameScheduler::FrameScheduler() {
+	for (atomic<float> &p : m_percentile) p = 0;
+}
+
+
+void FrameScheduler::resize(int w, int h, int threads, int tile_size) {
+	m_width = w;
+	m_height = h;
+	m_tile_size = std::max(tile_size, 1);
+	m_tiles_x = (w + m_tile_size - 1) / m_tile_size;
+	m_tiles = m_tiles_x * ((h + m_tile_size - 1) / m_tile_size);
+	m_threads = std::max(threads, 1);
+
+	m_tile_pixels.assign(m_tiles, 0);
+	for (int idx = 0; idx < w * h; idx++) m_tile_pixels[tile(idx)]++;
+	m_tile_cost.assign(m_tiles, 0.f);
+	m_thread_time.assign(size_t(m_threads) * m_tiles, 0.f);
+	m_thread_pixels.assign(size_t(m_threads) * m_tiles, 0);
+	m_speedup = float(m_threads);
+	m_overhead = 0;
+	m_predicted = 0;
+	m_error = 1;
+}
+
+
+FrameScheduler::Plan FrameScheduler::plan(const vector<int> &order, int offset, int begin) {
+	const int n = int(order.size());
+	Plan p;
+	if (n == 0 || m_tiles == 0) return p;
+
+	// the pixel time that fits, over all threads (planned short of the
+	// budget and corrected by how far the last predictions were off, as the
+	// cost changes under a moving view, and a quarter of the budget is
+	// always left for pixels, whatever the overhead)
+	const float budget = m_budget * margin;
+	const double available = std::max(budget - m_overhead, budget * 0.25f) * 1e6 * m_speedup / m_error;
+
+	// as many whole passes as fit
+	if (begin == 0) {
+		double pass = 0;
+		for (int t = 0; t < m_tiles; t++) pass += m_tile_pixels[t] * double(cost(t));
+		if (pass <= available) {
+			p.pixels = n;
+			p.passes = std::clamp(int(available / pass), 1, max_passes);
+			p.predicted = float(pass * p.passes / 1e6 / m_speedup);
+			m_predicted = p.predicted;
+			m_coverage = float(p.passes);
+			return p;
+		}
+	}
+
+	// otherwise the pixels that fit, at least a few chunks so the frame
+	// gets somewhere
+	const int least = std::min(n - begin, 256 * m_threads);
+	double sum = 0;
+	int k = begin;
+	for (; k < n; k++) {
+		const float c = cost(tile(order[(k + offset) % n]));
+		if (sum + c > available && k - begin >= least) break;
+		sum += c;
+	}
+	p.pixels = k - begin;
+	p.predicted = float(sum / 1e6 / m_speedup);
+	m_predicted = p.predicted;
+	m_coverage = float(p.pixels) / n;
+	return p;
+}
+
+
+void FrameScheduler::finishPixels(float ms) {
+	double total = 0, measured = 0;
+	int measured_tiles = 0;
+	for (int t = 0; t < m_tiles; t++) {
+		double time = 0;
+		int pixels = 0;
+		for (int r = 0; r < m_threads; r++) {
+			const size_t i = size_t(r) * m_tiles + t;
+			time += m_thread_time[i];
+			pixels += m_thread_pixels[i];
+			m_thread_time[i] = 0;
+			m_thread_pixels[i] = 0;
+		}
+		total += time;
+
+		// halfway to the new cost, the view (and the cost) changes every frame
+		if (pixels > 0) {
+			const float c = float(time / pixels);
+			m_tile_cost[t] = (m_tile_cost[t] > 0) ? 0.5f * (m_tile_cost[t] + c) : c;
+		}
+		if (m_tile_cost[t] > 0) {
+			measured += m_tile_cost[t];
+			measured_tiles++;
+		}
+	}
+	if (measured_tiles > 0) m_default_cost = float(measured / measured_tiles);
+
+	// how many threads' worth of pixels got done in the time (not quite
+	// all of them with hyperthreads, other work or a short loop)
+	if (total > 0 && ms > 0.5f) {
+		const float speedup = std::clamp(float(total / 1e6 / ms), 0.1f, float(m_threads));
+		m_speedup = 0.75f * m_speedup + 0.25f * speedup;
+	}
+}
+
+
+void FrameScheduler::finishFrame(float ms, float pixel_ms) {
+	m_overhead = 0.75f * m_overhead + 0.25f * std::max(ms - pixel_ms, 0.f);
+	if (m_predicted > 0.5f) m_error = 0.75f * m_error + 0.25f * std::clamp(pixel_ms / m_predicted, 0.5f, 2.f);
+	m_predicted = 0;
+
+	if (int(m_history.size()) < history_size) m_history.push_back(ms);
+	else m_history[m_frames % history_size] = ms;
+	m_frames++;
+
+	vector<float> sorted = m_history;
+	sort(sorted.begin(), sorted.end());
+	const int ps[3] = { 50, 95, 99 };
+	for (int i = 0; i < 3; i++) {
+		m_percentile[i] = sorted[std::min(size_t(ps[i] * sorted.size() / 100), sorted.size() - 1)];
+	}
+}
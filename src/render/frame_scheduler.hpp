@@ -0,0 +1,96 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <vector>
+
+// project
+#include "dirty_tiles.hpp"
+
+
+// Plans the frames of the interactive preview to fit a frame time. The
+// time every traced pixel takes is measured while rendering and kept per
+// tile, a frame then traces as many pixels of its (coarse-to-fine) order
+// as are predicted to fit. The preview resolution drops where the scene
+// is expensive and comes back where it is cheap, and a frame with time
+// to spare traces whole passes more than once.
+//
+// Render threads record their pixels in rows of their own (no locking),
+// the rows are folded into the tile costs after every pixel loop.
+class FrameScheduler {
+public:
+	static constexpr int max_passes = 16;
+	static constexpr int history_size = 256; // frames the percentiles are taken over
+	static constexpr float margin = 0.85f; // of the budget a frame is planned to, the rest absorbs mispredictions
+	static constexpr float deadline = 1.1f; // of the budget after which a preview frame stops whatever the plan
+
+	// what a frame traces, pixels of the order from where the last frame
+	// stopped, or whole passes of every pixel
+	struct Plan {
+		int pixels = 0;
+		int passes = 1;
+		float predicted = 0; // ms
+	};
+
+private:
+	std::atomic<float> m_budget{1000.f / 30}; // ms
+
+	int m_width = 0, m_height = 0;
+	int m_tile_size = DirtyTiles::default_tile_size, m_tiles_x = 0, m_tiles = 0;
+	int m_threads = 1;
+	std::vector<int> m_tile_pixels;
+	std::vector<float> m_tile_cost; // ns per pixel, 0 until measured
+	float m_default_cost = 1000; // ns per pixel of tiles not measured yet (the mean of the rest)
+
+	// ns and pixels of the current pixel loop, a row of tiles per thread
+	std::vector<float> m_thread_time;
+	std::vector<int> m_thread_pixels;
+
+	float m_speedup = 1; // measured pixel time over wall time of the pixel loops
+	float m_overhead = 0; // ms of a frame outside its pixel loops
+	float m_predicted = 0; // ms of pixels planned for the current frame
+	float m_error = 1; // measured pixel time over the predicted one
+
+	std::vector<float> m_history; // ms of the last frames
+	int m_frames = 0;
+	std::atomic<float> m_percentile[3]; // 50th, 95th and 99th
+	std::atomic<float> m_coverage{0}; // fraction of the pixels planned for the last frame (passes if more than one)
+
+	int tile(int idx) const { return (idx % m_width) / m_tile_size + ((idx / m_width) / m_tile_size) * m_tiles_x; }
+	float cost(int t) const { return m_tile_cost[t] > 0 ? m_tile_cost[t] : m_default_cost; }
+
+public:
+	FrameScheduler();
+
+	// forgets every measurement
+	void resize(int w, int h, int threads, int tile_size = DirtyTiles::default_tile_size);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// target frame time in ms (can be set from any thread)
+	void setBudget(float ms) { m_budget = ms; }
+	float budget() const { return m_budget; }
+
+	// the time a thread took for the pixel at index idx (x + y*width)
+	void record(int thread, int idx, float ns) {
+		const size_t i = size_t(thread) * m_tiles + tile(idx);
+		m_thread_time[i] += ns;
+		m_thread_pixels[i]++;
+	}
+
+	// plans a frame that traces order[(k + offset) % n] from k = begin on,
+	// whole passes are only planned for a frame that begins a pass
+	Plan plan(const std::vector<int> &order, int offset, int begin);
+
+	// folds the costs recorded since the last call into the tiles, ms is
+	// the wall time of the pixel loop
+	void finishPixels(float ms);
+
+	// ms of the whole frame, and of its pixel loops
+	void finishFrame(float ms, float pixel_ms);
+
+	// frame time percentiles over the last frames (p is 50, 95 or 99)
+	float percentile(int p) const { return m_percentile[p == 50 ? 0 : p == 95 ? 1 : 2]; }
+	float coverage() const { return m_coverage; }
+};
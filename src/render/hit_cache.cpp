@@ -0,0 +1,71 @@
+
+// project
+#include "hit_cache.hpp"
+#include "scene/scene_object.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+void PrimaryHitCache::resize(int pixels, int samples) {
+	m_pixels = pixels;
+	m_samples = samples;
+	m_valid_samples = 0;
+
+	const size_t n = size_t(pixels) * samples;
+	m_jitter.assign(n, vec2(0));
+	m_object_id.assign(n, -1);
+	m_distance.assign(n, 0);
+	m_normal.assign(n, vec3(0));
+	m_uv.assign(n, vec2(0));
+	m_dpdu.assign(n, vec3(0));
+	m_dpdv.assign(n, vec3(0));
+}
+
+
+void PrimaryHitCache::store(int sample, int pixel, const vec2 &jitter, const RayIntersection &intersect) {
+	const size_t i = index(sample, pixel);
+	m_jitter[i] = jitter;
+	m_object_id[i] = intersect.m_valid ? intersect.m_object_id : -1;
+	m_distance[i] = intersect.m_distance;
+	m_normal[i] = intersect.m_normal;
+	m_uv[i] = intersect.m_uv_coord;
+	m_dpdu[i] = intersect.m_dpdu;
+	m_dpdv[i] = intersect.m_dpdv;
+}
+
+
+RayIntersection PrimaryHitCache::load(const Scene &scene, const Ray &ray, int sample, int pixel) const {
+	const size_t i = index(sample, pixel);
+	RayIntersection intersect;
+	if (m_object_id[i] < 0) return intersect;
+
+	SceneObject *object = scene.object(m_object_id[i]);
+	intersect.m_valid = true;
+	intersect.m_distance = m_distance[i];
+	intersect.m_normal = m_normal[i];
+	intersect.m_uv_coord = m_uv[i];
+	intersect.m_dpdu = m_dpdu[i];
+	intersect.m_dpdv = m_dpdv[i];
+	intersect.m_shape = object->shape().get();
+	intersect.m_material = object->material().get();
+	intersect.m_object_id = object->objectId();
+	intersect.m_material_id = object->materialId();
+
+	// same footprint and offset as Scene::intersect
+	intersect.computeDifferentials(ray);
+	intersect.m_position = ray.origin + intersect.m_distance * ray.direction + intersect.m_normal * .0001f;
+
+	return intersect;
+}
+
+
+size_t PrimaryHitCache::bytes() const {
+	return m_jitter.size() * sizeof(vec2)
+		+ m_object_id.size() * sizeof(int)
+		+ m_distance.size() * sizeof(float)
+		+ m_normal.size() * sizeof(vec3)
+		+ m_uv.size() * sizeof(vec2)
+		+ (m_dpdu.size() + m_dpdv.size()) * sizeof(vec3);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "scene/ray.hpp"
+#include "scene/scene.hpp"
+
+
+// Caches the primary (camera ray) intersection of the first few
+// samples of every pixel. As long as the camera and geometry
+// stay the same, those samples can be re-shaded after a light or
+// material edit without traversing the scene again.
+// Stored per sample as planes of pixel values (structure of arrays).
+class PrimaryHitCache {
+private:
+	int m_pixels = 0;
+	int m_samples = 0;
+	int m_valid_samples = 0;
+
+	std::vector<glm::vec2> m_jitter;
+	std::vector<int> m_object_id; // -1 for a miss
+	std::vector<float> m_distance;
+	std::vector<glm::vec3> m_normal;
+	std::vector<glm::vec2> m_uv;
+	std::vector<glm::vec3> m_dpdu, m_dpdv; // for the ray footprint (texture lod)
+
+public:
+	PrimaryHitCache() { }
+
+	// reallocates the cache, invalidating everything
+	void resize(int pixels, int samples);
+
+	// forget all cached samples (camera or geometry changed)
+	void invalidate() { m_valid_samples = 0; }
+
+	int pixels() const { return m_pixels; }
+	int samples() const { return m_samples; }
+	int validSamples() const { return m_valid_samples; }
+
+	// mark the first n samples of every pixel as stored
+	void setValidSamples(int n) { m_valid_samples = glm::min(n, m_samples); }
+
+	// true if the sample has been stored for every pixel
+	bool valid(int sample) const { return sample < m_valid_samples; }
+
+	// true if the sample is one of the cached ones
+	bool caches(int sample) const { return sample < m_samples; }
+
+	// jitter of the camera ray for a cached sample
+	glm::vec2 jitter(int sample, int pixel) const { return m_jitter[index(sample, pixel)]; }
+
+	// record the intersection of a sample
+	void store(int sample, int pixel, const glm::vec2 &jitter, const RayIntersection &intersect);
+
+	// reconstructs the intersection of a cached sample
+	// ray must be the camera ray regenerated with the cached jitter,
+	// its differentials give the same footprint as a traced hit
+	RayIntersection load(const Scene &scene, const Ray &ray, int sample, int pixel) const;
+
+	// memory used by the cache
+	size_t bytes() const;
+
+private:
+	size_t index(int sample, int pixel) const { return size_t(sample) * m_pixels + pixel; }
+};
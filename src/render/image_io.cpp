@@ -0,0 +1,642 @@
+
+// std
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+// project
+#include "image_io.hpp"
+#include "random.hpp"
+
+
+using namespace std;
+
+
+namespace {
+
+	// display.glsl's tone mapping, pow(1 - exp(-exposure * c), 0.45),
+	// as the colors where each 8 bit level starts. Looking up the level
+	// is exact, unlike a table of the (very steep near black) curve.
+	class ToneCurve {
+	private:
+		// cells of 1/128 of an octave over [2^-32, 2^32)
+		static constexpr int cell_bits = 7, first_cell = (127 - 32) << cell_bits, cells = 64 << cell_bits;
+
+		float m_start[257]; // m_start[b] is where 255 * curve(c) reaches b
+		float m_scale[256]; // 1 / (m_start[b + 1] - m_start[b])
+		uint8_t m_level[cells]; // level at the start of each cell
+
+	public:
+		explicit ToneCurve(float exposure) {
+			for (int b = 0; b < 256; b++) m_start[b] = -log(1 - pow(b / 255.f, 1 / 0.45f)) / exposure;
+			m_start[0] = 0;
+			m_start[256] = numeric_limits<float>::infinity();
+			for (int b = 0; b < 256; b++) m_scale[b] = (b < 255) ? 1 / (m_start[b + 1] - m_start[b]) : 0;
+
+			// the first cell also holds everything below it
+			int b = 0;
+			m_level[0] = 0;
+			for (int i = 1; i < cells; i++) {
+				const uint32_t bits = uint32_t(first_cell + i) << (23 - cell_bits);
+				float c;
+				memcpy(&c, &bits, 4);
+				while (c >= m_start[b + 1]) b++;
+				m_level[i] = uint8_t(b);
+			}
+		}
+
+		// rounds 255 * curve(c) + dither (in [-0.5, 0.5)), the fraction
+		// within a level is taken as linear
+		unsigned char operator()(float c, float dither) const {
+			if (!(c > 0)) c = 0;
+			uint32_t bits;
+			memcpy(&bits, &c, 4);
+			const int cell = std::min(std::max(int(bits >> (23 - cell_bits)) - first_cell, 0), cells - 1);
+
+			// cells are small enough to rarely hold more than one level
+			int b = m_level[cell];
+			while (c >= m_start[b + 1]) b++;
+
+			const float f = (c - m_start[b]) * m_scale[b];
+			return (unsigned char)std::min(b + (f + dither >= 0.5f), 255);
+		}
+	};
+
+	uint32_t crc32(const unsigned char *data, size_t n, uint32_t crc = 0) {
+		static const auto table = []() {
+			array<uint32_t, 256> t;
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				t[i] = c;
+			}
+			return t;
+		}();
+		crc = ~crc;
+		for (size_t i = 0; i < n; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	const uint32_t adler_base = 65521;
+
+	uint32_t adler32(const unsigned char *data, size_t n) {
+		uint32_t a = 1, b = 0;
+		while (n > 0) {
+			// the sums can't overflow in 5552 bytes
+			const size_t block = std::min(n, size_t(5552));
+			for (size_t i = 0; i < block; i++) {
+				a += data[i];
+				b += a;
+			}
+			a %= adler_base;
+			b %= adler_base;
+			data += block;
+			n -= block;
+		}
+		return a | (b << 16);
+	}
+
+	// adler32 of two pieces of data joined, from the adler32 of each
+	uint32_t adler32Combine(uint32_t a1, uint32_t a2, size_t n2) {
+		const uint64_t rem = n2 % adler_base;
+		const uint64_t s1 = a1 & 0xffff, s2 = a1 >> 16, t1 = a2 & 0xffff, t2 = a2 >> 16;
+		const uint64_t sum1 = (s1 + t1 + adler_base - 1) % adler_base;
+		const uint64_t sum2 = (rem * s1 + s2 + t2 + adler_base - rem) % adler_base;
+		return uint32_t(sum1 | (sum2 << 16));
+	}
+
+	// deflate with the fixed huffman codes (like stb_image_write) but on
+	// a hash chain that is reset for every chunk, so chunks can be
+	// compressed at the same time and their output joined
+	class Deflater {
+	private:
+		static constexpr int window = 32768, hash_bits = 15, max_chain = 8;
+		static constexpr int good_length = 32; // long enough to stop looking for a longer match
+
+		struct Code { uint16_t bits; uint8_t length; };
+		Code m_literal[288];
+		uint16_t m_length_symbol[259], m_distance_symbol[512];
+
+		static const uint16_t * lengthBase() {
+			static const uint16_t base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			return base;
+		}
+		static const uint8_t * lengthExtra() {
+			static const uint8_t extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			return extra;
+		}
+		static const uint16_t * distanceBase() {
+			static const uint16_t base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			return base;
+		}
+		static const uint8_t * distanceExtra() {
+			static const uint8_t extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+			return extra;
+		}
+
+		static uint16_t reverse(uint16_t code, int length) {
+			uint16_t r = 0;
+			for (int i = 0; i < length; i++) r |= ((code >> i) & 1) << (length - 1 - i);
+			return r;
+		}
+
+		// lsb first bit output
+		struct Bits {
+			vector<unsigned char> &out;
+			uint64_t buffer = 0;
+			int count = 0;
+
+			void put(uint32_t bits, int n) {
+				buffer |= uint64_t(bits) << count;
+				count += n;
+				while (count >= 8) {
+					out.push_back((unsigned char)buffer);
+					buffer >>= 8;
+					count -= 8;
+				}
+			}
+
+			void align() { if (count > 0) put(0, 8 - count); }
+		};
+
+		void literal(Bits &bits, int symbol) const { bits.put(m_literal[symbol].bits, m_literal[symbol].length); }
+
+		void match(Bits &bits, int length, int distance) const {
+			const int l = m_length_symbol[length];
+			literal(bits, 257 + l);
+			bits.put(length - lengthBase()[l], lengthExtra()[l]);
+			const int d = (distance <= 256) ? m_distance_symbol[distance - 1] : m_distance_symbol[256 + ((distance - 1) >> 7)];
+			bits.put(reverse(uint16_t(d), 5), 5);
+			bits.put(distance - distanceBase()[d], distanceExtra()[d]);
+		}
+
+	public:
+		Deflater() {
+			for (int i = 0; i < 288; i++) {
+				Code &c = m_literal[i];
+				if (i < 144) c = { uint16_t(0x30 + i), 8 };
+				else if (i < 256) c = { uint16_t(0x190 + i - 144), 9 };
+				else if (i < 280) c = { uint16_t(i - 256), 7 };
+				else c = { uint16_t(0xc0 + i - 280), 8 };
+				c.bits = reverse(c.bits, c.length);
+			}
+			for (int l = 0; l < 29; l++) {
+				const int end = (l < 28) ? lengthBase()[l + 1] : 259;
+				for (int n = lengthBase()[l]; n < end; n++) m_length_symbol[n] = uint16_t(l);
+			}
+			// distances up to 256 directly, then in steps of 128
+			for (int d = 0; d < 30; d++) {
+				const int end = (d < 29) ? distanceBase()[d + 1] : 32769;
+				for (int n = distanceBase()[d]; n < end; n++) {
+					if (n <= 256) m_distance_symbol[n - 1] = uint16_t(d);
+					else m_distance_symbol[256 + ((n - 1) >> 7)] = uint16_t(d);
+				}
+			}
+		}
+
+		// appends one fixed huffman block of data to out, a final block
+		// if last, otherwise followed by an empty stored block so the
+		// output ends on a byte and the next chunk can follow it
+		void compress(const unsigned char *data, size_t n, bool last, vector<unsigned char> &out) const {
+			Bits bits{ out };
+			bits.put(last ? 1 : 0, 1);
+			bits.put(1, 2);
+
+			vector<int32_t> head(size_t(1) << hash_bits, -1), previous(n);
+			auto hash = [&](size_t i) {
+				const uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+				return (v * 2654435761u) >> (32 - hash_bits);
+			};
+			auto insert = [&](size_t i) {
+				if (i + 3 > n) return;
+				const uint32_t h = hash(i);
+				previous[i] = head[h];
+				head[h] = int32_t(i);
+			};
+
+			size_t i = 0;
+			while (i < n) {
+				int best = 0, best_distance = 0;
+				if (i + 3 <= n) {
+					const size_t limit = std::min(n - i, size_t(258));
+					int32_t candidate = head[hash(i)];
+					for (int chain = 0; chain < max_chain && candidate >= 0 && i - candidate <= size_t(window); chain++) {
+						// a match to the end of the data can't be beaten (and a[best] would be past it)
+						if (size_t(best) >= limit) break;
+						const unsigned char *a = data + candidate, *b = data + i;
+						if (a[best] == b[best]) {
+							int length = 0;
+							while (size_t(length) < limit && a[length] == b[length]) length++;
+							if (length > best) {
+								best = length;
+								best_distance = int(i - candidate);
+								if (length >= good_length) break;
+							}
+						}
+						candidate = previous[candidate];
+					}
+				}
+
+				if (best >= 3) {
+					match(bits, best, best_distance);
+					// long matches (runs of flat color) are skipped over
+					for (int k = 0; k < std::min(best, good_length); k++) insert(i + k);
+					i += best;
+				} else {
+					literal(bits, data[i]);
+					insert(i);
+					i++;
+				}
+			}
+			literal(bits, 256);
+
+			if (!last) {
+				bits.put(0, 3);
+				bits.align();
+				bits.put(0, 16);
+				bits.put(0xffff, 16);
+			}
+			bits.align();
+		}
+	};
+
+	void putBigEndian(vector<unsigned char> &out, uint32_t v) {
+		for (int s = 24; s >= 0; s -= 8) out.push_back((unsigned char)(v >> s));
+	}
+
+	// length, type, data and the crc of the type and data
+	void putChunk(vector<unsigned char> &out, const char *type, const unsigned char *data, size_t n, uint32_t crc) {
+		putBigEndian(out, uint32_t(n));
+		out.insert(out.end(), type, type + 4);
+		out.insert(out.end(), data, data + n);
+		putBigEndian(out, crc);
+	}
+
+	// png filter predictors (1 sub, 2 up, 3 average, 4 paeth) of a byte
+	// from the one to the left (a), above (b) and above left (c)
+	template <int filter>
+	inline int predict(int a, int b, int c) {
+		switch (filter) {
+		case 1: return a;
+		case 2: return b;
+		case 3: return (a + b) >> 1;
+		case 4: {
+			const int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+			return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+		}
+		default: return 0;
+		}
+	}
+
+	// a row of n bytes through a filter, returns the sum of the
+	// residuals as signed bytes
+	template <int filter>
+	int filterRow(const unsigned char *row, const unsigned char *above, size_t n, unsigned char *out) {
+		int sum = 0;
+		auto residual = [&](size_t i, int a, int c) {
+			const unsigned char v = (unsigned char)(row[i] - predict<filter>(a, above[i], c));
+			out[i] = v;
+			sum += abs(int((signed char)v));
+		};
+		for (size_t i = 0; i < std::min(n, size_t(3)); i++) residual(i, 0, 0);
+		for (size_t i = 3; i < n; i++) residual(i, row[i - 3], above[i - 3]);
+		return sum;
+	}
+
+	// exr files are little endian, like every machine this runs on, so
+	// values are copied as they are
+	template <typename T>
+	void put(vector<char> &out, const T &value) {
+		const char *p = reinterpret_cast<const char *>(&value);
+		out.insert(out.end(), p, p + sizeof(T));
+	}
+
+	void putString(vector<char> &out, const string &s) {
+		out.insert(out.end(), s.c_str(), s.c_str() + s.size() + 1);
+	}
+
+	// name, type, size and value
+	void putAttribute(vector<char> &out, const char *name, const char *type, const void *value, int32_t size) {
+		putString(out, name);
+		putString(out, type);
+		put(out, size);
+		const char *p = reinterpret_cast<const char *>(value);
+		out.insert(out.end(), p, p + size);
+	}
+
+	struct EXRPart {
+		string name;
+		vector<ImageChannel> channels; // sorted by name, the order they are stored in
+		vector<vector<char>> chunks;   // line blocks, top to bottom
+	};
+
+	// lines per block for a compression
+	int blockLines(const EXROptions &options) {
+		return options.compress ? 16 : 1;
+	}
+
+	// float to half rounding to nearest even, without the branches
+	// on every exponent of glm::packHalf1x16
+	uint16_t toHalf(float f) {
+		uint32_t x;
+		memcpy(&x, &f, 4);
+		const uint32_t sign = (x >> 16) & 0x8000;
+		x &= 0x7fffffff;
+
+		// too big for a half, infinity or nan
+		if (x >= 0x47800000) return uint16_t(sign | ((x > 0x7f800000) ? 0x7e00 : 0x7c00));
+
+		// denormals, adding 0.5 leaves the rounded mantissa in the low bits
+		if (x < 0x38800000) {
+			float a;
+			memcpy(&a, &x, 4);
+			a += 0.5f;
+			memcpy(&x, &a, 4);
+			return uint16_t(sign | (x - 0x3f000000));
+		}
+
+		// rebias the exponent and round
+		x += 0xc8000fff + ((x >> 13) & 1);
+		return uint16_t(sign | (x >> 13));
+	}
+
+	bool half(const ImageChannel &c, const EXROptions &options) {
+		return options.type == EXRPixelType::Half && !c.full_precision;
+	}
+
+	vector<char> header(const EXRPart &part, int width, int height, const EXROptions &options, bool multipart) {
+		vector<char> out;
+
+		vector<char> chlist;
+		for (const ImageChannel &c : part.channels) {
+			putString(chlist, c.name);
+			put(chlist, int32_t(half(c, options) ? 1 : 2)); // HALF or FLOAT
+			put(chlist, int32_t(0)); // pLinear and reserved
+			put(chlist, int32_t(1)); // x and y sampling
+			put(chlist, int32_t(1));
+		}
+		chlist.push_back(0);
+		putAttribute(out, "channels", "chlist", chlist.data(), int32_t(chlist.size()));
+
+		const uint8_t compression = options.compress ? 3 : 0; // ZIP_COMPRESSION or NO_COMPRESSION
+		putAttribute(out, "compression", "compression", &compression, 1);
+		const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+		putAttribute(out, "dataWindow", "box2i", window, sizeof(window));
+		putAttribute(out, "displayWindow", "box2i", window, sizeof(window));
+		const uint8_t line_order = 0; // INCREASING_Y
+		putAttribute(out, "lineOrder", "lineOrder", &line_order, 1);
+		const float aspect = 1, center[2] = { 0, 0 }, window_width = 1;
+		putAttribute(out, "pixelAspectRatio", "float", &aspect, sizeof(float));
+		putAttribute(out, "screenWindowCenter", "v2f", center, sizeof(center));
+		putAttribute(out, "screenWindowWidth", "float", &window_width, sizeof(float));
+
+		if (multipart) {
+			putAttribute(out, "name", "string", part.name.c_str(), int32_t(part.name.size()));
+			putAttribute(out, "type", "string", "scanlineimage", 13);
+			const int32_t chunks = int32_t(part.chunks.size());
+			putAttribute(out, "chunkCount", "int", &chunks, sizeof(int32_t));
+		}
+
+		out.push_back(0);
+		return out;
+	}
+
+	// a chunk of lines [y0, y1) without the part number, every channel
+	// of a line one after another
+	void encodeBlock(const EXRPart &part, int width, int y0, int y1, const EXROptions &options, vector<char> &chunk) {
+		size_t line_size = 0;
+		for (const ImageChannel &c : part.channels) line_size += size_t(width) * (half(c, options) ? 2 : 4);
+
+		vector<unsigned char> raw(size_t(y1 - y0) * line_size);
+		unsigned char *p = raw.data();
+		for (int y = y0; y < y1; y++) {
+			for (const ImageChannel &c : part.channels) {
+				const float *src = c.data + size_t(y) * width * c.stride;
+				if (half(c, options)) {
+					for (int x = 0; x < width; x++, src += c.stride, p += 2) {
+						const uint16_t h = toHalf(*src);
+						memcpy(p, &h, 2);
+					}
+				} else {
+					for (int x = 0; x < width; x++, src += c.stride, p += 4) memcpy(p, src, 4);
+				}
+			}
+		}
+
+		chunk.clear();
+		put(chunk, int32_t(y0));
+		if (!options.compress) {
+			put(chunk, int32_t(raw.size()));
+			chunk.insert(chunk.end(), raw.begin(), raw.end());
+			return;
+		}
+
+		// zip: bytes split into even and odd halves, then delta coded
+		// so the high bytes of similar values become runs of zeros
+		const size_t n = raw.size();
+		vector<unsigned char> split(n);
+		for (size_t i = 0; i < n; i++) split[(i & 1) ? (n + 1) / 2 + i / 2 : i / 2] = raw[i];
+		for (size_t i = n - 1; i > 0; i--) split[i] = (unsigned char)(int(split[i]) - split[i - 1] + 128);
+
+		static const Deflater deflater;
+		vector<unsigned char> deflated = { 0x78, 0x01 };
+		deflater.compress(split.data(), n, true, deflated);
+		putBigEndian(deflated, adler32(split.data(), n));
+		if (deflated.size() < n) {
+			put(chunk, int32_t(deflated.size()));
+			chunk.insert(chunk.end(), deflated.begin(), deflated.end());
+		} else {
+			// stored as is when it doesn't get smaller
+			put(chunk, int32_t(n));
+			chunk.insert(chunk.end(), raw.begin(), raw.end());
+		}
+	}
+}
+
+
+bool writePNG(const string &filename, int width, int height, const float *rgb, float exposure) {
+	vector<unsigned char> png;
+	encodePNG(width, height, rgb, exposure, png);
+	ofstream out(filename, ios::binary | ios::trunc);
+	out.write(reinterpret_cast<const char *>(png.data()), streamsize(png.size()));
+	return bool(out);
+}
+
+
+void encodePNG(int width, int height, const float *rgb, float exposure, vector<unsigned char> &png) {
+	static const Deflater deflater;
+	const ToneCurve curve(exposure);
+	const size_t row_bytes = size_t(width) * 3, stride = row_bytes + 1;
+
+	// tone mapped rows, dithered by a hash of the pixel like the display
+	vector<unsigned char> pixels(row_bytes * height);
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		const float *src = rgb + y * row_bytes;
+		unsigned char *dst = pixels.data() + y * row_bytes;
+		for (int x = 0; x < width; x++) {
+			const float dither = toUnitFloat(pcgHash(uint32_t(x + y * width))) - 0.5f;
+			for (int c = 0; c < 3; c++) dst[3 * x + c] = curve(src[3 * x + c], dither);
+		}
+	}
+
+	// every row filtered on its own, with the filter that leaves the
+	// smallest residuals (the usual heuristic, and stb_image_write's)
+	vector<unsigned char> filtered(stride * height);
+	const vector<unsigned char> zeros(row_bytes, 0); // above the first row
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		const unsigned char *row = pixels.data() + y * row_bytes;
+		const unsigned char *above = (y > 0) ? row - row_bytes : zeros.data();
+		unsigned char *dst = filtered.data() + y * stride;
+
+		static thread_local vector<unsigned char> line;
+		line.resize(row_bytes);
+		int best_sum = numeric_limits<int>::max();
+		for (int filter = 0; filter < 5; filter++) {
+			int sum = 0;
+			switch (filter) {
+			case 0: sum = filterRow<0>(row, above, row_bytes, line.data()); break;
+			case 1: sum = filterRow<1>(row, above, row_bytes, line.data()); break;
+			case 2: sum = filterRow<2>(row, above, row_bytes, line.data()); break;
+			case 3: sum = filterRow<3>(row, above, row_bytes, line.data()); break;
+			default: sum = filterRow<4>(row, above, row_bytes, line.data());
+			}
+			if (sum < best_sum) {
+				best_sum = sum;
+				dst[0] = (unsigned char)filter;
+				memcpy(dst + 1, line.data(), row_bytes);
+			}
+		}
+	}
+
+	// chunks of rows deflated at the same time, each its own IDAT
+	const int rows = std::max(int((256 << 10) / stride), 1);
+	const int chunks = (height + rows - 1) / rows;
+	vector<vector<unsigned char>> idat(chunks);
+	vector<uint32_t> adler(chunks), crc(chunks);
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < chunks; k++) {
+		const size_t begin = size_t(k) * rows * stride, end = std::min(size_t(k + 1) * rows, size_t(height)) * stride;
+		vector<unsigned char> &out = idat[k];
+		out.reserve((end - begin) / 2);
+		out.insert(out.end(), { 'I', 'D', 'A', 'T' });
+		if (k == 0) out.insert(out.end(), { 0x78, 0x01 }); // zlib header
+		deflater.compress(filtered.data() + begin, end - begin, k == chunks - 1, out);
+		adler[k] = adler32(filtered.data() + begin, end - begin);
+		crc[k] = crc32(out.data(), out.size());
+	}
+
+	png.clear();
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	png.insert(png.end(), signature, signature + 8);
+
+	vector<unsigned char> header;
+	header.insert(header.end(), { 'I', 'H', 'D', 'R' });
+	putBigEndian(header, uint32_t(width));
+	putBigEndian(header, uint32_t(height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit rgb, no interlacing
+	putChunk(png, "IHDR", header.data() + 4, header.size() - 4, crc32(header.data(), header.size()));
+
+	uint32_t checksum = 1;
+	for (int k = 0; k < chunks; k++) {
+		putChunk(png, "IDAT", idat[k].data() + 4, idat[k].size() - 4, crc[k]);
+		const size_t n = (std::min(size_t(k + 1) * rows, size_t(height)) - size_t(k) * rows) * stride;
+		checksum = adler32Combine(checksum, adler[k], n);
+	}
+
+	// the zlib checksum in an IDAT of its own, after all the data
+	vector<unsigned char> tail = { 'I', 'D', 'A', 'T' };
+	putBigEndian(tail, checksum);
+	putChunk(png, "IDAT", tail.data() + 4, 4, crc32(tail.data(), tail.size()));
+
+	const unsigned char end[4] = { 'I', 'E', 'N', 'D' };
+	putChunk(png, "IEND", nullptr, 0, crc32(end, 4));
+}
+
+
+bool writePFM(const string &filename, int width, int height, const float *data, int channels) {
+	ofstream out(filename, ios::binary | ios::trunc);
+	if (!out) return false;
+
+	// a negative scale marks little endian values
+	const uint16_t one = 1;
+	const bool little_endian = *reinterpret_cast<const unsigned char *>(&one) == 1;
+	out << ((channels == 1) ? "Pf" : "PF") << "\n" << width << " " << height << "\n" << (little_endian ? "-1.0" : "1.0") << "\n";
+
+	// rows go from the bottom up
+	for (int y = height - 1; y >= 0; y--) {
+		out.write(reinterpret_cast<const char *>(data + size_t(y) * width * channels), streamsize(sizeof(float)) * width * channels);
+	}
+	return bool(out);
+}
+
+
+bool writeEXR(const string &filename, int width, int height, const vector<ImageChannel> &channels, const EXROptions &options) {
+	return writeEXR(filename, width, height, vector<ImagePart>{ { "rgba", channels } }, options);
+}
+
+
+bool writeEXR(const string &filename, int width, int height, const vector<ImagePart> &parts, const EXROptions &options) {
+	if (parts.empty() || width <= 0 || height <= 0) return false;
+
+	const int lines = blockLines(options);
+	const int blocks = (height + lines - 1) / lines;
+	vector<EXRPart> encoded(parts.size());
+	for (size_t i = 0; i < parts.size(); i++) {
+		encoded[i].name = parts[i].name;
+		encoded[i].channels = parts[i].channels;
+		sort(encoded[i].channels.begin(), encoded[i].channels.end(),
+			[](const ImageChannel &a, const ImageChannel &b) { return a.name < b.name; });
+		encoded[i].chunks.resize(blocks);
+	}
+
+	// every block of every part is independent
+	const int jobs = int(parts.size()) * blocks;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int j = 0; j < jobs; j++) {
+		EXRPart &part = encoded[j / blocks];
+		const int y0 = (j % blocks) * lines;
+		encodeBlock(part, width, y0, std::min(y0 + lines, height), options, part.chunks[j % blocks]);
+	}
+
+	// magic, version (2) and the multi-part flag
+	const bool multipart = parts.size() > 1;
+	vector<char> head;
+	put(head, int32_t(20000630));
+	put(head, int32_t(multipart ? 0x1002 : 2));
+	for (const EXRPart &part : encoded) {
+		const vector<char> h = header(part, width, height, options, multipart);
+		head.insert(head.end(), h.begin(), h.end());
+	}
+	if (multipart) head.push_back(0);
+
+	// offset tables of every part, then the chunks (tagged with their part)
+	uint64_t offset = head.size() + encoded.size() * blocks * sizeof(uint64_t);
+	for (size_t i = 0; i < encoded.size(); i++) {
+		for (const vector<char> &chunk : encoded[i].chunks) {
+			put(head, offset);
+			offset += chunk.size() + (multipart ? sizeof(int32_t) : 0);
+		}
+	}
+
+	ofstream out(filename, ios::binary | ios::trunc);
+	out.write(head.data(), streamsize(head.size()));
+	for (size_t i = 0; i < encoded.size(); i++) {
+		for (const vector<char> &chunk : encoded[i].chunks) {
+			if (multipart) {
+				const int32_t index = int32_t(i);
+				out.write(reinterpret_cast<const char *>(&index), sizeof(index));
+			}
+			out.write(chunk.data(), streamsize(chunk.size()));
+		}
+	}
+	return bool(out);
+}
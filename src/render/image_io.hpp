@@ -0,0 +1,58 @@
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+
+// Saves a float rgb image (3 floats per pixel, top row first) as a png,
+// with the same tone mapping as display.glsl (1 - exp(-exposure * c),
+// a 0.45 gamma and dithering). Rows are filtered, and chunks of them
+// deflated, in parallel.
+bool writePNG(const std::string &filename, int width, int height, const float *rgb, float exposure = 1);
+
+// the png file writePNG saves, in memory
+void encodePNG(int width, int height, const float *rgb, float exposure, std::vector<unsigned char> &png);
+
+// Saves a linear float rgb image (3 floats per pixel, top row first)
+// as a pfm, or a single channel as a greyscale pfm if channels is 1
+bool writePFM(const std::string &filename, int width, int height, const float *data, int channels = 3);
+
+
+// how the pixels of an exr are stored
+enum class EXRPixelType { Half, Float };
+
+
+// A plane of an image, the pixel (x, y) is data[(x + y*width) * stride]
+// (top row first). Names follow the exr conventions, "R", "G", "B" for
+// the color and "<layer>.<channel>" for everything else.
+struct ImageChannel {
+	std::string name;
+	const float *data = nullptr;
+	int stride = 1;
+	bool full_precision = false; // float even in a half image (e.g. ids)
+};
+
+
+// a part of a multi-part exr
+struct ImagePart {
+	std::string name;
+	std::vector<ImageChannel> channels;
+};
+
+
+struct EXROptions {
+	EXRPixelType type = EXRPixelType::Half;
+	bool compress = true; // zip compression (blocks of 16 lines)
+};
+
+
+// Saves channels as a linear scanline OpenEXR image. Blocks are
+// converted and compressed in parallel.
+bool writeEXR(const std::string &filename, int width, int height,
+	const std::vector<ImageChannel> &channels, const EXROptions &options = EXROptions());
+
+// Saves each part as its own image in a multi-part OpenEXR file
+// (a single part is written as a plain scanline image)
+bool writeEXR(const std::string &filename, int width, int height,
+	const std::vector<ImagePart> &parts, const EXROptions &options = EXROptions());
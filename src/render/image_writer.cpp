@@ -0,0 +1,185 @@
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// openmp (if avaliable)
+#ifdef CGRA_HAVE_OPENMP
+#include <omp.h>
+#endif // CGRA_HAVE_OPENMP
+
+// project
+#include "image_writer.hpp"
+
+
+using namespace std;
+
+
+namespace {
+
+	// names of the channels of an aov within its layer
+	const char * channelName(AOV a, int c) {
+		static const char *xyz[3] = { "X", "Y", "Z" };
+		static const char *rgb[3] = { "R", "G", "B" };
+		switch (a) {
+		case AOV::Normal: return xyz[c];
+		case AOV::MaterialID:
+		case AOV::ObjectID: return "id";
+		default: return rgb[c];
+		}
+	}
+}
+
+
+const char * ImageWriter::layer(AOV a) {
+	switch (a) {
+	case AOV::Depth: return "depth";
+	case AOV::Normal: return "normal";
+	case AOV::Albedo: return "albedo";
+	case AOV::MaterialID: return "material";
+	case AOV::ObjectID: return "object";
+	case AOV::Direct: return "direct";
+	case AOV::Indirect: return "indirect";
+	default: return "";
+	}
+}
+
+
+bool ImageWriter::write(const string &filename, int width, int height, const float *color, int stride,
+	const AOVBuffer *aovs, const ImageWriteOptions &options) {
+	if (m_busy) return false;
+	if (m_thread.joinable()) m_thread.join();
+
+	const auto time_begin = chrono::steady_clock::now();
+
+	// this copy is the only part that holds up the render
+	m_width = width;
+	m_height = height;
+	const size_t n = size_t(width) * height;
+	m_color.resize(3 * n);
+	for (size_t i = 0; i < n; i++) {
+		for (int c = 0; c < 3; c++) m_color[3 * i + c] = color[i * stride + c];
+	}
+	if (aovs && options.aovs) m_aovs = *aovs;
+	else m_aovs.resize(0, 0, 0);
+
+	m_busy = true;
+	m_thread = thread([this, filename, options, time_begin]() {
+		const bool ok = save(filename, options);
+		if (ok) printf("Wrote image: %s\n", filename.c_str());
+		else fprintf(stderr, "Error: Failed to write image %s\n", filename.c_str());
+
+		m_write_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+		m_busy = false;
+	});
+
+	return true;
+}
+
+
+bool ImageWriter::save(const string &filename, const ImageWriteOptions &options) const {
+	const int w = m_width, h = m_height;
+
+	if (options.format == ImageFormat::PFM) {
+		bool ok = writePFM(filename + ".pfm", w, h, m_color.data());
+
+		// interleaved again for the pfm
+		vector<float> interleaved;
+		for (int i = 0; i < int(AOV::Count); i++) {
+			const AOV a = AOV(i);
+			if (!m_aovs.enabled(a)) continue;
+			const int channels = AOVBuffer::channels(a);
+			interleaved.resize(size_t(w) * h * channels);
+			for (int c = 0; c < channels; c++) {
+				const float *plane = m_aovs.plane(a, c);
+				for (size_t p = 0; p < size_t(w) * h; p++) interleaved[p * channels + c] = plane[p];
+			}
+			ok &= writePFM(filename + "." + layer(a) + ".pfm", w, h, interleaved.data(), channels);
+		}
+		return ok;
+	}
+
+	vector<ImagePart> parts(1);
+	parts[0].name = "rgba";
+	for (int c = 0; c < 3; c++) parts[0].channels.push_back({ string(1, "RGB"[c]), m_color.data() + c, 3 });
+
+	for (int i = 0; i < int(AOV::Count); i++) {
+		const AOV a = AOV(i);
+		if (!m_aovs.enabled(a)) continue;
+		if (options.multipart) parts.push_back({ layer(a), {} });
+		ImagePart &part = parts.back();
+
+		// ids are kept exact, halfs only hold integers up to 2048
+		const bool id = a == AOV::MaterialID || a == AOV::ObjectID;
+		for (int c = 0; c < AOVBuffer::channels(a); c++) {
+			const string name = (a == AOV::Depth) ? string("Z") : string(layer(a)) + "." + channelName(a, c);
+			part.channels.push_back({ name, m_aovs.plane(a, c), 1, id });
+		}
+	}
+
+	return writeEXR(filename + ".exr", w, h, parts, options.exr);
+}
+
+
+void ImageWriter::wait() {
+	if (m_thread.joinable()) m_thread.join();
+}
+
+
+ImageQueue::ImageQueue(int threads, int capacity, float exposure)
+	: m_capacity(size_t(std::max(capacity, 1))), m_exposure(exposure) {
+	threads = std::max(threads, 1);
+	for (int i = 0; i < threads; i++) {
+		m_threads.emplace_back([this, threads]() {
+#ifdef CGRA_HAVE_OPENMP
+			// the writers share the cores between their encodes
+			omp_set_num_threads(std::max(omp_get_max_threads() / threads, 1));
+#endif // CGRA_HAVE_OPENMP
+			run();
+		});
+	}
+}
+
+
+void ImageQueue::push(const string &filename, int width, int height, vector<float> rgb) {
+	unique_lock<mutex> lock(m_lock);
+	m_popped.wait(lock, [&]() { return m_frames.size() < m_capacity; });
+	m_frames.push_back({ filename, width, height, move(rgb) });
+	m_pushed.notify_one();
+}
+
+
+void ImageQueue::run() {
+	for (;;) {
+		Frame frame;
+		{
+			unique_lock<mutex> lock(m_lock);
+			m_pushed.wait(lock, [&]() { return m_closed || !m_frames.empty(); });
+			if (m_frames.empty()) return;
+			frame = move(m_frames.front());
+			m_frames.pop_front();
+			m_popped.notify_one();
+		}
+
+		if (writePNG(frame.filename, frame.width, frame.height, frame.rgb.data(), m_exposure)) {
+			m_written++;
+		} else {
+			fprintf(stderr, "Error: Failed to write %s\n", frame.filename.c_str());
+			m_failed++;
+		}
+	}
+}
+
+
+bool ImageQueue::finish() {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_closed = true;
+	}
+	m_pushed.notify_all();
+	for (thread &t : m_threads) {
+		if (t.joinable()) t.join();
+	}
+	return m_failed == 0;
+}
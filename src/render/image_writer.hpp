@@ -0,0 +1,113 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// project
+#include "aov.hpp"
+#include "image_io.hpp"
+
+
+enum class ImageFormat { EXR, PFM };
+
+
+struct ImageWriteOptions {
+	ImageFormat format = ImageFormat::EXR;
+	EXROptions exr;
+	bool aovs = true;       // save the enabled aovs along with the color
+	bool multipart = false; // aovs in their own parts of the exr rather than as layers
+};
+
+
+// Saves the linear color and aovs of a render on a background thread,
+// straight from the cpu buffers. The buffers are copied into a staging
+// area first so the render can keep going while the file is encoded.
+//
+// Exrs hold the color as R, G, B and every aov as a layer ("Z" for the
+// depth, "normal.X", "albedo.R", "object.id", ...). Pfms can only hold
+// one image, so the aovs go in their own files next to the color
+// ("<filename>.normal.pfm").
+class ImageWriter {
+private:
+	std::thread m_thread;
+	std::atomic<bool> m_busy{false};
+	int m_width = 0, m_height = 0;
+	std::vector<float> m_color; // rgb
+	AOVBuffer m_aovs;
+	std::atomic<float> m_write_time{0};
+
+	bool save(const std::string &filename, const ImageWriteOptions &options) const;
+
+public:
+	ImageWriter() { }
+	~ImageWriter() { wait(); }
+
+	ImageWriter(const ImageWriter&) = delete;
+	ImageWriter& operator=(const ImageWriter&) = delete;
+
+	// layer an aov is saved as (and the suffix of its pfm)
+	static const char * layer(AOV a);
+
+	// starts saving color (stride floats per pixel, rgb first) and the
+	// aovs (if not nullptr) to filename, the extension is added
+	// returns false without doing anything if the last write is still going
+	bool write(const std::string &filename, int width, int height, const float *color, int stride,
+		const AOVBuffer *aovs, const ImageWriteOptions &options = ImageWriteOptions());
+
+	// blocks until the current write (if any) finishes
+	void wait();
+
+	bool busy() const { return m_busy; }
+
+	// ms the last write took (including the copy)
+	float writeTime() const { return m_write_time; }
+};
+
+
+// Bounded queue of finished frames, saved as pngs by writer threads (taken
+// in the order they were pushed). push blocks while the queue is full, so a
+// renderer that gets ahead of the disk waits instead of holding every
+// frame in memory.
+class ImageQueue {
+private:
+	struct Frame {
+		std::string filename;
+		int width = 0, height = 0;
+		std::vector<float> rgb;
+	};
+
+	size_t m_capacity;
+	float m_exposure;
+	std::mutex m_lock;
+	std::condition_variable m_pushed, m_popped;
+	std::deque<Frame> m_frames;
+	bool m_closed = false;
+	std::vector<std::thread> m_threads;
+	std::atomic<int> m_written{0}, m_failed{0};
+
+	void run();
+
+public:
+	// threads writing at once, frames queued (not counting the ones being written)
+	ImageQueue(int threads = 2, int capacity = 4, float exposure = 1);
+	~ImageQueue() { finish(); }
+
+	ImageQueue(const ImageQueue&) = delete;
+	ImageQueue& operator=(const ImageQueue&) = delete;
+
+	// queues a frame (3 floats per pixel, top row first) to be saved to filename
+	void push(const std::string &filename, int width, int height, std::vector<float> rgb);
+
+	// waits for every queued frame to be written, then stops the threads
+	// returns false if any of them failed
+	bool finish();
+
+	int written() const { return m_written; }
+	int failed() const { return m_failed; }
+};
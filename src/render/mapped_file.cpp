@@ -0,0 +1,115 @@
+
+// std
+#include <utility>
+
+// platform
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// project
+#include "mapped_file.hpp"
+
+
+using namespace std;
+
+
+MappedFile& MappedFile::operator=(MappedFile &&other) noexcept {
+	if (this != &other) {
+		close();
+		swap(m_data, other.m_data);
+		swap(m_size, other.m_size);
+#ifdef _WIN32
+		swap(m_file, other.m_file);
+		swap(m_mapping, other.m_mapping);
+#else
+		swap(m_fd, other.m_fd);
+#endif
+	}
+	return *this;
+}
+
+
+#ifdef _WIN32
+
+bool MappedFile::open(const string &filename) {
+	close();
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		close();
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		close();
+		return false;
+	}
+	m_mapping = mapping;
+
+	m_data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data) {
+		close();
+		return false;
+	}
+	m_size = size_t(size.QuadPart);
+	return true;
+}
+
+
+void MappedFile::close() {
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file) CloseHandle(m_file);
+	m_data = nullptr;
+	m_size = 0;
+	m_mapping = nullptr;
+	m_file = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const string &filename) {
+	close();
+
+	m_fd = ::open(filename.c_str(), O_RDONLY);
+	if (m_fd < 0) return false;
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || st.st_size == 0) {
+		close();
+		return false;
+	}
+
+	void *data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, m_fd, 0);
+	if (data == MAP_FAILED) {
+		close();
+		return false;
+	}
+	m_data = static_cast<const char *>(data);
+	m_size = size_t(st.st_size);
+	return true;
+}
+
+
+void MappedFile::close() {
+	if (m_data) munmap(const_cast<char *>(m_data), m_size);
+	if (m_fd >= 0) ::close(m_fd);
+	m_data = nullptr;
+	m_size = 0;
+	m_fd = -1;
+}
+
+#endif
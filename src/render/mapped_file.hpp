@@ -0,0 +1,42 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <string>
+#include <utility>
+
+
+// Read-only memory mapping of a whole file. Pages are loaded
+// lazily by the OS the first time they are touched, so opening
+// a large file is (nearly) free.
+class MappedFile {
+private:
+	const char *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+
+public:
+	MappedFile() { }
+	~MappedFile() { close(); }
+
+	// not copyable, but can be moved
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile &&other) noexcept { *this = std::move(other); }
+	MappedFile& operator=(MappedFile &&other) noexcept;
+
+	// maps the file, returns false if it can't be opened (or is empty)
+	bool open(const std::string &filename);
+
+	// unmaps the file
+	void close();
+
+	bool valid() const { return m_data != nullptr; }
+	const char * data() const { return m_data; }
+	size_t size() const { return m_size; }
+};
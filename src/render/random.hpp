@@ -0,0 +1,235 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+
+// Small random number library used by the samplers and integrators.
+//  - PCG32 and Xoroshiro128Plus are fast sequential generators, for
+//    when a stream per thread is enough (both satisfy
+//    UniformRandomBitGenerator, so they work with <random>/<algorithm>)
+//  - Philox4x32 is counter-based, every block of 4 values is a pure
+//    function of (counter, key), so lanes are independent and can be
+//    generated together
+//  - pcgHash and counterUniform are stateless, for keying values on
+//    (seed, pixel, sample, dimension) so renders don't depend on the
+//    number of threads or the order pixels are done in
+
+
+// converts the top 24 bits of an integer to a float in [0, 1)
+inline float toUnitFloat(uint32_t v) {
+	return float(v >> 8) * (1.f / 16777216.f);
+}
+
+inline float toUnitFloat(uint64_t v) {
+	return float(v >> 40) * (1.f / 16777216.f);
+}
+
+
+// PCG-style integer hash (LCG step followed by the RXS-M-XS output permutation)
+inline uint32_t pcgHash(uint32_t v) {
+	uint32_t state = v * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+
+// uniform float in [0, 1) for a pixel, sample index and dimension
+inline float counterUniform(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t dimension) {
+	return toUnitFloat(pcgHash(pcgHash(pcgHash(pcgHash(seed) ^ pixel) ^ sample) ^ dimension));
+}
+
+
+// fills n consecutive dimensions (starting at dimension) of a pixel sample
+inline void counterUniform(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t dimension, float *out, size_t n) {
+	const uint32_t key = pcgHash(pcgHash(pcgHash(seed) ^ pixel) ^ sample);
+	for (size_t i = 0; i < n; i++) {
+		out[i] = toUnitFloat(pcgHash(key ^ uint32_t(dimension + i)));
+	}
+}
+
+
+// splitmix64, used to expand seeds into generator state
+inline uint64_t splitMix64(uint64_t &x) {
+	uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+
+// PCG32 (XSH-RR variant), 64 bits of state and a selectable stream
+class PCG32 {
+private:
+	uint64_t m_state = 0;
+	uint64_t m_inc = 1;
+
+public:
+	using result_type = uint32_t;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return std::numeric_limits<uint32_t>::max(); }
+
+	PCG32(uint64_t seed = 0x853C49E6748FEA9Bull, uint64_t stream = 0xDA3E39CB94B95BDBull) {
+		m_inc = (stream << 1u) | 1u;
+		(*this)();
+		m_state += seed;
+		(*this)();
+	}
+
+	result_type operator()() {
+		uint64_t old = m_state;
+		m_state = old * 6364136223846793005ull + m_inc;
+		uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = uint32_t(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	// uniform float in [0, 1)
+	float nextFloat() { return toUnitFloat((*this)()); }
+
+	void fill(float *out, size_t n) {
+		for (size_t i = 0; i < n; i++) out[i] = nextFloat();
+	}
+};
+
+
+// xoroshiro128+, 128 bits of state, very fast but the lowest bits are
+// weak (only the top bits are used for floats)
+class Xoroshiro128Plus {
+private:
+	uint64_t m_s[2];
+
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+	using result_type = uint64_t;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return std::numeric_limits<uint64_t>::max(); }
+
+	Xoroshiro128Plus(uint64_t seed = 0) {
+		m_s[0] = splitMix64(seed);
+		m_s[1] = splitMix64(seed);
+	}
+
+	result_type operator()() {
+		const uint64_t s0 = m_s[0];
+		uint64_t s1 = m_s[1];
+		const uint64_t result = s0 + s1;
+		s1 ^= s0;
+		m_s[0] = rotl(s0, 24) ^ s1 ^ (s1 << 16);
+		m_s[1] = rotl(s1, 37);
+		return result;
+	}
+
+	// uniform float in [0, 1)
+	float nextFloat() { return toUnitFloat((*this)()); }
+
+	void fill(float *out, size_t n) {
+		for (size_t i = 0; i < n; i++) out[i] = nextFloat();
+	}
+};
+
+
+// Philox4x32-10 counter-based generator (Salmon et al. 2011)
+// Uses only 32x32->64 multiplies, xors and adds, so blocks for
+// consecutive counters can be computed in SIMD lanes at once.
+class Philox4x32 {
+private:
+	uint32_t m_key[2];
+	uint64_t m_counter = 0; // index of the next block
+
+public:
+	Philox4x32(uint64_t seed = 0, uint64_t stream = 0) {
+		m_key[0] = uint32_t(seed);
+		m_key[1] = uint32_t(seed >> 32);
+		m_counter = stream << 32;
+	}
+
+	// the 4 random words for a counter and key
+	static void block(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1, uint32_t out[4]) {
+		for (int round = 0; round < 10; round++) {
+			uint64_t p0 = uint64_t(0xD2511F53u) * c0;
+			uint64_t p1 = uint64_t(0xCD9E8D57u) * c2;
+			uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+			uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+			c1 = uint32_t(p1);
+			c3 = uint32_t(p0);
+			c0 = n0;
+			c2 = n2;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+	}
+
+	// stateless, 4 uniform floats in [0, 1) for a given key and counter
+	static void uniform4(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1, float out[4]) {
+		uint32_t r[4];
+		block(c0, c1, c2, c3, k0, k1, r);
+		for (int i = 0; i < 4; i++) out[i] = toUnitFloat(r[i]);
+	}
+
+	// fills n uniform floats, 4 per block
+	// blocks are independent, so groups of them are computed with the
+	// rounds as the outer loop and the lanes as the (vectorized) inner loop
+	void fill(float *out, size_t n) {
+		const int lanes = 8;
+		const size_t blocks = (n + 3) / 4;
+		const size_t full = n / 4;
+		size_t b = 0;
+
+		for (; b + lanes <= full; b += lanes) {
+			uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+			for (int l = 0; l < lanes; l++) {
+				uint64_t c = m_counter + b + l;
+				c0[l] = uint32_t(c);
+				c1[l] = uint32_t(c >> 32);
+				c2[l] = 0;
+				c3[l] = 0;
+			}
+			uint32_t k0 = m_key[0], k1 = m_key[1];
+			for (int round = 0; round < 10; round++) {
+#pragma omp simd
+				for (int l = 0; l < lanes; l++) {
+					uint64_t p0 = uint64_t(0xD2511F53u) * c0[l];
+					uint64_t p1 = uint64_t(0xCD9E8D57u) * c2[l];
+					uint32_t n0 = uint32_t(p1 >> 32) ^ c1[l] ^ k0;
+					uint32_t n2 = uint32_t(p0 >> 32) ^ c3[l] ^ k1;
+					c1[l] = uint32_t(p1);
+					c3[l] = uint32_t(p0);
+					c0[l] = n0;
+					c2[l] = n2;
+				}
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			float *o = out + 4 * b;
+			for (int l = 0; l < lanes; l++) {
+				o[4 * l + 0] = toUnitFloat(c0[l]);
+				o[4 * l + 1] = toUnitFloat(c1[l]);
+				o[4 * l + 2] = toUnitFloat(c2[l]);
+				o[4 * l + 3] = toUnitFloat(c3[l]);
+			}
+		}
+
+		// remaining blocks one at a time
+		for (; b < blocks; b++) {
+			uint64_t c = m_counter + b;
+			uint32_t r[4];
+			block(uint32_t(c), uint32_t(c >> 32), 0, 0, m_key[0], m_key[1], r);
+			for (size_t i = 4 * b; i < std::min(n, 4 * b + 4); i++) out[i] = toUnitFloat(r[i - 4 * b]);
+		}
+
+		m_counter += blocks;
+	}
+
+	// uniform float in [0, 1) (wastes 3 of the 4 words, prefer fill)
+	float nextFloat() {
+		float f;
+		fill(&f, 1);
+		return f;
+	}
+};
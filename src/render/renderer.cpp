@@ -0,0 +1,105 @@
+
+// std
+#include <cmath>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "renderer.hpp"
+#include "random.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+Scene makeScene(int index) {
+	switch (index) {
+	case 0: return Scene::simpleScene();
+	case 1: return Scene::lightScene();
+	case 2: return Scene::materialScene();
+	case 3: return Scene::shapeScene();
+	case 4: return Scene::cornellBoxScene();
+	default: return Scene();
+	}
+}
+
+
+unique_ptr<PathTracer> makePathTracer(int index, Scene *scene) {
+	switch (index) {
+	case 1: return make_unique<CorePathTracer>(scene);
+	case 2: return make_unique<CompletionPathTracer>(scene);
+	case 3: return make_unique<ChallengePathTracer>(scene);
+	default: return make_unique<SimplePathTracer>(scene);
+	}
+}
+
+
+Renderer::Renderer(Scene scene, int integrator) : m_scene(std::move(scene)) {
+	m_pathtracer = makePathTracer(integrator, &m_scene);
+}
+
+
+void Renderer::renderTile(const Camera &camera, const RenderSettings &settings,
+	int x, int y, int w, int h, int s0, int s1, float *out) {
+
+	Camera view = camera;
+	if (view.imageSize() != vec2(settings.width, settings.height)) view.setImageSize({ settings.width, settings.height });
+
+#pragma omp parallel for schedule(dynamic, 16)
+	for (int i = 0; i < w * h; i++) {
+		const int px = x + i % w, py = y + i / w;
+		const uint32_t idx = uint32_t(px + py * settings.width);
+
+		vec3 sum(0);
+		for (int s = s0; s < s1; s++) {
+			// same jitter as the deterministic mode of the application
+			vec2 rand(counterUniform(settings.seed, idx, s, 0), counterUniform(settings.seed, idx, s, 1));
+			rand = (rand - 0.5f) * (1.f - exp(float(s) * -0.4f)) + 0.5f;
+
+			Ray ray = view.generateRay(vec2(px, py) + rand);
+			sum += m_pathtracer->sampleRay(ray, settings.ray_depth);
+		}
+
+		vec3 mean = sum / float(std::max(s1 - s0, 1));
+		out[3 * i + 0] = mean.r;
+		out[3 * i + 1] = mean.g;
+		out[3 * i + 2] = mean.b;
+	}
+}
+
+
+void Renderer::renderTile(const Camera &camera, const RenderSettings &settings, Film &film,
+	int x, int y, int w, int h, int s0, int s1, FilmTile &tile) {
+
+	Camera view = camera;
+	if (view.imageSize() != vec2(settings.width, settings.height)) view.setImageSize({ settings.width, settings.height });
+
+	film.startTile(x, y, w, h, tile);
+	for (int i = 0; i < w * h; i++) {
+		const int px = x + i % w, py = y + i / w;
+		const uint32_t idx = uint32_t(px + py * settings.width);
+
+		for (int s = s0; s < s1; s++) {
+			// spread over the whole pixel, the filter weighs them by where they land
+			vec2 rand(counterUniform(settings.seed, idx, s, 0), counterUniform(settings.seed, idx, s, 1));
+			Ray ray = view.generateRay(vec2(px, py) + rand);
+			tile.addSample(vec2(px, py) + rand, m_pathtracer->sampleRay(ray, settings.ray_depth));
+		}
+	}
+}
+
+
+void Renderer::render(const Camera &camera, const RenderSettings &settings, Film &film, int tile_size) {
+	const int tile = std::max(tile_size, 1);
+	const int tiles_x = (settings.width + tile - 1) / tile, tiles_y = (settings.height + tile - 1) / tile;
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int t = 0; t < tiles_x * tiles_y; t++) {
+		const int x = (t % tiles_x) * tile, y = (t / tiles_x) * tile;
+		static thread_local FilmTile film_tile;
+		renderTile(camera, settings, film, x, y, std::min(tile, settings.width - x), std::min(tile, settings.height - y), 0, settings.samples, film_tile);
+		film.mergeTile(film_tile);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// std
+#include <memory>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "film.hpp"
+#include "scene/camera.hpp"
+#include "scene/path_tracer.hpp"
+#include "scene/scene.hpp"
+
+
+// builtin scenes and integrators by index (same order as the gui)
+// unknown indices give an empty scene and the simple integrator
+const int builtin_scenes = 5, builtin_integrators = 4;
+Scene makeScene(int index);
+std::unique_ptr<PathTracer> makePathTracer(int index, Scene *scene);
+
+
+struct RenderSettings {
+	int width = 640, height = 480;
+	int samples = 16;
+	int ray_depth = 2;
+	int seed = 0;
+};
+
+
+// Headless renderer, renders parts of a frame to float buffers
+// without a window. Jitter is keyed on (seed, pixel, sample) like
+// the deterministic mode of the application, so any split of the
+// pixels and samples gives the same image.
+class Renderer {
+private:
+	Scene m_scene;
+	std::unique_ptr<PathTracer> m_pathtracer;
+
+public:
+	Renderer(Scene scene, int integrator);
+
+	// the integrator keeps a pointer to the scene
+	Renderer(const Renderer&) = delete;
+	Renderer& operator=(const Renderer&) = delete;
+
+	Scene & scene() { return m_scene; }
+
+	// renders samples [s0, s1) of every pixel in the tile at (x, y) of size (w, h)
+	// and writes their mean color to out (3 floats per pixel, rows of the tile)
+	void renderTile(const Camera &camera, const RenderSettings &settings,
+		int x, int y, int w, int h, int s0, int s1, float *out);
+
+	// renders samples [s0, s1) of every pixel in the tile and splats them
+	// into a tile of the film (on the calling thread only, so tiles can be
+	// rendered by several threads at once)
+	void renderTile(const Camera &camera, const RenderSettings &settings, Film &film,
+		int x, int y, int w, int h, int s0, int s1, FilmTile &tile);
+
+	// renders every sample of the frame into the film, tiles in parallel
+	void render(const Camera &camera, const RenderSettings &settings, Film &film, int tile_size = 32);
+};
@@ -0,0 +1,73 @@
+
+// std
+#include <cstring>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "reprojection.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	const uint64_t no_pixel = ~uint64_t(0);
+
+	// positive floats compare the same way as their bit patterns
+	inline uint64_t pack(float depth, int pixel) {
+		uint32_t bits;
+		memcpy(&bits, &depth, sizeof(bits));
+		return (uint64_t(bits) << 32) | uint32_t(pixel);
+	}
+}
+
+
+void Reprojector::reproject(const Camera &from, const Camera &to, int w, int h, const float *depth) {
+	const int n = w * h;
+	if (m_pixels != n) {
+		m_pixels = n;
+		m_nearest.reset(new atomic<uint64_t>[n]);
+		m_source.resize(n);
+		m_depth.resize(n);
+	}
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) m_nearest[i].store(no_pixel, memory_order_relaxed);
+
+	// scatter the old pixels into the new view
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) {
+		if (depth[i] <= 0) continue; // nothing to reproject for misses
+
+		Ray ray = from.generateRay(vec2(i % w, i / w) + 0.5f);
+		vec3 world = ray.origin + ray.direction * depth[i];
+
+		vec2 p;
+		if (!to.project(world, p)) continue;
+		int x = int(floor(p.x)), y = int(floor(p.y));
+		if (x < 0 || y < 0 || x >= w || y >= h) continue;
+
+		uint64_t packed = pack(distance(to.position(), world), i);
+		atomic<uint64_t> &nearest = m_nearest[x + y * w];
+		uint64_t current = nearest.load(memory_order_relaxed);
+		while (packed < current && !nearest.compare_exchange_weak(current, packed, memory_order_relaxed)) { }
+	}
+
+	// unpack
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) {
+		uint64_t packed = m_nearest[i].load(memory_order_relaxed);
+		if (packed == no_pixel) {
+			m_source[i] = -1;
+			m_depth[i] = 0;
+		} else {
+			uint32_t bits = uint32_t(packed >> 32);
+			memcpy(&m_depth[i], &bits, sizeof(bits));
+			m_source[i] = int(uint32_t(packed));
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// project
+#include "scene/camera.hpp"
+
+
+// Reprojects per-pixel history between two camera views using the
+// depth of each pixel. Every old pixel is moved to its world position
+// and projected into the new view; where several land on the same
+// pixel the nearest one wins. Only the mapping is computed here, the
+// caller gathers whatever per-pixel data it keeps with it.
+class Reprojector {
+private:
+	int m_pixels = 0;
+
+	// packed (depth bits << 32 | source pixel) so the nearest can be found with an atomic min
+	std::unique_ptr<std::atomic<uint64_t>[]> m_nearest;
+
+	std::vector<int> m_source;
+	std::vector<float> m_depth;
+
+public:
+	Reprojector() { }
+
+	// computes the mapping for a w*h image from the view of 'from' to the view of 'to'
+	// depth is the distance from 'from' to the surface of each pixel (0 for misses)
+	void reproject(const Camera &from, const Camera &to, int w, int h, const float *depth);
+
+	// pixel of the old view that landed on this pixel of the new view, or -1 if none
+	int source(int pixel) const { return m_source[pixel]; }
+
+	// distance from the new camera to the reprojected surface
+	float depth(int pixel) const { return m_depth[pixel]; }
+};
@@ -0,0 +1,102 @@
+
+// std
+#include <chrono>
+
+// project
+#include "scene_swap.hpp"
+
+
+using namespace std;
+
+
+void SceneSwap::publish(SceneHandle handle) {
+	lock_guard<mutex> guard(m_lock);
+	m_pending = move(handle);
+	m_ready.store(true, memory_order_release);
+}
+
+
+bool SceneSwap::takePending(SceneHandle &handle) {
+	lock_guard<mutex> guard(m_lock);
+	if (!m_ready) return false;
+	handle = move(m_pending);
+	m_pending = SceneHandle();
+	m_ready = false;
+	return true;
+}
+
+
+void SceneSwap::clear() {
+	SceneHandle dropped;
+	takePending(dropped);
+}
+
+
+SceneLoader::~SceneLoader() {
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_next = nullptr;
+	}
+	if (m_thread.joinable()) m_thread.join();
+}
+
+
+void SceneLoader::load(function<bool(SceneFile &)> build) {
+	lock_guard<mutex> guard(m_lock);
+	m_next = move(build);
+	if (m_running) return;
+
+	// the last thread has finished (or is about to)
+	if (m_thread.joinable()) m_thread.join();
+	m_running = true;
+	m_thread = thread([this]() { run(); });
+}
+
+
+void SceneLoader::run() {
+	for (;;) {
+		function<bool(SceneFile &)> build;
+		{
+			lock_guard<mutex> guard(m_lock);
+			if (!m_next) {
+				m_running = false;
+				return;
+			}
+			build = move(m_next);
+			m_next = nullptr;
+		}
+
+		const auto time_begin = chrono::steady_clock::now();
+		LoadedScene loaded;
+		SceneFile file;
+		if (build(file)) {
+			loaded.scene = make_shared<Scene>(move(file.scene));
+			loaded.has_camera = file.has_camera;
+			loaded.camera_position = file.camera_position;
+			loaded.camera_yaw = file.camera_yaw;
+			loaded.camera_pitch = file.camera_pitch;
+			loaded.from_cache = file.from_cache;
+		}
+		loaded.load_time = float((chrono::steady_clock::now() - time_begin) / 1.0ms);
+
+		lock_guard<mutex> guard(m_lock);
+		m_result = move(loaded);
+		m_ready = true;
+	}
+}
+
+
+bool SceneLoader::poll(LoadedScene &out) {
+	lock_guard<mutex> guard(m_lock);
+	if (!m_ready) return false;
+	out = move(m_result);
+	m_result = LoadedScene();
+	m_ready = false;
+	return true;
+}
+
+
+bool SceneLoader::busy() {
+	lock_guard<mutex> guard(m_lock);
+	return m_running || m_ready;
+}
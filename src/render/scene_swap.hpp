@@ -0,0 +1,101 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "scene/path_tracer.hpp"
+#include "scene/scene.hpp"
+#include "scene/scene_file.hpp"
+
+
+// A scene and the integrator that renders it. Neither is changed while
+// a render thread uses them (edits stop the render first), so a handle
+// can be passed between threads and kept alive by whoever still uses it.
+struct SceneHandle {
+	std::shared_ptr<Scene> scene;
+	std::shared_ptr<PathTracer> pathtracer;
+};
+
+
+// Hands a new scene to a running render thread. The main thread
+// publishes a handle, the render thread takes it between passes (one
+// atomic load when there is nothing to take) and keeps rendering the
+// old scene until then.
+class SceneSwap {
+private:
+	std::mutex m_lock;
+	SceneHandle m_pending;
+	std::atomic<bool> m_ready{false};
+
+public:
+	SceneSwap() { }
+
+	SceneSwap(const SceneSwap&) = delete;
+	SceneSwap& operator=(const SceneSwap&) = delete;
+
+	// replaces any handle that was not taken yet
+	void publish(SceneHandle handle);
+
+	// moves the published handle to handle, returns false if there is none
+	bool take(SceneHandle &handle) {
+		if (!m_ready.load(std::memory_order_acquire)) return false;
+		return takePending(handle);
+	}
+	bool takePending(SceneHandle &handle);
+
+	// drops the published handle (the render is restarted anyway)
+	void clear();
+
+	bool pending() const { return m_ready; }
+};
+
+
+// a scene built by a SceneLoader
+struct LoadedScene {
+	std::shared_ptr<Scene> scene; // null if it couldn't be built
+	bool has_camera = false;
+	glm::vec3 camera_position{ 0 };
+	float camera_yaw = 0, camera_pitch = 0;
+	bool from_cache = false;
+	float load_time = 0; // ms
+};
+
+
+// Builds scenes (parsing, bvh) on a background thread so the gui keeps
+// running. A scene asked for while another is being built is built
+// after it, replacing anything else that was waiting.
+class SceneLoader {
+private:
+	std::thread m_thread;
+	std::mutex m_lock;
+	bool m_running = false;
+	std::function<bool(SceneFile &)> m_next;
+	bool m_ready = false;
+	LoadedScene m_result;
+
+	void run();
+
+public:
+	SceneLoader() { }
+	~SceneLoader();
+
+	SceneLoader(const SceneLoader&) = delete;
+	SceneLoader& operator=(const SceneLoader&) = delete;
+
+	// builds a scene with build (returning false if it failed)
+	void load(std::function<bool(SceneFile &)> build);
+
+	// moves the last scene built to out, returns false if there is none
+	bool poll(LoadedScene &out);
+
+	// a scene is being built, waiting to be, or waiting to be polled
+	bool busy();
+};
@@ -0,0 +1,186 @@
+
+// std
+#include <algorithm>
+#include <utility>
+
+// platform
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+// project
+#include "socket.hpp"
+
+
+using namespace std;
+
+
+namespace {
+
+#ifdef _WIN32
+	using native_socket = SOCKET;
+
+	// winsock needs initializing once per process
+	struct WinsockInit {
+		WinsockInit() { WSADATA data; WSAStartup(MAKEWORD(2, 2), &data); }
+		~WinsockInit() { WSACleanup(); }
+	};
+
+	void init() { static WinsockInit winsock; }
+	void closeNative(native_socket s) { closesocket(s); }
+	bool isValid(native_socket s) { return s != INVALID_SOCKET; }
+#else
+	using native_socket = int;
+
+	void init() { }
+	void closeNative(native_socket s) { ::close(s); }
+	bool isValid(native_socket s) { return s >= 0; }
+#endif
+
+	// don't raise SIGPIPE if the other end went away, send just fails
+#ifdef MSG_NOSIGNAL
+	const int send_flags = MSG_NOSIGNAL;
+#else
+	const int send_flags = 0;
+#endif
+
+	// tiles are sent as single messages, don't wait to batch them
+	void setNoDelay(native_socket s) {
+		int flag = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&flag), sizeof(flag));
+	}
+}
+
+
+Socket& Socket::operator=(Socket &&other) noexcept {
+	if (this != &other) {
+		close();
+		swap(m_handle, other.m_handle);
+	}
+	return *this;
+}
+
+
+Socket Socket::listen(int port, const string &address, int backlog) {
+	init();
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo *result = nullptr;
+	if (getaddrinfo(address.c_str(), to_string(port).c_str(), &hints, &result) != 0) return Socket();
+
+	// bind the first address that works
+	native_socket s = native_socket(-1);
+	for (addrinfo *a = result; a; a = a->ai_next) {
+		s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (!isValid(s)) continue;
+		int reuse = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+		if (::bind(s, a->ai_addr, int(a->ai_addrlen)) == 0 && ::listen(s, backlog) == 0) break;
+		closeNative(s);
+		s = native_socket(-1);
+	}
+	freeaddrinfo(result);
+
+	if (!isValid(s)) return Socket();
+	return Socket(intptr_t(s));
+}
+
+
+Socket Socket::connect(const string &host, int port) {
+	init();
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *result = nullptr;
+	if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0) return Socket();
+
+	// try every address the host resolves to
+	native_socket s = native_socket(-1);
+	for (addrinfo *a = result; a; a = a->ai_next) {
+		s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (!isValid(s)) continue;
+		if (::connect(s, a->ai_addr, int(a->ai_addrlen)) == 0) break;
+		closeNative(s);
+		s = native_socket(-1);
+	}
+	freeaddrinfo(result);
+
+	if (!isValid(s)) return Socket();
+	setNoDelay(s);
+	return Socket(intptr_t(s));
+}
+
+
+Socket Socket::accept() {
+	if (!valid()) return Socket();
+	native_socket s = ::accept(native_socket(m_handle), nullptr, nullptr);
+	if (!isValid(s)) return Socket();
+	setNoDelay(s);
+	return Socket(intptr_t(s));
+}
+
+
+int Socket::port() const {
+	sockaddr_storage addr{};
+	socklen_t len = sizeof(addr);
+	if (!valid() || getsockname(native_socket(m_handle), reinterpret_cast<sockaddr *>(&addr), &len) != 0) return 0;
+	if (addr.ss_family == AF_INET6) return ntohs(reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_port);
+	return ntohs(reinterpret_cast<sockaddr_in *>(&addr)->sin_port);
+}
+
+
+bool Socket::setReceiveTimeout(double seconds) {
+	if (!valid()) return false;
+	seconds = std::max(seconds, 0.0);
+#ifdef _WIN32
+	DWORD timeout = DWORD(seconds * 1000);
+#else
+	timeval timeout{};
+	timeout.tv_sec = time_t(seconds);
+	timeout.tv_usec = suseconds_t((seconds - double(timeout.tv_sec)) * 1e6);
+#endif
+	return setsockopt(native_socket(m_handle), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&timeout), sizeof(timeout)) == 0;
+}
+
+
+bool Socket::sendAll(const void *data, size_t n) {
+	const char *p = static_cast<const char *>(data);
+	while (n > 0) {
+		// 1GB at a time to stay within int on windows
+		int sent = int(send(native_socket(m_handle), p, int(std::min<size_t>(n, 1 << 30)), send_flags));
+		if (sent <= 0) return false;
+		p += sent;
+		n -= size_t(sent);
+	}
+	return true;
+}
+
+
+bool Socket::recvAll(void *data, size_t n) {
+	char *p = static_cast<char *>(data);
+	while (n > 0) {
+		int received = int(recv(native_socket(m_handle), p, int(std::min<size_t>(n, 1 << 30)), 0));
+		if (received <= 0) return false;
+		p += received;
+		n -= size_t(received);
+	}
+	return true;
+}
+
+
+void Socket::close() {
+	if (valid()) closeNative(native_socket(m_handle));
+	m_handle = -1;
+}
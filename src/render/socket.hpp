@@ -0,0 +1,49 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Minimal blocking TCP socket (BSD sockets or winsock)
+class Socket {
+private:
+	intptr_t m_handle = -1;
+
+	explicit Socket(intptr_t handle) : m_handle(handle) { }
+
+public:
+	Socket() { }
+	~Socket() { close(); }
+
+	// not copyable, but can be moved
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+	Socket(Socket &&other) noexcept : m_handle(other.m_handle) { other.m_handle = -1; }
+	Socket& operator=(Socket &&other) noexcept;
+
+	// listens on the given local address ("0.0.0.0" for all interfaces),
+	// port 0 picks a free port
+	static Socket listen(int port, const std::string &address = "127.0.0.1", int backlog = 64);
+
+	// connects to a listening socket
+	static Socket connect(const std::string &host, int port);
+
+	// waits for a connection on a listening socket
+	Socket accept();
+
+	bool valid() const { return m_handle != -1; }
+
+	// the local port (of a listening socket)
+	int port() const;
+
+	// receives fail once nothing has arrived for this long, 0 waits forever
+	bool setReceiveTimeout(double seconds);
+
+	// send/receive exactly n bytes, false if the connection was lost (or timed out)
+	bool sendAll(const void *data, size_t n);
+	bool recvAll(void *data, size_t n);
+
+	void close();
+};
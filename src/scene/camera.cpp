@@ -23,7 +23,7 @@ void Camera::setPositionOrientation(const vec3 &pos, float yaw, float pitch) {
 }
 
 
-Ray Camera::generateRay(const vec2 &pixel) {
+Ray Camera::generateRay(const vec2 &pixel) const {
 	//-------------------------------------------------------------
 	// [Assignment 4] :
 	// Generate a ray in the scene using the camera position,
@@ -36,8 +36,33 @@ Ray Camera::generateRay(const vec2 &pixel) {
 	
 	Ray ray;
     vec3 camSpace((2 * ((pixel.x + 0.5) / m_image_size.x) - 1) * (m_image_size.x / m_image_size.y) * tan(m_fovy/2), (2 * ((pixel.y + 0.5) / m_image_size.y) - 1) * tan(m_fovy/2), -1);
-    vec4 dirVector = vec4(normalize(camSpace - m_position),0) * m_rotation;
+    vec4 dirVector = vec4(normalize(camSpace),0) * m_rotation;
     ray.origin = m_position;
     ray.direction = vec3(dirVector.x, dirVector.y, dirVector.z);
+
+	// differentials, the derivative of the normalized direction per pixel
+	// (the origin doesn't move)
+	float len = length(camSpace);
+	vec3 dir = camSpace / len;
+	vec3 dcdx(2 * (m_image_size.x / m_image_size.y) * tan(m_fovy / 2) / m_image_size.x, 0, 0);
+	vec3 dcdy(0, 2 * tan(m_fovy / 2) / m_image_size.y, 0);
+	ray.has_differentials = true;
+	ray.dddx = vec3(vec4((dcdx - dir * dot(dir, dcdx)) / len, 0) * m_rotation);
+	ray.dddy = vec3(vec4((dcdy - dir * dot(dir, dcdy)) / len, 0) * m_rotation);
 	return ray;
 }
+
+
+bool Camera::project(const vec3 &point, vec2 &pixel) const {
+	// into view space (m_rotation is orthonormal so its transpose is its inverse)
+	vec3 view = vec3(m_rotation * vec4(point - m_position, 0));
+	if (view.z >= 0) return false;
+
+	// onto the image plane at z = -1
+	float t = tan(m_fovy / 2);
+	vec2 ndc(view.x / (-view.z * t * (m_image_size.x / m_image_size.y)), view.y / (-view.z * t));
+
+	// undo the [-1, 1] mapping from generateRay
+	pixel = (ndc + 1.f) * 0.5f * m_image_size - 0.5f;
+	return true;
+}
@@ -29,9 +29,10 @@ public:
 	Camera() { setPositionOrientation(m_position, m_yaw, m_pitch); }
 
 	// typical get methods
-	glm::vec3 position() { return m_position; }
-	float yaw() { return m_yaw; }
-	float pitch() { return m_pitch; }
+	glm::vec3 position() const { return m_position; }
+	float yaw() const { return m_yaw; }
+	float pitch() const { return m_pitch; }
+	glm::vec2 imageSize() const { return m_image_size; }
 
 	// typical set methods
 	void setPositionOrientation(const glm::vec3 &pos, float yaw, float pitch);
@@ -41,5 +42,10 @@ public:
 	}
 
 	// converts a position in screen coordinates into a ray in world coordinates
-	Ray generateRay(const glm::vec2 &pixel);
+	// (with differentials for a step of one pixel)
+	Ray generateRay(const glm::vec2 &pixel) const;
+
+	// inverse of generateRay, converts a point in world coordinates into
+	// screen coordinates, returns false if the point is behind the camera
+	bool project(const glm::vec3 &point, glm::vec2 &pixel) const;
 };
@@ -24,6 +24,11 @@ public:
 	// return ambience (contribution of light bouncing around the scene)
 	// approximates indirect lighting and does not require the light to be visable
 	virtual glm::vec3 ambience() const = 0;
+
+	// get/set the strength of the light, the meaning depends on the light
+	// (only set this while the scene isn't being rendered)
+	virtual glm::vec3 intensity() const = 0;
+	virtual void setIntensity(const glm::vec3 &intensity) = 0;
 };
 
 
@@ -41,6 +46,10 @@ public:
 	virtual glm::vec3 incidentDirection(const glm::vec3 &point) const override;
 	virtual glm::vec3 irradiance(const glm::vec3 & point) const override;
 	virtual glm::vec3 ambience() const override { return m_ambience; }
+
+	// intensity is the irradiance
+	virtual glm::vec3 intensity() const override { return m_irradiance; }
+	virtual void setIntensity(const glm::vec3 &intensity) override { m_irradiance = intensity; }
 };
 
 
@@ -58,4 +67,8 @@ public:
 	virtual glm::vec3 incidentDirection(const glm::vec3 &point) const override;
 	virtual glm::vec3 irradiance(const glm::vec3 &point) const override;
 	virtual glm::vec3 ambience() const override { return m_ambience; }
+
+	// intensity is the flux
+	virtual glm::vec3 intensity() const override { return m_flux; }
+	virtual void setIntensity(const glm::vec3 &intensity) override { m_flux = intensity; }
 };
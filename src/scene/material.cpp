@@ -14,4 +14,31 @@ Material::Material(const glm::vec3 &diffuse_chroma, float shininess, float specu
 	glm::vec3 specular_chroma = glm::sqrt(diffuse_chroma);
 	m_specular = specular_ratio * (metalicity_ratio * specular_chroma + glm::vec3(1.f - metalicity_ratio));
 	m_diffuse = (1 - specular_ratio) * diffuse_chroma;
-}
\ No newline at end of file
+}
+
+MaterialSample Material::evaluateTextured(const RayIntersection &hit) const {
+	// filtered over the hit's footprint (the base level if it has no differentials)
+	const glm::vec2 uv = hit.m_uv_coord * m_texture_scale;
+	const glm::vec3 texel = m_diffuse_texture->sample(uv, hit.m_duvdx * m_texture_scale, hit.m_duvdy * m_texture_scale);
+	return { m_diffuse * texel, m_specular, m_shininess };
+}
+
+
+void Material::evaluate(const RayIntersection *hits, size_t count, MaterialSample *out) {
+	// neighbouring hits are usually on the same material, so a constant
+	// one is only looked at once per run of hits
+	const Material *last = nullptr;
+	MaterialSample last_sample = {};
+	for (size_t i = 0; i < count; i++) {
+		if (!hits[i].m_valid) continue;
+		const Material *m = hits[i].m_material;
+		if (m == last) {
+			out[i] = last_sample;
+		} else if (!m->m_diffuse_texture) {
+			last = m;
+			last_sample = out[i] = { m->m_diffuse, m->m_specular, m->m_shininess };
+		} else {
+			out[i] = m->evaluateTextured(hits[i]);
+		}
+	}
+}
@@ -12,12 +12,25 @@
 #include "texture.hpp"
 
 
+// the parameters of a material at one point on a surface
+struct MaterialSample {
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float shininess;
+};
+
+
 class Material {
 private:
 	glm::vec3 m_diffuse;
 	glm::vec3 m_specular;
 	float m_shininess;
 
+	std::shared_ptr<const Texture> m_diffuse_texture;
+	float m_texture_scale = 1;
+
+	MaterialSample evaluateTextured(const RayIntersection &hit) const;
+
 public:
 	
 	// Typical constructor that takes the diffuse, specular and shininess
@@ -31,11 +44,37 @@ public:
 	Material(const glm::vec3 &diffuse_chroma, float shininess, float specular_ratio, float metalicity_ratio);
 
 	// return the (lambertian) diffuse color of this material
-	virtual glm::vec3 diffuse() const { return m_diffuse; }
+	// (the constant part, textures are applied by evaluate)
+	glm::vec3 diffuse() const { return m_diffuse; }
 	
 	// return the specular reflection color of this material
-	virtual glm::vec3 specular() const { return m_specular; }
+	glm::vec3 specular() const { return m_specular; }
 	
 	// return the shininess of this material
-	virtual float shininess() const { return m_shininess; }
-};
\ No newline at end of file
+	float shininess() const { return m_shininess; }
+
+	// texture multiplying the diffuse color, sampled at the hit's uvs times scale
+	const std::shared_ptr<const Texture> & diffuseTexture() const { return m_diffuse_texture; }
+	float textureScale() const { return m_texture_scale; }
+	bool textured() const { return bool(m_diffuse_texture); }
+
+	// the parameters at a hit (not virtual, so constant materials are
+	// just a copy that the compiler can inline)
+	MaterialSample evaluate(const RayIntersection &hit) const {
+		if (!m_diffuse_texture) return { m_diffuse, m_specular, m_shininess };
+		return evaluateTextured(hit);
+	}
+
+	// evaluates the materials of count hits into out (misses are left as they are)
+	static void evaluate(const RayIntersection *hits, size_t count, MaterialSample *out);
+
+	// typical set methods
+	// (only call these while the scene isn't being rendered)
+	void setDiffuse(const glm::vec3 &diffuse) { m_diffuse = diffuse; }
+	void setSpecular(const glm::vec3 &specular) { m_specular = specular; }
+	void setShininess(float shininess) { m_shininess = shininess; }
+	void setDiffuseTexture(std::shared_ptr<const Texture> texture, float scale = 1) {
+		m_diffuse_texture = std::move(texture);
+		m_texture_scale = scale;
+	}
+};
@@ -0,0 +1,432 @@
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <type_traits>
+
+// project
+#include "mesh.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	const char mesh_magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+	const uint32_t mesh_version = 1;
+	const uint64_t alignment = 4096;
+
+	uint64_t align(uint64_t x) {
+		return (x + alignment - 1) / alignment * alignment;
+	}
+
+	struct MeshHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t vertex_count, triangle_count, node_count;
+		uint64_t position_offset, normal_offset, index_offset, node_offset;
+		uint64_t file_size;
+	};
+
+	static_assert(sizeof(BVHNode) == 32 && is_trivially_copyable<BVHNode>::value, "nodes are written as raw bytes");
+	static_assert(sizeof(vec3) == 12, "vertices are written as raw bytes");
+
+	const uint32_t max_leaf_size = 4;
+	const int max_depth = 60; // the traversal stack holds one node per level
+	const int bin_count = 12;
+	const float traversal_cost = 1; // of visiting a node, relative to testing a triangle
+	const float infinity = numeric_limits<float>::infinity();
+
+
+	struct Bounds {
+		vec3 min{ numeric_limits<float>::max() };
+		vec3 max{ -numeric_limits<float>::max() };
+
+		void grow(const vec3 &p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void grow(const Bounds &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+		float area() const {
+			vec3 d = max - min;
+			return (d.x < 0) ? 0 : 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
+	};
+
+
+	// top down build with a binned surface area heuristic
+	class BVHBuilder {
+	private:
+		vector<Bounds> m_bounds; // of each triangle
+		vector<vec3> m_centroids;
+
+	public:
+		vector<uint32_t> order; // triangles in the order of the leaves
+		vector<BVHNode> nodes;
+
+		BVHBuilder(const vector<vec3> &positions, const vector<uint32_t> &indices) {
+			const size_t n = indices.size() / 3;
+			m_bounds.resize(n);
+			m_centroids.resize(n);
+			order.resize(n);
+			for (size_t i = 0; i < n; i++) {
+				for (int k = 0; k < 3; k++) m_bounds[i].grow(positions[indices[3 * i + k]]);
+				m_centroids[i] = 0.5f * (m_bounds[i].min + m_bounds[i].max);
+				order[i] = uint32_t(i);
+			}
+			if (n > 0) {
+				nodes.reserve(2 * n / max_leaf_size + 1);
+				nodes.emplace_back();
+				build(0, 0, uint32_t(n), 0);
+			}
+		}
+
+	private:
+		void build(uint32_t node, uint32_t begin, uint32_t end, int depth) {
+			Bounds bounds, centroid_bounds;
+			for (uint32_t i = begin; i < end; i++) {
+				bounds.grow(m_bounds[order[i]]);
+				centroid_bounds.grow(m_centroids[order[i]]);
+			}
+			nodes[node].min = bounds.min;
+			nodes[node].max = bounds.max;
+
+			const uint32_t mid = split(begin, end, bounds, centroid_bounds);
+			if (mid == begin || mid == end || depth >= max_depth) {
+				nodes[node].offset = begin;
+				nodes[node].count = end - begin;
+				return;
+			}
+
+			// first child right after this node, then the whole first subtree
+			nodes.emplace_back();
+			build(node + 1, begin, mid, depth + 1);
+			const uint32_t second = uint32_t(nodes.size());
+			nodes.emplace_back();
+			nodes[node].offset = second;
+			nodes[node].count = 0;
+			build(second, mid, end, depth + 1);
+		}
+
+		// partitions the triangles and returns where, or begin to make a leaf
+		uint32_t split(uint32_t begin, uint32_t end, const Bounds &bounds, const Bounds &centroid_bounds) {
+			const uint32_t count = end - begin;
+			if (count <= 1) return begin;
+
+			const vec3 extent = centroid_bounds.max - centroid_bounds.min;
+			const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+			if (extent[axis] <= 0) {
+				// all centroids in one place, so just halve big leaves
+				return (count > max_leaf_size) ? begin + count / 2 : begin;
+			}
+
+			auto bin = [&](uint32_t t) {
+				int b = int(bin_count * (m_centroids[t][axis] - centroid_bounds.min[axis]) / extent[axis]);
+				return std::min(b, bin_count - 1);
+			};
+
+			Bounds bin_bounds[bin_count];
+			uint32_t bin_counts[bin_count] = {};
+			for (uint32_t i = begin; i < end; i++) {
+				int b = bin(order[i]);
+				bin_bounds[b].grow(m_bounds[order[i]]);
+				bin_counts[b]++;
+			}
+
+			// cost of splitting after each bin, sweeping from the right then the left
+			float right_cost[bin_count];
+			Bounds right;
+			uint32_t right_count = 0;
+			for (int b = bin_count - 1; b > 0; b--) {
+				right.grow(bin_bounds[b]);
+				right_count += bin_counts[b];
+				right_cost[b - 1] = right.area() * right_count;
+			}
+			float best_cost = infinity;
+			int best = -1;
+			Bounds left;
+			uint32_t left_count = 0;
+			for (int b = 0; b < bin_count - 1; b++) {
+				left.grow(bin_bounds[b]);
+				left_count += bin_counts[b];
+				float cost = left.area() * left_count + right_cost[b];
+				if (left_count > 0 && left_count < count && cost < best_cost) {
+					best_cost = cost;
+					best = b;
+				}
+			}
+
+			// a leaf is cheaper than visiting both children
+			if (best < 0 || (count <= max_leaf_size && traversal_cost * bounds.area() + best_cost >= bounds.area() * count)) {
+				return (count > max_leaf_size) ? begin + count / 2 : begin;
+			}
+
+			auto it = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t t) { return bin(t) <= best; });
+			return uint32_t(it - order.begin());
+		}
+	};
+}
+
+
+Mesh::Mesh(vector<vec3> positions, vector<vec3> normals, vector<uint32_t> indices)
+	: m_position_data(std::move(positions)), m_normal_data(std::move(normals)), m_index_data(std::move(indices))
+{
+	m_index_data.resize(m_index_data.size() / 3 * 3);
+
+	// smooth normals, weighted by the area of each triangle
+	if (m_normal_data.size() != m_position_data.size()) {
+		m_normal_data.assign(m_position_data.size(), vec3(0));
+		for (size_t i = 0; i < m_index_data.size(); i += 3) {
+			const uint32_t *t = &m_index_data[i];
+			vec3 n = cross(m_position_data[t[1]] - m_position_data[t[0]], m_position_data[t[2]] - m_position_data[t[0]]);
+			for (int k = 0; k < 3; k++) m_normal_data[t[k]] += n;
+		}
+		for (vec3 &n : m_normal_data) {
+			float l = length(n);
+			n = (l > 0) ? n / l : vec3(0, 1, 0);
+		}
+	}
+
+	buildBVH();
+
+	m_positions = m_position_data.data();
+	m_normals = m_normal_data.data();
+	m_indices = m_index_data.data();
+	m_nodes = m_node_data.data();
+	m_vertex_count = uint32_t(m_position_data.size());
+	m_triangle_count = uint32_t(m_index_data.size() / 3);
+	m_node_count = uint32_t(m_node_data.size());
+}
+
+
+Mesh::Mesh(vector<vec3> positions, vector<vec3> normals, vector<uint32_t> indices, vector<BVHNode> nodes)
+	: m_position_data(std::move(positions)), m_normal_data(std::move(normals)), m_index_data(std::move(indices)), m_node_data(std::move(nodes))
+{
+	m_positions = m_position_data.data();
+	m_normals = m_normal_data.data();
+	m_indices = m_index_data.data();
+	m_nodes = m_node_data.data();
+	m_vertex_count = uint32_t(m_position_data.size());
+	m_triangle_count = uint32_t(m_index_data.size() / 3);
+	m_node_count = uint32_t(m_node_data.size());
+}
+
+
+void Mesh::buildBVH() {
+	BVHBuilder builder(m_position_data, m_index_data);
+	m_node_data = std::move(builder.nodes);
+
+	// triangles in leaf order, so each leaf is a contiguous range
+	vector<uint32_t> indices(m_index_data.size());
+	for (size_t i = 0; i < builder.order.size(); i++) {
+		for (int k = 0; k < 3; k++) indices[3 * i + k] = m_index_data[3 * size_t(builder.order[i]) + k];
+	}
+	m_index_data = std::move(indices);
+}
+
+
+RayIntersection Mesh::intersect(const Ray &ray) {
+	return intersect(ray, infinity);
+}
+
+
+RayIntersection Mesh::intersect(const Ray &ray, float max_distance) {
+	RayIntersection intersect;
+	if (m_node_count == 0) return intersect;
+
+	const vec3 inv_direction = 1.f / ray.direction;
+	float closest = max_distance;
+	uint32_t hit = 0;
+	vec2 hit_uv;
+
+	// nodes still to visit and where the ray enters them, nearest on top
+	struct Entry { uint32_t node; float distance; } stack[max_depth + 4];
+	int top = 0;
+	float root = hitNode(m_nodes[0], ray.origin, inv_direction, closest);
+	if (root < infinity) stack[top++] = { 0, root };
+
+	while (top > 0) {
+		const Entry entry = stack[--top];
+		if (entry.distance >= closest) continue;
+		const BVHNode &node = m_nodes[entry.node];
+
+		if (node.count == 0) {
+			Entry first{ entry.node + 1, hitNode(m_nodes[entry.node + 1], ray.origin, inv_direction, closest) };
+			Entry second{ node.offset, hitNode(m_nodes[node.offset], ray.origin, inv_direction, closest) };
+			if (first.distance > second.distance) std::swap(first, second);
+			if (second.distance < infinity) stack[top++] = second;
+			if (first.distance < infinity) stack[top++] = first;
+			continue;
+		}
+
+		// Moller-Trumbore for each triangle in the leaf
+		for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+			const uint32_t *t = m_indices + 3 * size_t(i);
+			const vec3 &p0 = m_positions[t[0]];
+			const vec3 e1 = m_positions[t[1]] - p0, e2 = m_positions[t[2]] - p0;
+			const vec3 pv = cross(ray.direction, e2);
+			const float det = dot(e1, pv);
+			if (det == 0) continue;
+			const float inv_det = 1 / det;
+			const vec3 tv = ray.origin - p0;
+			const float u = dot(tv, pv) * inv_det;
+			if (u < 0 || u > 1) continue;
+			const vec3 qv = cross(tv, e1);
+			const float v = dot(ray.direction, qv) * inv_det;
+			if (v < 0 || u + v > 1) continue;
+			const float d = dot(e2, qv) * inv_det;
+			if (d <= 0 || d >= closest) continue;
+			closest = d;
+			hit = i;
+			hit_uv = vec2(u, v);
+		}
+	}
+
+	if (closest == max_distance) return intersect;
+
+	const uint32_t *t = m_indices + 3 * size_t(hit);
+	intersect.m_valid = true;
+	intersect.m_distance = closest;
+	intersect.m_position = ray.origin + closest * ray.direction;
+	intersect.m_normal = normalize((1 - hit_uv.x - hit_uv.y) * m_normals[t[0]] + hit_uv.x * m_normals[t[1]] + hit_uv.y * m_normals[t[2]]);
+	intersect.m_uv_coord = hit_uv;
+	intersect.m_dpdu = m_positions[t[1]] - m_positions[t[0]];
+	intersect.m_dpdv = m_positions[t[2]] - m_positions[t[0]];
+	intersect.m_shape = this;
+	return intersect;
+}
+
+
+bool Mesh::write(const string &filename) const {
+	MeshHeader h = {};
+	memcpy(h.magic, mesh_magic, sizeof(mesh_magic));
+	h.version = mesh_version;
+	h.vertex_count = m_vertex_count;
+	h.triangle_count = m_triangle_count;
+	h.node_count = m_node_count;
+	h.position_offset = align(sizeof(MeshHeader));
+	h.normal_offset = align(h.position_offset + uint64_t(m_vertex_count) * sizeof(vec3));
+	h.index_offset = align(h.normal_offset + uint64_t(m_vertex_count) * sizeof(vec3));
+	h.node_offset = align(h.index_offset + uint64_t(m_triangle_count) * 3 * sizeof(uint32_t));
+	h.file_size = h.node_offset + uint64_t(m_node_count) * sizeof(BVHNode);
+
+	// write to a temporary and swap it in, so a half written mesh is never used
+	const string temp = filename + ".tmp";
+	{
+		ofstream out(temp, ios::binary | ios::trunc);
+		uint64_t written = 0;
+		auto section = [&](uint64_t offset, const void *data, uint64_t bytes) {
+			// zero padding up to the aligned offset
+			static const char zeros[alignment] = {};
+			out.write(zeros, streamsize(offset - written));
+			out.write(static_cast<const char *>(data), streamsize(bytes));
+			written = offset + bytes;
+		};
+		section(0, &h, sizeof(h));
+		section(h.position_offset, m_positions, uint64_t(m_vertex_count) * sizeof(vec3));
+		section(h.normal_offset, m_normals, uint64_t(m_vertex_count) * sizeof(vec3));
+		section(h.index_offset, m_indices, uint64_t(m_triangle_count) * 3 * sizeof(uint32_t));
+		section(h.node_offset, m_nodes, uint64_t(m_node_count) * sizeof(BVHNode));
+		if (!out) return false;
+	}
+#ifdef _WIN32
+	remove(filename.c_str());
+#endif
+	return rename(temp.c_str(), filename.c_str()) == 0;
+}
+
+
+shared_ptr<Mesh> Mesh::loadOBJ(const string &filename) {
+	ifstream file(filename);
+	if (!file) {
+		cerr << "Error: Could not open mesh " << filename << endl;
+		return nullptr;
+	}
+
+	vector<vec3> positions;
+	vector<uint32_t> indices;
+	vector<uint32_t> face;
+
+	string line;
+	for (int line_number = 1; getline(file, line); line_number++) {
+		istringstream ss(line);
+		string type;
+		if (!(ss >> type)) continue;
+
+		if (type == "v") {
+			vec3 p;
+			if (!(ss >> p.x >> p.y >> p.z)) {
+				cerr << "Error: " << filename << ":" << line_number << " : could not read '" << line << "'" << endl;
+				return nullptr;
+			}
+			positions.push_back(p);
+		} else if (type == "f") {
+			// v, v/vt, v//vn or v/vt/vn, indices from 1 or negative from the end
+			face.clear();
+			string vertex;
+			while (ss >> vertex) {
+				long i = strtol(vertex.c_str(), nullptr, 10);
+				if (i < 0) i += long(positions.size()) + 1;
+				if (i < 1 || i > long(positions.size())) {
+					cerr << "Error: " << filename << ":" << line_number << " : bad vertex index '" << vertex << "'" << endl;
+					return nullptr;
+				}
+				face.push_back(uint32_t(i - 1));
+			}
+			// triangle fan
+			for (size_t k = 2; k < face.size(); k++) {
+				indices.push_back(face[0]);
+				indices.push_back(face[k - 1]);
+				indices.push_back(face[k]);
+			}
+		}
+	}
+
+	return make_shared<Mesh>(std::move(positions), vector<vec3>(), std::move(indices));
+}
+
+
+shared_ptr<Mesh> Mesh::loadBinary(const string &filename) {
+	MappedFile file;
+	if (!file.open(filename) || file.size() < sizeof(MeshHeader)) {
+		cerr << "Error: Could not open mesh " << filename << endl;
+		return nullptr;
+	}
+
+	MeshHeader h;
+	memcpy(&h, file.data(), sizeof(h));
+	if (memcmp(h.magic, mesh_magic, sizeof(mesh_magic)) != 0 || h.version != mesh_version
+		|| h.file_size != file.size()
+		|| h.position_offset + uint64_t(h.vertex_count) * sizeof(vec3) > h.normal_offset
+		|| h.normal_offset + uint64_t(h.vertex_count) * sizeof(vec3) > h.index_offset
+		|| h.index_offset + uint64_t(h.triangle_count) * 3 * sizeof(uint32_t) > h.node_offset
+		|| h.node_offset + uint64_t(h.node_count) * sizeof(BVHNode) > h.file_size
+		|| h.position_offset % alignment != 0 || h.normal_offset % alignment != 0
+		|| h.index_offset % alignment != 0 || h.node_offset % alignment != 0) {
+		cerr << "Error: " << filename << " is not a mesh file (or a different version)" << endl;
+		return nullptr;
+	}
+
+	shared_ptr<Mesh> mesh(new Mesh());
+	mesh->m_positions = reinterpret_cast<const vec3 *>(file.data() + h.position_offset);
+	mesh->m_normals = reinterpret_cast<const vec3 *>(file.data() + h.normal_offset);
+	mesh->m_indices = reinterpret_cast<const uint32_t *>(file.data() + h.index_offset);
+	mesh->m_nodes = reinterpret_cast<const BVHNode *>(file.data() + h.node_offset);
+	mesh->m_vertex_count = h.vertex_count;
+	mesh->m_triangle_count = h.triangle_count;
+	mesh->m_node_count = h.node_count;
+	mesh->m_file = std::move(file); // the mapping (and the views) stay where they are
+	return mesh;
+}
+
+
+shared_ptr<Mesh> Mesh::load(const string &filename) {
+	const string extension = ".mesh";
+	if (filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0) {
+		return loadBinary(filename);
+	}
+	return loadOBJ(filename);
+}
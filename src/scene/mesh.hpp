@@ -0,0 +1,105 @@
+#pragma once
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "shape.hpp"
+#include "render/mapped_file.hpp"
+
+
+// Node of a bounding volume hierarchy. Nodes are stored flat in depth
+// first order, with indices in place of pointers, so the tree can be
+// written to a file and used straight out of a memory mapping.
+struct BVHNode {
+	glm::vec3 min;
+	uint32_t offset; // first triangle of a leaf, or the second child of an inner node (the first is the next node)
+	glm::vec3 max;
+	uint32_t count; // triangles in a leaf, 0 for inner nodes
+};
+
+
+// slab test, returns the distance the ray enters the node's box (0 if it
+// starts inside) or infinity if it misses or enters after max_distance
+inline float hitNode(const BVHNode &node, const glm::vec3 &origin, const glm::vec3 &inv_direction, float max_distance) {
+	glm::vec3 t0 = (node.min - origin) * inv_direction;
+	glm::vec3 t1 = (node.max - origin) * inv_direction;
+	glm::vec3 t_near = glm::min(t0, t1), t_far = glm::max(t0, t1);
+	float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.f));
+	float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+	return (enter <= exit) ? enter : std::numeric_limits<float>::infinity();
+}
+
+
+// Triangle mesh with a BVH over its triangles.
+//
+// Binary mesh files (.mesh) hold the vertex positions, normals, triangle
+// indices and BVH nodes as page aligned arrays. They are memory mapped and
+// used in place without parsing or copying, pages are only read from disk
+// when a ray first touches them, so meshes larger than memory work too.
+// Mesh files are trusted, only their header is checked when they are opened.
+class Mesh : public Shape {
+private:
+	// views of the data, which is either owned by the vectors or mapped
+	const glm::vec3 *m_positions = nullptr;
+	const glm::vec3 *m_normals = nullptr;
+	const uint32_t *m_indices = nullptr; // 3 per triangle
+	const BVHNode *m_nodes = nullptr;
+	uint32_t m_vertex_count = 0, m_triangle_count = 0, m_node_count = 0;
+
+	std::vector<glm::vec3> m_position_data;
+	std::vector<glm::vec3> m_normal_data;
+	std::vector<uint32_t> m_index_data;
+	std::vector<BVHNode> m_node_data;
+	MappedFile m_file;
+
+	Mesh() { }
+	void buildBVH();
+
+public:
+	// builds the BVH, reordering the triangles
+	// smooth normals are computed if none are given
+	Mesh(std::vector<glm::vec3> positions, std::vector<glm::vec3> normals, std::vector<uint32_t> indices);
+
+	// uses a BVH that was already built for these triangles
+	Mesh(std::vector<glm::vec3> positions, std::vector<glm::vec3> normals, std::vector<uint32_t> indices, std::vector<BVHNode> nodes);
+
+	// not copyable (the views would point into the original)
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+
+	virtual RayIntersection intersect(const Ray &ray) override;
+
+	// only hits closer than max_distance
+	RayIntersection intersect(const Ray &ray, float max_distance);
+
+	const glm::vec3 * positions() const { return m_positions; }
+	const glm::vec3 * normals() const { return m_normals; }
+	const uint32_t * indices() const { return m_indices; }
+	const BVHNode * nodes() const { return m_nodes; }
+	uint32_t vertexCount() const { return m_vertex_count; }
+	uint32_t triangleCount() const { return m_triangle_count; }
+	uint32_t nodeCount() const { return m_node_count; }
+
+	// writes a binary mesh file, returns false on failure
+	bool write(const std::string &filename) const;
+
+	// builds a mesh from the vertices and faces of a Wavefront OBJ file
+	// (polygons are split into triangles, normals and uvs are ignored)
+	static std::shared_ptr<Mesh> loadOBJ(const std::string &filename);
+
+	// maps a binary mesh file
+	static std::shared_ptr<Mesh> loadBinary(const std::string &filename);
+
+	// binary if the filename ends with .mesh, OBJ otherwise
+	// returns nullptr if the file can't be read
+	static std::shared_ptr<Mesh> load(const std::string &filename);
+};
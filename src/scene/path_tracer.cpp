@@ -1,10 +1,6 @@
 
 // glm
 #include <glm/gtc/constants.hpp>
-#include <glm/gtc/random.hpp>
-
-// std
-#include <random>
 
 // project
 #include "scene.hpp"
@@ -18,9 +14,25 @@ using namespace std;
 using namespace glm;
 
 
-vec3 SimplePathTracer::sampleRay(const Ray &ray, int) {
-	// intersect ray with the scene
-	RayIntersection intersect = m_scene->intersect(ray);
+vec3 PathTracer::sampleHit(const Ray &ray, const RayIntersection &intersect, int depth, AOVSample &aov) {
+	// record the geometric AOVs of the primary hit
+	aov = AOVSample();
+	if (intersect.m_valid) {
+		aov.depth = intersect.m_distance;
+		aov.normal = normalize(intersect.m_normal);
+		aov.albedo = intersect.m_material->evaluate(intersect).diffuse;
+		aov.material_id = float(intersect.m_material_id);
+		aov.object_id = float(intersect.m_object_id);
+	}
+
+	// the integrator fills in the lighting AOVs
+	return shade(ray, intersect, depth, &aov);
+}
+
+
+
+vec3 SimplePathTracer::shade(const Ray &ray, const RayIntersection &intersect, int, AOVSample *aov) {
+	vec3 colour = { 0.3f, 0.3f, 0.4f }; // background color
 
 	// if ray hit something
 	if (intersect.m_valid) {
@@ -28,16 +40,17 @@ vec3 SimplePathTracer::sampleRay(const Ray &ray, int) {
 		// simple grey shape shading
 		float f = abs(dot(-ray.direction, intersect.m_normal));
 		vec3 grey(0.5, 0.5, 0.5);
-		return mix(grey / 2.0f, grey, f);
+		colour = mix(grey / 2.0f, grey, f);
 	}
 
-	// no intersection - return background color
-	return { 0.3f, 0.3f, 0.4f };
+	// no lights, so it's all direct
+	if (aov) aov->direct = colour;
+	return colour;
 }
 
 
 
-vec3 CorePathTracer::sampleRay(const Ray &ray, int) {
+vec3 CorePathTracer::shade(const Ray &ray, const RayIntersection &intersect, int, AOVSample *aov) {
 	//-------------------------------------------------------------
 	// [Assignment 4] :
 	// Implement a PathTracer that calculates the ambient, diffuse
@@ -47,29 +60,40 @@ vec3 CorePathTracer::sampleRay(const Ray &ray, int) {
 	// not need to use the depth argument for this implementation.
 	//-------------------------------------------------------------
 
-    RayIntersection intersect = m_scene->intersect(ray);
     vec3 colour(0);
-    if (!intersect.m_valid){ return { 0.3f, 0.3f, 0.4f }; } // Return bg on no intersect
+    vec3 direct(0);
+    if (!intersect.m_valid){ // Return bg on no intersect
+        if (aov) aov->direct = { 0.3f, 0.3f, 0.4f };
+        return { 0.3f, 0.3f, 0.4f };
+    }
+    const MaterialSample material = intersect.m_material->evaluate(intersect);
     for (size_t i = 0; i < m_scene->lights().size(); i++) {
         std::shared_ptr<Light> light = m_scene->lights().at(i);
-        vec3 diffuse = intersect.m_material->diffuse() * light->ambience();
+        vec3 diffuse = material.diffuse * light->ambience();
 
         bool isOccluded = light->occluded(m_scene, intersect.m_position);
 
         float angle = glm::max(0.0f, dot(-light->incidentDirection(intersect.m_position), intersect.m_normal));
-        vec3 diffuse_reflect = light->irradiance(intersect.m_position) * intersect.m_material->diffuse() * angle;
+        vec3 diffuse_reflect = light->irradiance(intersect.m_position) * material.diffuse * angle;
 
         vec3 reflect = glm::reflect(normalize(light->incidentDirection(intersect.m_position)), normalize(intersect.m_normal));
 
         angle = glm::max(0.0f, dot(  reflect, -ray.direction));
-        angle = pow(angle, intersect.m_material->shininess());
-        vec3 spec_reflect = light->irradiance(intersect.m_position) * angle * intersect.m_material->specular();
+        angle = pow(angle, material.shininess);
+        vec3 spec_reflect = light->irradiance(intersect.m_position) * angle * material.specular;
 
 
-        colour += diffuse + (isOccluded ? vec3(0):diffuse_reflect + spec_reflect);
+        colour += diffuse;
+        if (!isOccluded){ direct += diffuse_reflect + spec_reflect; }
     }
 
-	return colour;
+    // ambient approximates the indirect lighting
+    if (aov) {
+        aov->direct = direct;
+        aov->indirect = colour;
+    }
+
+	return colour + direct;
 }
 //outer_color = diffuse + specular;
 //if (depth > 1){
@@ -78,7 +102,7 @@ vec3 CorePathTracer::sampleRay(const Ray &ray, int) {
 //}
 
 
-vec3 CompletionPathTracer::sampleRay(const Ray &ray, int depth) {
+vec3 CompletionPathTracer::shade(const Ray &ray, const RayIntersection &intersect, int depth, AOVSample *aov) {
 	//-------------------------------------------------------------
 	// [Assignment 4] :
 	// Using the same requirements for the CorePathTracer add in
@@ -88,38 +112,48 @@ vec3 CompletionPathTracer::sampleRay(const Ray &ray, int depth) {
 	// light your object. To make this more realistic you may weight
 	// the incoming light by the (1 - (1/shininess)).
 	//-------------------------------------------------------------
-    RayIntersection intersect = m_scene->intersect(ray);
     vec3 colour(0);
     vec3 rec_colour(0);
-    if (!intersect.m_valid){ return { 0.3f, 0.3f, 0.4f }; } // Return bg on no intersect
+    vec3 direct(0);
+    if (!intersect.m_valid){ // Return bg on no intersect
+        if (aov) aov->direct = { 0.3f, 0.3f, 0.4f };
+        return { 0.3f, 0.3f, 0.4f };
+    }
+    const MaterialSample material = intersect.m_material->evaluate(intersect);
     for (size_t i = 0; i < m_scene->lights().size(); i++) {
         std::shared_ptr<Light> light = m_scene->lights().at(i);
-        vec3 diffuse = intersect.m_material->diffuse() * light->ambience();
+        vec3 diffuse = material.diffuse * light->ambience();
 
         bool isOccluded = light->occluded(m_scene, intersect.m_position);
 
         float angle = glm::max(0.0f, dot(-light->incidentDirection(intersect.m_position), intersect.m_normal));
-        vec3 diffuse_reflect = light->irradiance(intersect.m_position) * intersect.m_material->diffuse() * angle;
+        vec3 diffuse_reflect = light->irradiance(intersect.m_position) * material.diffuse * angle;
 
         vec3 reflect = glm::reflect(normalize(light->incidentDirection(intersect.m_position)), normalize(intersect.m_normal));
 
         angle = glm::max(0.0f, dot(  reflect, -ray.direction));
-        angle = pow(angle, intersect.m_material->shininess());
-        vec3 spec_reflect = light->irradiance(intersect.m_position) * angle * intersect.m_material->specular();
+        angle = pow(angle, material.shininess);
+        vec3 spec_reflect = light->irradiance(intersect.m_position) * angle * material.specular;
         colour += diffuse;
-        if (!isOccluded){ colour += diffuse_reflect + spec_reflect; }
+        if (!isOccluded){ direct += diffuse_reflect + spec_reflect; }
     }
     if (depth > 1){
-        rec_colour = CompletionPathTracer::sampleRay(Ray(intersect.m_position, normalize(glm::reflect(normalize(ray.direction), normalize(intersect.m_normal)))), depth-1);
-        colour += rec_colour * intersect.m_material->specular() * (1 - (1/ intersect.m_material->shininess()));
+        rec_colour = sampleRay(intersect.reflectedRay(ray), depth-1);
+        colour += rec_colour * material.specular * (1 - (1/ material.shininess));
+    }
+
+    // ambient and reflections are indirect
+    if (aov) {
+        aov->direct = direct;
+        aov->indirect = colour;
     }
 
-    return colour;
+    return colour + direct;
 }
 
 
 
-vec3 ChallengePathTracer::sampleRay(const Ray &ray, int depth) {
+vec3 ChallengePathTracer::shade(const Ray &ray, const RayIntersection &, int depth, AOVSample *) {
 	//-------------------------------------------------------------
 	// [Assignment 4] :
 	// Implement a PathTracer that calculates the diffuse and 
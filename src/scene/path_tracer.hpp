@@ -7,6 +7,7 @@
 // project
 #include "ray.hpp"
 #include "scene.hpp"
+#include "render/aov.hpp"
 
 
 // The base class for the pathtracer (backwards ray tracing) which
@@ -17,7 +18,23 @@ public:
 	Scene *m_scene;
 
 	PathTracer(Scene *s) : m_scene(s) { }
-	virtual glm::vec3 sampleRay(const Ray &ray, int depth) = 0;
+
+	// casts a ray into the scene and returns the color
+	glm::vec3 sampleRay(const Ray &ray, int depth) {
+		return shade(ray, m_scene->intersect(ray), depth, nullptr);
+	}
+
+	// as above, but also writes the AOVs of the first intersection
+	glm::vec3 sampleRay(const Ray &ray, int depth, AOVSample &aov) {
+		return sampleHit(ray, m_scene->intersect(ray), depth, aov);
+	}
+
+	// as above, but for a ray whose intersection is already known (no tracing)
+	glm::vec3 sampleHit(const Ray &ray, const RayIntersection &intersect, int depth, AOVSample &aov);
+
+	// returns the color for a ray given its (possibly invalid) intersection
+	// if aov is not null, the direct and indirect lighting are recorded in it
+	virtual glm::vec3 shade(const Ray &ray, const RayIntersection &intersect, int depth, AOVSample *aov) = 0;
 };
 
 
@@ -25,7 +42,7 @@ public:
 class SimplePathTracer : public PathTracer {
 public : 
 	SimplePathTracer(Scene *s) : PathTracer(s) { }
-	virtual glm::vec3 sampleRay(const Ray &ray, int) override;
+	virtual glm::vec3 shade(const Ray &ray, const RayIntersection &intersect, int, AOVSample *aov) override;
 };
 
 
@@ -36,7 +53,7 @@ public :
 class CorePathTracer : public PathTracer {
 public:
 	CorePathTracer(Scene *s) : PathTracer(s) { }
-	virtual glm::vec3 sampleRay(const Ray &ray, int) override;
+	virtual glm::vec3 shade(const Ray &ray, const RayIntersection &intersect, int, AOVSample *aov) override;
 };
 
 
@@ -45,7 +62,7 @@ public:
 class CompletionPathTracer : public PathTracer {
 public:
 	CompletionPathTracer(Scene *s) : PathTracer(s) { }
-	virtual glm::vec3 sampleRay(const Ray &ray, int depth = 0) override;
+	virtual glm::vec3 shade(const Ray &ray, const RayIntersection &intersect, int depth, AOVSample *aov) override;
 };
 
 
@@ -56,5 +73,5 @@ public:
 class ChallengePathTracer : public PathTracer {
 public:
 	ChallengePathTracer(Scene *s) : PathTracer(s) { }
-	virtual glm::vec3 sampleRay(const Ray &ray, int depth = 0) override;
+	virtual glm::vec3 shade(const Ray &ray, const RayIntersection &intersect, int depth, AOVSample *aov) override;
 };
\ No newline at end of file
@@ -11,6 +11,12 @@ public:
 	glm::vec3 origin;
 	glm::vec3 direction;
 
+	// ray differentials, how the origin and direction change from one pixel
+	// to the next in x and y (for the footprint of the ray on a surface)
+	bool has_differentials = false;
+	glm::vec3 dodx{ 0 }, dddx{ 0 };
+	glm::vec3 dody{ 0 }, dddy{ 0 };
+
 	Ray() { }
 	Ray(const glm::vec3 &o, const glm::vec3 &d) : origin(o), direction(d) { }
 };
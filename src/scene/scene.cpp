@@ -1,6 +1,7 @@
 
 // std
 #include <limits>
+#include <map>
 
 // glm
 #include <glm/gtc/matrix_transform.hpp>
@@ -15,6 +16,61 @@ using namespace std;
 using namespace glm;
 
 
+Scene::Scene(vector<shared_ptr<SceneObject>> objects, vector<shared_ptr<Light>> lights)
+	: m_objects(objects), m_lights(lights)
+{
+	// materials are numbered in order of first use
+	map<Material *, int> material_ids;
+	for (size_t i = 0; i < m_objects.size(); i++) {
+		Material *m = m_objects[i]->material().get();
+		auto it = material_ids.emplace(m, int(material_ids.size()));
+		if (it.second) m_materials.push_back(m_objects[i]->material());
+		m_objects[i]->setIds(int(i), it.first->second);
+	}
+}
+
+
+void RayIntersection::computeDifferentials(const Ray &ray) {
+	if (!ray.has_differentials) return;
+	const vec3 n = normalize(m_normal);
+	const float dn = dot(ray.direction, n);
+	if (dn == 0) return;
+
+	// where the offset rays hit the tangent plane at the intersection
+	auto transfer = [&](const vec3 &dodx, const vec3 &dddx) {
+		vec3 dp = dodx + m_distance * dddx;
+		return dp - (dot(dp, n) / dn) * ray.direction;
+	};
+	m_dpdx = transfer(ray.dodx, ray.dddx);
+	m_dpdy = transfer(ray.dody, ray.dddy);
+
+	// least squares solve of dp = dpdu * du + dpdv * dv
+	const float a = dot(m_dpdu, m_dpdu), b = dot(m_dpdu, m_dpdv), c = dot(m_dpdv, m_dpdv);
+	const float det = a * c - b * b;
+	if (det == 0) return;
+	auto solve = [&](const vec3 &dp) {
+		float pu = dot(dp, m_dpdu), pv = dot(dp, m_dpdv);
+		return vec2(c * pu - b * pv, a * pv - b * pu) / det;
+	};
+	m_duvdx = solve(m_dpdx);
+	m_duvdy = solve(m_dpdy);
+}
+
+
+Ray RayIntersection::reflectedRay(const Ray &ray) const {
+	const vec3 n = normalize(m_normal);
+	Ray reflected(m_position, normalize(glm::reflect(normalize(ray.direction), n)));
+	if (ray.has_differentials) {
+		reflected.has_differentials = true;
+		reflected.dodx = m_dpdx;
+		reflected.dody = m_dpdy;
+		reflected.dddx = glm::reflect(ray.dddx, n);
+		reflected.dddy = glm::reflect(ray.dddy, n);
+	}
+	return reflected;
+}
+
+
 RayIntersection Scene::intersect(const Ray &ray) {
 	RayIntersection closest_intersect;
 	
@@ -26,6 +82,9 @@ RayIntersection Scene::intersect(const Ray &ray) {
 		}
 	}
 
+    if (closest_intersect.m_valid)
+        closest_intersect.computeDifferentials(ray);
+
     // translate a bit to the outside to avoid inside intersections
     if (closest_intersect.m_valid)
         closest_intersect.m_position += closest_intersect.m_normal * .0001f;
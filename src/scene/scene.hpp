@@ -35,9 +35,28 @@ public:
 	glm::vec3 m_normal;
 	glm::vec2 m_uv_coord; // challenge only!
 
+	// how the position changes with the uv coordinates, set by shapes with uvs
+	glm::vec3 m_dpdu{ 0 }, m_dpdv{ 0 };
+
+	// footprint of the ray on the surface, how the position and uv coordinates
+	// change per pixel (zero unless the ray has differentials)
+	glm::vec3 m_dpdx{ 0 }, m_dpdy{ 0 };
+	glm::vec2 m_duvdx{ 0 }, m_duvdy{ 0 };
+
 	// pointers to the original shape and material
 	Shape * m_shape = nullptr;
 	Material * m_material = nullptr;
+
+	// indices of the object and material in the scene
+	int m_object_id = -1;
+	int m_material_id = -1;
+
+	// carries the ray's differentials over to the surface (m_dpdx to m_duvdy)
+	void computeDifferentials(const Ray &ray);
+
+	// the mirror reflection of a ray off this surface, with differentials
+	// (treating the surface as flat around the hit)
+	Ray reflectedRay(const Ray &ray) const;
 };
 
 
@@ -45,13 +64,14 @@ class Scene {
 private:
 	std::vector<std::shared_ptr<SceneObject>> m_objects;
 	std::vector<std::shared_ptr<Light>> m_lights;
+	std::vector<std::shared_ptr<Material>> m_materials; // indexed by material id
 
 public:
 
 	Scene() { }
 
-	Scene(std::vector<std::shared_ptr<SceneObject>> objects, std::vector<std::shared_ptr<Light>> lights)
-		: m_objects(objects), m_lights(lights) { }
+	// also assigns the object and material ids
+	Scene(std::vector<std::shared_ptr<SceneObject>> objects, std::vector<std::shared_ptr<Light>> lights);
 
 	// return an intersetion for a ray in the scene
 	RayIntersection intersect(const Ray &ray);
@@ -62,6 +82,12 @@ public:
 	// returns a vector of the lights in the scene
 	std::vector<std::shared_ptr<Light>> lights() const { return m_lights; }
 
+	// returns a vector of the distinct materials in the scene (indexed by id)
+	std::vector<std::shared_ptr<Material>> materials() const { return m_materials; }
+
+	// returns the object with the given id (without copying the vector)
+	SceneObject * object(int id) const { return m_objects[id].get(); }
+
 
 	// Simple scene with a single sphere, box, and light.
 	// requires Sphere
@@ -0,0 +1,376 @@
+
+// std
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// project
+#include "scene_file.hpp"
+#include "light.hpp"
+#include "material.hpp"
+#include "mesh.hpp"
+#include "scene_object.hpp"
+#include "shape.hpp"
+#include "streamed_mesh.hpp"
+#include "texture_cache.hpp"
+#include "render/mapped_file.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	// everything parsed from a scene file
+	struct SceneRecords {
+		vector<MaterialRecord> materials;
+		vector<ShapeRecord> shapes;
+		vector<LightRecord> lights;
+		vector<FileNameRecord> files;
+		bool has_camera = false;
+		float camera[5] = { 0, 0, 0, 0, 0 }; // position, yaw, pitch
+	};
+
+	const char cache_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+	const uint32_t cache_version = 3;
+	const uint64_t alignment = 4096;
+
+	uint64_t align(uint64_t x) {
+		return (x + alignment - 1) / alignment * alignment;
+	}
+
+	struct CacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t has_camera;
+		uint64_t source_size;
+		int64_t source_time;
+		float camera[5];
+		uint32_t material_count, shape_count, light_count, file_count;
+		uint64_t material_offset, shape_offset, light_offset, file_offset;
+		uint64_t file_size;
+	};
+
+	// size and modification time of the text file, to tell if the cache is stale
+	bool sourceStamp(const string &filename, uint64_t &size, int64_t &time) {
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0) return false;
+		size = uint64_t(st.st_size);
+		time = int64_t(st.st_mtime);
+		return true;
+	}
+
+
+	bool parseText(const string &filename, SceneRecords &out) {
+		ifstream file(filename);
+		if (!file) {
+			cerr << "Error: Could not open scene " << filename << endl;
+			return false;
+		}
+
+		map<string, int> material_ids;
+		map<string, int32_t> file_ids; // so each file is recorded once
+		auto addFile = [&](const string &name) {
+			auto it = file_ids.find(name);
+			if (it != file_ids.end()) return it->second;
+			FileNameRecord record = {};
+			copy(name.begin(), name.end(), record.filename);
+			out.files.push_back(record);
+			return file_ids[name] = int32_t(out.files.size() - 1);
+		};
+		auto vec = [](istream &ss, vec3 &v) { return bool(ss >> v.x >> v.y >> v.z); };
+
+		string line;
+		for (int line_number = 1; getline(file, line); line_number++) {
+			line = line.substr(0, line.find('#'));
+			istringstream ss(line);
+			string type;
+			if (!(ss >> type)) continue;
+
+			bool ok = true;
+			if (type == "material" || type == "material_chroma") {
+				string name;
+				vec3 a, b;
+				float shininess, ratio, metalicity;
+				MaterialRecord m;
+				if (type == "material") {
+					ok = ss >> name && vec(ss, a) && vec(ss, b) && ss >> shininess;
+					m = { a, b, shininess, -1, 1 };
+				} else {
+					ok = ss >> name && vec(ss, a) && ss >> shininess >> ratio >> metalicity;
+					Material chroma(a, shininess, ratio, metalicity);
+					m = { chroma.diffuse(), chroma.specular(), chroma.shininess(), -1, 1 };
+				}
+				if (ok) {
+					material_ids[name] = int(out.materials.size());
+					out.materials.push_back(m);
+				}
+			} else if (type == "texture") {
+				string material, texture;
+				ok = ss >> material >> texture && texture.size() < sizeof(FileNameRecord::filename);
+				auto it = material_ids.find(material);
+				if (ok && it == material_ids.end()) {
+					cerr << "Error: " << filename << ":" << line_number << " : unknown material '" << material << "'" << endl;
+					return false;
+				}
+				if (ok) {
+					MaterialRecord &m = out.materials[it->second];
+					m.texture = addFile(texture);
+					if (!(ss >> m.texture_scale)) m.texture_scale = 1;
+				}
+			} else if (type == "sphere" || type == "box" || type == "plane" || type == "disk" || type == "triangle") {
+				static const map<string, pair<ShapeType, int>> shapes = {
+					{ "sphere", { ShapeType::Sphere, 4 } },
+					{ "box", { ShapeType::Box, 6 } },
+					{ "plane", { ShapeType::Plane, 6 } },
+					{ "disk", { ShapeType::Disk, 7 } },
+					{ "triangle", { ShapeType::Triangle, 9 } }
+				};
+				const auto &shape = shapes.at(type);
+				string material;
+				ShapeRecord s = {};
+				s.type = shape.first;
+				ok = bool(ss >> material);
+				for (int i = 0; ok && i < shape.second; i++) ok = bool(ss >> s.params[i]);
+				auto it = material_ids.find(material);
+				if (ok && it == material_ids.end()) {
+					cerr << "Error: " << filename << ":" << line_number << " : unknown material '" << material << "'" << endl;
+					return false;
+				}
+				if (ok) {
+					s.material = it->second;
+					out.shapes.push_back(s);
+				}
+			} else if (type == "mesh") {
+				string material, mesh;
+				ShapeRecord s = {};
+				s.type = ShapeType::Mesh;
+				ok = ss >> material >> mesh && mesh.size() < sizeof(FileNameRecord::filename);
+				auto it = material_ids.find(material);
+				if (ok && it == material_ids.end()) {
+					cerr << "Error: " << filename << ":" << line_number << " : unknown material '" << material << "'" << endl;
+					return false;
+				}
+				if (ok) {
+					s.material = it->second;
+					s.mesh = addFile(mesh);
+					out.shapes.push_back(s);
+				}
+			} else if (type == "directional_light" || type == "point_light") {
+				LightRecord l;
+				l.type = (type == "point_light") ? LightType::Point : LightType::Directional;
+				ok = vec(ss, l.vector) && vec(ss, l.intensity) && vec(ss, l.ambience);
+				if (ok) out.lights.push_back(l);
+			} else if (type == "camera") {
+				ok = bool(ss >> out.camera[0] >> out.camera[1] >> out.camera[2] >> out.camera[3] >> out.camera[4]);
+				out.has_camera = ok;
+			} else {
+				ok = false;
+			}
+
+			if (!ok) {
+				cerr << "Error: " << filename << ":" << line_number << " : could not read '" << line << "'" << endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+
+	bool writeCache(const string &filename, const SceneRecords &records, uint64_t source_size, int64_t source_time) {
+		CacheHeader h = {};
+		memcpy(h.magic, cache_magic, sizeof(cache_magic));
+		h.version = cache_version;
+		h.has_camera = records.has_camera;
+		h.source_size = source_size;
+		h.source_time = source_time;
+		copy(begin(records.camera), end(records.camera), h.camera);
+		h.material_count = uint32_t(records.materials.size());
+		h.shape_count = uint32_t(records.shapes.size());
+		h.light_count = uint32_t(records.lights.size());
+		h.file_count = uint32_t(records.files.size());
+		h.material_offset = align(sizeof(CacheHeader));
+		h.shape_offset = align(h.material_offset + h.material_count * sizeof(MaterialRecord));
+		h.light_offset = align(h.shape_offset + h.shape_count * sizeof(ShapeRecord));
+		h.file_offset = align(h.light_offset + h.light_count * sizeof(LightRecord));
+		h.file_size = h.file_offset + h.file_count * sizeof(FileNameRecord);
+
+		// write to a temporary and swap it in, so a half written cache is never used
+		const string temp = filename + ".tmp";
+		{
+			ofstream out(temp, ios::binary | ios::trunc);
+			uint64_t written = 0;
+			auto section = [&](uint64_t offset, const void *data, size_t bytes) {
+				// zero padding up to the aligned offset
+				static const char zeros[alignment] = {};
+				out.write(zeros, streamsize(offset - written));
+				out.write(static_cast<const char *>(data), streamsize(bytes));
+				written = offset + bytes;
+			};
+			section(0, &h, sizeof(h));
+			section(h.material_offset, records.materials.data(), records.materials.size() * sizeof(MaterialRecord));
+			section(h.shape_offset, records.shapes.data(), records.shapes.size() * sizeof(ShapeRecord));
+			section(h.light_offset, records.lights.data(), records.lights.size() * sizeof(LightRecord));
+			section(h.file_offset, records.files.data(), records.files.size() * sizeof(FileNameRecord));
+			if (!out) return false;
+		}
+#ifdef _WIN32
+		remove(filename.c_str());
+#endif
+		return rename(temp.c_str(), filename.c_str()) == 0;
+	}
+
+
+	// builds the scene objects straight from the records
+	// mesh and texture files are relative to the directory of the scene file
+	bool buildScene(const MaterialRecord *materials, size_t material_count,
+		const ShapeRecord *shapes, size_t shape_count,
+		const LightRecord *lights, size_t light_count,
+		const FileNameRecord *files, const string &directory, Scene &out) {
+
+		// textures are decoded in parallel (and shared with anything else using them)
+		TextureCache &textures = TextureCache::global();
+		vector<string> texture_filenames;
+		for (size_t i = 0; i < material_count; i++) {
+			if (materials[i].texture >= 0) texture_filenames.push_back(directory + files[materials[i].texture].filename);
+		}
+		textures.preload(texture_filenames);
+
+		vector<shared_ptr<Material>> scene_materials(material_count);
+		for (size_t i = 0; i < material_count; i++) {
+			scene_materials[i] = make_shared<Material>(materials[i].diffuse, materials[i].specular, materials[i].shininess);
+			if (materials[i].texture < 0) continue;
+			shared_ptr<const Texture> texture = textures.get(directory + files[materials[i].texture].filename);
+			if (!texture) return false;
+			scene_materials[i]->setDiffuseTexture(texture, materials[i].texture_scale);
+		}
+
+		vector<shared_ptr<SceneObject>> objects;
+		objects.reserve(shape_count);
+		map<string, shared_ptr<Shape>> loaded_meshes; // so a mesh used twice is only loaded once
+		for (size_t i = 0; i < shape_count; i++) {
+			const float *p = shapes[i].params;
+			shared_ptr<Shape> shape;
+			switch (shapes[i].type) {
+			case ShapeType::Sphere: shape = make_shared<Sphere>(vec3(p[0], p[1], p[2]), p[3]); break;
+			case ShapeType::Box: shape = make_shared<AABB>(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5])); break;
+			case ShapeType::Plane: shape = make_shared<Plane>(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5])); break;
+			case ShapeType::Disk: shape = make_shared<Disk>(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]), p[6]); break;
+			case ShapeType::Triangle: shape = make_shared<Triangle>(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]), vec3(p[6], p[7], p[8])); break;
+			case ShapeType::Mesh: {
+				const string mesh_filename = directory + files[shapes[i].mesh].filename;
+				shared_ptr<Shape> &mesh = loaded_meshes[mesh_filename];
+				if (!mesh) {
+					const string bricks = ".bricks";
+					bool streamed = mesh_filename.size() >= bricks.size()
+						&& mesh_filename.compare(mesh_filename.size() - bricks.size(), bricks.size(), bricks) == 0;
+					if (streamed) mesh = StreamedMesh::open(mesh_filename);
+					else mesh = Mesh::load(mesh_filename);
+				}
+				if (!mesh) return false;
+				shape = mesh;
+				break;
+			}
+			default: continue;
+			}
+			objects.push_back(make_shared<SceneObject>(shape, scene_materials[shapes[i].material]));
+		}
+
+		vector<shared_ptr<Light>> scene_lights;
+		for (size_t i = 0; i < light_count; i++) {
+			const LightRecord &l = lights[i];
+			if (l.type == LightType::Point) scene_lights.push_back(make_shared<PointLight>(l.vector, l.intensity, l.ambience));
+			else scene_lights.push_back(make_shared<DirectionalLight>(l.vector, l.intensity, l.ambience));
+		}
+
+		out = Scene(objects, scene_lights);
+		return true;
+	}
+
+
+	// loads the scene from a valid, up to date cache
+	bool loadCache(const string &filename, const string &directory, uint64_t source_size, int64_t source_time, SceneFile &out) {
+		MappedFile file;
+		if (!file.open(filename) || file.size() < sizeof(CacheHeader)) return false;
+
+		CacheHeader h;
+		memcpy(&h, file.data(), sizeof(h));
+		if (memcmp(h.magic, cache_magic, sizeof(cache_magic)) != 0 || h.version != cache_version
+			|| h.source_size != source_size || h.source_time != source_time
+			|| h.file_size != file.size()
+			|| h.material_offset + h.material_count * sizeof(MaterialRecord) > h.shape_offset
+			|| h.shape_offset + h.shape_count * sizeof(ShapeRecord) > h.light_offset
+			|| h.light_offset + h.light_count * sizeof(LightRecord) > h.file_offset
+			|| h.file_offset + h.file_count * sizeof(FileNameRecord) > h.file_size) {
+			return false;
+		}
+
+		// material and file ids must be in range before anything is built
+		const auto *materials = reinterpret_cast<const MaterialRecord *>(file.data() + h.material_offset);
+		const auto *shapes = reinterpret_cast<const ShapeRecord *>(file.data() + h.shape_offset);
+		const auto *files = reinterpret_cast<const FileNameRecord *>(file.data() + h.file_offset);
+		auto validFile = [&](int32_t id) {
+			return id >= 0 && uint32_t(id) < h.file_count && files[id].filename[sizeof(FileNameRecord::filename) - 1] == 0;
+		};
+		for (uint32_t i = 0; i < h.material_count; i++) {
+			if (materials[i].texture != -1 && !validFile(materials[i].texture)) return false;
+		}
+		for (uint32_t i = 0; i < h.shape_count; i++) {
+			if (shapes[i].material < 0 || uint32_t(shapes[i].material) >= h.material_count) return false;
+			if (shapes[i].type == ShapeType::Mesh && !validFile(shapes[i].mesh)) return false;
+		}
+
+		if (!buildScene(
+			materials, h.material_count,
+			shapes, h.shape_count,
+			reinterpret_cast<const LightRecord *>(file.data() + h.light_offset), h.light_count,
+			files, directory, out.scene
+		)) return false;
+		out.has_camera = h.has_camera != 0;
+		out.camera_position = vec3(h.camera[0], h.camera[1], h.camera[2]);
+		out.camera_yaw = h.camera[3];
+		out.camera_pitch = h.camera[4];
+		out.from_cache = true;
+		return true;
+	}
+}
+
+
+bool loadSceneFile(const string &filename, SceneFile &out, bool use_cache) {
+	const string cache_filename = filename + ".cache";
+	uint64_t source_size = 0;
+	int64_t source_time = 0;
+	if (!sourceStamp(filename, source_size, source_time)) {
+		cerr << "Error: Could not open scene " << filename << endl;
+		return false;
+	}
+
+	const size_t slash = filename.find_last_of("/\\");
+	const string directory = (slash == string::npos) ? "" : filename.substr(0, slash + 1);
+
+	if (use_cache && loadCache(cache_filename, directory, source_size, source_time, out)) return true;
+
+	SceneRecords records;
+	if (!parseText(filename, records)) return false;
+
+	if (!buildScene(records.materials.data(), records.materials.size(),
+		records.shapes.data(), records.shapes.size(),
+		records.lights.data(), records.lights.size(),
+		records.files.data(), directory, out.scene)) return false;
+	out.has_camera = records.has_camera;
+	out.camera_position = vec3(records.camera[0], records.camera[1], records.camera[2]);
+	out.camera_yaw = records.camera[3];
+	out.camera_pitch = records.camera[4];
+	out.from_cache = false;
+
+	if (use_cache && !writeCache(cache_filename, records, source_size, source_time)) {
+		cerr << "Warning: Could not write scene cache " << cache_filename << endl;
+	}
+	return true;
+}
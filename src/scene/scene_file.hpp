@@ -0,0 +1,81 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "scene.hpp"
+
+
+// Text scene files, one item per line ('#' starts a comment).
+// Materials are named, and shapes refer to them by name.
+//
+//   material <name> <diffuse r g b> <specular r g b> <shininess>
+//   material_chroma <name> <chroma r g b> <shininess> <specular ratio> <metalicity>
+//   texture <material> <filename> [<uv scale>] (multiplies the diffuse, relative to the scene file)
+//   sphere <material> <center x y z> <radius>
+//   box <material> <center x y z> <half size x y z>
+//   plane <material> <point x y z> <normal x y z>
+//   disk <material> <center x y z> <normal x y z> <radius>
+//   triangle <material> <x y z> <x y z> <x y z>
+//   mesh <material> <filename> (.obj, .mesh or .bricks, relative to the scene file)
+//   directional_light <direction x y z> <irradiance r g b> <ambience r g b>
+//   point_light <position x y z> <flux r g b> <ambience r g b>
+//   camera <position x y z> <yaw> <pitch>
+//
+// The parsed scene is cached in a binary file next to it (<filename>.cache)
+// holding flat arrays of the records below, page aligned so they are used
+// straight out of a memory mapping. The cache is rebuilt whenever the
+// text file's size or modification time changes.
+
+
+// flat records of a parsed scene (the same in memory and in the cache)
+struct MaterialRecord {
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float shininess;
+	int32_t texture; // index of the diffuse texture's filename, -1 for none
+	float texture_scale;
+};
+
+enum class ShapeType : uint32_t { Sphere, Box, Plane, Disk, Triangle, Mesh };
+
+struct ShapeRecord {
+	ShapeType type;
+	int32_t material;
+	float params[9]; // in the order of the text format
+	int32_t mesh; // index of the mesh's filename
+};
+
+// filenames of meshes and textures
+struct FileNameRecord {
+	char filename[256];
+};
+
+enum class LightType : uint32_t { Directional, Point };
+
+struct LightRecord {
+	LightType type;
+	glm::vec3 vector; // direction or position
+	glm::vec3 intensity;
+	glm::vec3 ambience;
+};
+
+
+struct SceneFile {
+	Scene scene;
+	bool has_camera = false;
+	glm::vec3 camera_position{ 0 };
+	float camera_yaw = 0, camera_pitch = 0;
+	bool from_cache = false;
+};
+
+
+// loads a scene file, through its cache if it is up to date (and
+// rewriting the cache otherwise), returns false if it can't be read
+bool loadSceneFile(const std::string &filename, SceneFile &out, bool use_cache = true);
@@ -25,5 +25,7 @@ SceneObject::SceneObject(std::shared_ptr<Shape> shape, std::shared_ptr<Material>
 RayIntersection SceneObject::intersect(const Ray &ray) {
 	RayIntersection intersect = m_shape->intersect(ray);
 	intersect.m_material = m_material.get();
+	intersect.m_object_id = m_object_id;
+	intersect.m_material_id = m_material_id;
 	return intersect;
 }
\ No newline at end of file
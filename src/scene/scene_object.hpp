@@ -18,8 +18,21 @@ class SceneObject {
 private:
 	std::shared_ptr<Shape> m_shape;
 	std::shared_ptr<Material> m_material;
+	int m_object_id = -1;
+	int m_material_id = -1;
 
 public:
 	SceneObject(std::shared_ptr<Shape> shape, std::shared_ptr<Material> material);
 	RayIntersection intersect(const Ray &ray);
+
+	const std::shared_ptr<Shape> & shape() const { return m_shape; }
+	const std::shared_ptr<Material> & material() const { return m_material; }
+	int objectId() const { return m_object_id; }
+	int materialId() const { return m_material_id; }
+
+	// set by the scene, reported with every intersection
+	void setIds(int object_id, int material_id) {
+		m_object_id = object_id;
+		m_material_id = material_id;
+	}
 };
\ No newline at end of file
@@ -56,6 +56,8 @@ RayIntersection AABB::intersect(const Ray &ray) {
 	intersect.m_uv_coord = (abs(intersect.m_normal.x) > 0) ?
 		vec2(intersect.m_position.y, intersect.m_position.z) :
 		vec2(intersect.m_position.x, intersect.m_position.y + intersect.m_position.z);
+	intersect.m_dpdu = (abs(intersect.m_normal.x) > 0) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+	intersect.m_dpdv = (abs(intersect.m_normal.x) > 0 || abs(intersect.m_normal.y) > 0) ? vec3(0, 0, 1) : vec3(0, 1, 0);
 	intersect.m_shape = this;
 
 	return intersect;
@@ -89,6 +91,14 @@ RayIntersection Sphere::intersect(const Ray &ray) {
         intersect.m_position = ray.origin + t0*ray.direction;
         intersect.m_normal = intersect.m_position - m_center;
         intersect.m_shape = this;
+
+        // longitude and latitude, v goes from the bottom pole to the top
+        vec3 d = intersect.m_normal / m_radius;
+        float phi = atan(d.z, d.x);
+        float theta = acos(clamp(d.y, -1.f, 1.f));
+        intersect.m_uv_coord = vec2(phi / two_pi<float>(), 1 - theta / pi<float>());
+        intersect.m_dpdu = two_pi<float>() * vec3(-intersect.m_normal.z, 0, intersect.m_normal.x);
+        intersect.m_dpdv = pi<float>() * m_radius * vec3(-d.y * cos(phi), sin(theta), -d.y * sin(phi));
     }
     return intersect;
 }
@@ -104,8 +114,17 @@ RayIntersection Plane::intersect(const Ray &ray) {
             intersect.m_valid = true;
             intersect.m_distance = t;
             intersect.m_position = ray.origin + intersect.m_distance * ray.direction;
-            intersect.m_normal = dot(ray.direction, m_normal) > 0 ? -m_normal : m_normal;
+            vec3 n = normalize(m_normal);
+            intersect.m_normal = dot(ray.direction, n) > 0 ? -n : n;
             intersect.m_shape = this;
+
+            // world units along a frame in the plane, from its point
+            vec3 t = normalize(cross(abs(n.y) < 0.99f ? vec3(0, 1, 0) : vec3(1, 0, 0), n));
+            vec3 b = cross(n, t);
+            vec3 rel = intersect.m_position - m_point;
+            intersect.m_uv_coord = vec2(dot(rel, t), dot(rel, b));
+            intersect.m_dpdu = t;
+            intersect.m_dpdv = b;
         }
     }
     return intersect;
@@ -121,8 +140,8 @@ RayIntersection Disk::intersect(const Ray &ray) {
         if (sqrt(d2) > m_radius){
             intersection.m_valid = false;
         }
+        intersection.m_shape = this; // not the temporary plane
     }
-    intersection.m_normal *= -1;
     return intersection;
 }
 
@@ -162,5 +181,34 @@ RayIntersection Triangle::intersect(const Ray &ray) {
     intersect.m_normal = glm::normalize(glm::cross(v0v1, v0v2));
     intersect.m_shape = this;
 
+    // barycentric, p = corner1 + u * (corner2 - corner1) + v * (corner3 - corner1)
+    float area2_squared = dot(N, N);
+    intersect.m_uv_coord = vec2(dot(N, cross(vp0, v0v2)), dot(N, cross(v0v1, vp0))) / area2_squared;
+    intersect.m_dpdu = v0v1;
+    intersect.m_dpdv = v0v2;
+
     return intersect;
-}
\ No newline at end of file
+}
+
+
+TransformedShape::TransformedShape(std::shared_ptr<Shape> shape, const mat4 &transform)
+	: m_shape(shape), m_transform(transform), m_inverse(inverse(transform)),
+	m_normal_matrix(transpose(inverse(mat3(transform)))) { }
+
+
+RayIntersection TransformedShape::intersect(const Ray &ray) {
+	// intersect in object space with a unit length direction
+	vec3 origin = vec3(m_inverse * vec4(ray.origin, 1));
+	vec3 direction = normalize(vec3(m_inverse * vec4(ray.direction, 0)));
+	RayIntersection intersect = m_shape->intersect(Ray(origin, direction));
+	if (!intersect.m_valid) return intersect;
+
+	// and move the hit back out to world space
+	intersect.m_position = vec3(m_transform * vec4(intersect.m_position, 1));
+	intersect.m_normal = normalize(m_normal_matrix * intersect.m_normal);
+	intersect.m_dpdu = mat3(m_transform) * intersect.m_dpdu;
+	intersect.m_dpdv = mat3(m_transform) * intersect.m_dpdv;
+	intersect.m_distance = length(intersect.m_position - ray.origin) / length(ray.direction);
+	intersect.m_shape = this;
+	return intersect;
+}
@@ -1,6 +1,9 @@
 
 #pragma once
 
+// std
+#include <memory>
+
 // glm
 #include <glm/glm.hpp>
 
@@ -80,3 +83,17 @@ public:
     virtual RayIntersection intersect(const Ray &ray) override;
 };
 
+
+// Another shape placed with an affine transform (object to world),
+// so it can be moved without changing (or copying) the original
+class TransformedShape : public Shape {
+private:
+	std::shared_ptr<Shape> m_shape;
+	glm::mat4 m_transform;
+	glm::mat4 m_inverse;
+	glm::mat3 m_normal_matrix;
+
+public:
+	TransformedShape(std::shared_ptr<Shape> shape, const glm::mat4 &transform);
+	virtual RayIntersection intersect(const Ray &ray) override;
+};
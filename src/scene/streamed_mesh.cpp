@@ -0,0 +1,381 @@
+
+// std
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+
+// project
+#include "streamed_mesh.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	const char brick_magic[8] = { 'R', 'T', 'B', 'R', 'I', 'C', 'K', 0 };
+	const uint32_t brick_version = 1;
+	const uint64_t alignment = 4096;
+	const float infinity = numeric_limits<float>::infinity();
+
+	uint64_t align(uint64_t x) {
+		return (x + alignment - 1) / alignment * alignment;
+	}
+
+	// the file starts with this header (in its own page), then the bricks,
+	// each page aligned, then the resident nodes and the brick table
+	struct StreamHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t node_count, brick_count;
+		uint32_t padding;
+		uint64_t node_offset, brick_offset;
+		uint64_t file_size;
+	};
+
+	// calls visit(brick, distance) for the bricks along a ray, nearest first
+	// visit returns the closest hit so far, further bricks are skipped
+	template <typename Visit>
+	void traverse(const vector<BVHNode> &nodes, const Ray &ray, float closest, Visit visit) {
+		if (nodes.empty()) return;
+		const vec3 inv_direction = 1.f / ray.direction;
+
+		struct Entry { uint32_t node; float distance; } stack[64];
+		int top = 0;
+		float root = hitNode(nodes[0], ray.origin, inv_direction, closest);
+		if (root < infinity) stack[top++] = { 0, root };
+
+		while (top > 0) {
+			const Entry entry = stack[--top];
+			if (entry.distance >= closest) continue;
+			const BVHNode &node = nodes[entry.node];
+
+			if (node.count > 0) {
+				closest = visit(node.offset, entry.distance);
+				continue;
+			}
+
+			Entry first{ entry.node + 1, hitNode(nodes[entry.node + 1], ray.origin, inv_direction, closest) };
+			Entry second{ node.offset, hitNode(nodes[node.offset], ray.origin, inv_direction, closest) };
+			if (first.distance > second.distance) std::swap(first, second);
+			if (second.distance < infinity) stack[top++] = second;
+			if (first.distance < infinity) stack[top++] = first;
+		}
+	}
+}
+
+
+shared_ptr<Mesh> BrickCache::find(uint32_t id) {
+	lock_guard<mutex> guard(m_lock);
+	m_stats.lookups++;
+	auto it = m_entries.find(id);
+	if (it == m_entries.end()) return nullptr;
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+	return it->second.brick;
+}
+
+
+void BrickCache::insert(uint32_t id, shared_ptr<Mesh> brick, size_t bytes) {
+	lock_guard<mutex> guard(m_lock);
+	m_stats.loads++;
+	m_stats.bytes_loaded += bytes;
+
+	// another thread may have loaded it at the same time
+	if (m_entries.count(id)) return;
+
+	m_lru.push_front(id);
+	m_entries[id] = { std::move(brick), bytes, m_lru.begin() };
+	m_resident += bytes;
+
+	while (m_resident > m_budget && !m_lru.empty()) {
+		auto it = m_entries.find(m_lru.back());
+		m_resident -= it->second.bytes;
+		m_entries.erase(it);
+		m_lru.pop_back();
+		m_stats.evictions++;
+	}
+}
+
+
+bool BrickCache::resident(uint32_t id) {
+	lock_guard<mutex> guard(m_lock);
+	return m_entries.count(id) > 0;
+}
+
+
+size_t BrickCache::residentBytes() {
+	lock_guard<mutex> guard(m_lock);
+	return m_resident;
+}
+
+
+BrickCache::Stats BrickCache::stats() {
+	lock_guard<mutex> guard(m_lock);
+	return m_stats;
+}
+
+
+size_t StreamedMesh::brickBytes(const BrickRecord &brick) {
+	return size_t(brick.vertex_count) * 2 * sizeof(vec3) + size_t(brick.triangle_count) * 3 * sizeof(uint32_t)
+		+ size_t(brick.node_count) * sizeof(BVHNode);
+}
+
+
+size_t StreamedMesh::totalBytes() const {
+	size_t bytes = 0;
+	for (const BrickRecord &b : m_bricks) bytes += brickBytes(b);
+	return bytes;
+}
+
+
+shared_ptr<Mesh> StreamedMesh::loadBrick(uint32_t id) {
+	const BrickRecord &b = m_bricks[id];
+	vector<vec3> positions(b.vertex_count), normals(b.vertex_count);
+	vector<uint32_t> indices(size_t(b.triangle_count) * 3);
+	vector<BVHNode> nodes(b.node_count);
+	{
+		lock_guard<mutex> guard(m_file_lock);
+		m_file.clear();
+		m_file.seekg(streamoff(b.offset));
+		m_file.read(reinterpret_cast<char *>(positions.data()), streamsize(positions.size() * sizeof(vec3)));
+		m_file.read(reinterpret_cast<char *>(normals.data()), streamsize(normals.size() * sizeof(vec3)));
+		m_file.read(reinterpret_cast<char *>(indices.data()), streamsize(indices.size() * sizeof(uint32_t)));
+		m_file.read(reinterpret_cast<char *>(nodes.data()), streamsize(nodes.size() * sizeof(BVHNode)));
+		if (!m_file) {
+			cerr << "Error: Could not read brick " << id << endl;
+			return nullptr;
+		}
+	}
+	return make_shared<Mesh>(std::move(positions), std::move(normals), std::move(indices), std::move(nodes));
+}
+
+
+shared_ptr<Mesh> StreamedMesh::brick(uint32_t id) {
+	shared_ptr<Mesh> b = m_cache.find(id);
+	if (!b) {
+		b = loadBrick(id);
+		if (b) m_cache.insert(id, b, brickBytes(m_bricks[id]));
+	}
+	return b;
+}
+
+
+RayIntersection StreamedMesh::intersect(const Ray &ray) {
+	RayIntersection closest;
+	traverse(m_nodes, ray, infinity, [&](uint32_t id, float) {
+		shared_ptr<Mesh> b = brick(id);
+		if (b) {
+			RayIntersection hit = b->intersect(ray, closest.m_distance);
+			if (hit.m_valid) closest = hit;
+		}
+		return closest.m_distance;
+	});
+	// the brick may not stay loaded
+	if (closest.m_valid) closest.m_shape = this;
+	return closest;
+}
+
+
+void StreamedMesh::intersect(const vector<Ray> &rays, vector<RayIntersection> &hits) {
+	hits.assign(rays.size(), RayIntersection());
+
+	// rays waiting for a brick, with where they reach it
+	struct Deferred {
+		uint32_t ray;
+		float distance;
+	};
+	map<uint32_t, vector<Deferred>> deferred;
+
+	// everything that can be done with the resident bricks
+	for (size_t r = 0; r < rays.size(); r++) {
+		RayIntersection &closest = hits[r];
+		traverse(m_nodes, rays[r], infinity, [&](uint32_t id, float distance) {
+			shared_ptr<Mesh> b = m_cache.find(id);
+			if (b) {
+				RayIntersection hit = b->intersect(rays[r], closest.m_distance);
+				if (hit.m_valid) closest = hit;
+			} else {
+				deferred[id].push_back({ uint32_t(r), distance });
+			}
+			return closest.m_distance;
+		});
+	}
+
+	// then each missing brick once, in file order, for all the rays waiting on it
+	for (auto &waiting : deferred) {
+		shared_ptr<Mesh> b;
+		for (const Deferred &d : waiting.second) {
+			RayIntersection &closest = hits[d.ray];
+			if (d.distance >= closest.m_distance) continue;
+			if (!b) b = brick(waiting.first);
+			if (!b) break;
+			RayIntersection hit = b->intersect(rays[d.ray], closest.m_distance);
+			if (hit.m_valid) closest = hit;
+		}
+	}
+
+	for (RayIntersection &hit : hits) {
+		if (hit.m_valid) hit.m_shape = this;
+	}
+}
+
+
+bool StreamedMesh::write(const Mesh &mesh, const string &filename, uint32_t brick_triangles) {
+	const BVHNode *nodes = mesh.nodes();
+	const uint32_t node_count = mesh.nodeCount();
+
+	// where each subtree ends and its range of triangles (children come after their parents)
+	vector<uint32_t> subtree_end(node_count), first_triangle(node_count), triangle_count(node_count);
+	for (uint32_t n = node_count; n-- > 0;) {
+		const BVHNode &node = nodes[n];
+		if (node.count > 0) {
+			subtree_end[n] = n + 1;
+			first_triangle[n] = node.offset;
+			triangle_count[n] = node.count;
+		} else {
+			subtree_end[n] = subtree_end[node.offset];
+			first_triangle[n] = first_triangle[n + 1];
+			triangle_count[n] = triangle_count[n + 1] + triangle_count[node.offset];
+		}
+	}
+
+	// write to a temporary and swap it in, so a half written file is never used
+	const string temp = filename + ".tmp";
+	ofstream out(temp, ios::binary | ios::trunc);
+	static const char zeros[alignment] = {};
+	out.write(zeros, alignment); // the header, filled in at the end
+	uint64_t written = alignment;
+	auto section = [&](uint64_t offset, const void *data, uint64_t bytes) {
+		out.write(zeros, streamsize(offset - written));
+		out.write(static_cast<const char *>(data), streamsize(bytes));
+		written = offset + bytes;
+	};
+
+	vector<BVHNode> top;
+	vector<BrickRecord> bricks;
+	vector<uint32_t> remap(mesh.vertexCount(), UINT32_MAX);
+	vector<vec3> positions, normals;
+	vector<uint32_t> indices;
+	vector<BVHNode> local_nodes;
+
+	// a subtree with its own copy of the vertices it uses
+	auto writeBrick = [&](uint32_t n) {
+		positions.clear();
+		normals.clear();
+		indices.clear();
+		const uint32_t first = first_triangle[n], count = triangle_count[n];
+		for (size_t i = 3 * size_t(first); i < 3 * size_t(first + count); i++) {
+			const uint32_t v = mesh.indices()[i];
+			if (remap[v] == UINT32_MAX) {
+				remap[v] = uint32_t(positions.size());
+				positions.push_back(mesh.positions()[v]);
+				normals.push_back(mesh.normals()[v]);
+			}
+			indices.push_back(remap[v]);
+		}
+		for (size_t i = 3 * size_t(first); i < 3 * size_t(first + count); i++) remap[mesh.indices()[i]] = UINT32_MAX;
+
+		// the subtree is contiguous, so only its indices need to move
+		local_nodes.assign(nodes + n, nodes + subtree_end[n]);
+		for (BVHNode &l : local_nodes) l.offset -= (l.count > 0) ? first : n;
+
+		BrickRecord b = {};
+		b.offset = align(written);
+		b.vertex_count = uint32_t(positions.size());
+		b.triangle_count = count;
+		b.node_count = uint32_t(local_nodes.size());
+		section(b.offset, positions.data(), positions.size() * sizeof(vec3));
+		section(written, normals.data(), normals.size() * sizeof(vec3));
+		section(written, indices.data(), indices.size() * sizeof(uint32_t));
+		section(written, local_nodes.data(), local_nodes.size() * sizeof(BVHNode));
+		bricks.push_back(b);
+	};
+
+	// the top of the tree, down to subtrees small enough to be bricks
+	function<void(uint32_t)> split = [&](uint32_t n) {
+		const uint32_t index = uint32_t(top.size());
+		top.push_back(nodes[n]);
+		if (nodes[n].count > 0 || triangle_count[n] <= brick_triangles) {
+			top[index].offset = uint32_t(bricks.size());
+			top[index].count = triangle_count[n];
+			writeBrick(n);
+			return;
+		}
+		split(n + 1);
+		top[index].offset = uint32_t(top.size());
+		split(nodes[n].offset);
+	};
+	if (node_count > 0) split(0);
+
+	StreamHeader h = {};
+	memcpy(h.magic, brick_magic, sizeof(brick_magic));
+	h.version = brick_version;
+	h.node_count = uint32_t(top.size());
+	h.brick_count = uint32_t(bricks.size());
+	h.node_offset = align(written);
+	section(h.node_offset, top.data(), top.size() * sizeof(BVHNode));
+	h.brick_offset = align(written);
+	section(h.brick_offset, bricks.data(), bricks.size() * sizeof(BrickRecord));
+	h.file_size = written;
+	out.seekp(0);
+	out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+	out.close();
+	if (!out) return false;
+
+#ifdef _WIN32
+	remove(filename.c_str());
+#endif
+	return rename(temp.c_str(), filename.c_str()) == 0;
+}
+
+
+shared_ptr<StreamedMesh> StreamedMesh::open(const string &filename, size_t budget) {
+	shared_ptr<StreamedMesh> mesh(new StreamedMesh(budget));
+	ifstream &file = mesh->m_file;
+	file.open(filename, ios::binary);
+	StreamHeader h;
+	if (!file || !file.read(reinterpret_cast<char *>(&h), sizeof(h))) {
+		cerr << "Error: Could not open bricked mesh " << filename << endl;
+		return nullptr;
+	}
+
+	file.seekg(0, ios::end);
+	const uint64_t size = uint64_t(file.tellg());
+	if (memcmp(h.magic, brick_magic, sizeof(brick_magic)) != 0 || h.version != brick_version || h.file_size != size
+		|| h.node_offset + uint64_t(h.node_count) * sizeof(BVHNode) > h.brick_offset
+		|| h.brick_offset + uint64_t(h.brick_count) * sizeof(BrickRecord) > h.file_size) {
+		cerr << "Error: " << filename << " is not a bricked mesh file (or a different version)" << endl;
+		return nullptr;
+	}
+
+	// only the top of the tree and the brick table are kept in memory
+	mesh->m_nodes.resize(h.node_count);
+	mesh->m_bricks.resize(h.brick_count);
+	file.seekg(streamoff(h.node_offset));
+	file.read(reinterpret_cast<char *>(mesh->m_nodes.data()), streamsize(h.node_count * sizeof(BVHNode)));
+	file.seekg(streamoff(h.brick_offset));
+	file.read(reinterpret_cast<char *>(mesh->m_bricks.data()), streamsize(h.brick_count * sizeof(BrickRecord)));
+	if (!file) {
+		cerr << "Error: Could not read " << filename << endl;
+		return nullptr;
+	}
+
+	// check the links so traversal stays in bounds
+	for (uint32_t n = 0; n < h.node_count; n++) {
+		const BVHNode &node = mesh->m_nodes[n];
+		bool ok = (node.count > 0) ? node.offset < h.brick_count : (node.offset > n + 1 && node.offset < h.node_count);
+		if (!ok) {
+			cerr << "Error: " << filename << " has a broken node " << n << endl;
+			return nullptr;
+		}
+	}
+	for (const BrickRecord &b : mesh->m_bricks) {
+		if (b.offset + brickBytes(b) > h.node_offset) {
+			cerr << "Error: " << filename << " has a broken brick table" << endl;
+			return nullptr;
+		}
+	}
+	return mesh;
+}
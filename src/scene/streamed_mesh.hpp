@@ -0,0 +1,110 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// project
+#include "mesh.hpp"
+
+
+// Least recently used cache of loaded bricks, bounded by their size
+// in bytes. Bricks that are evicted while in use stay alive until the
+// last user lets go of them.
+class BrickCache {
+public:
+	struct Stats {
+		uint64_t lookups = 0;
+		uint64_t loads = 0;
+		uint64_t bytes_loaded = 0;
+		uint64_t evictions = 0;
+	};
+
+private:
+	struct Entry {
+		std::shared_ptr<Mesh> brick;
+		size_t bytes;
+		std::list<uint32_t>::iterator lru;
+	};
+
+	std::mutex m_lock;
+	std::unordered_map<uint32_t, Entry> m_entries;
+	std::list<uint32_t> m_lru; // most recently used first
+	size_t m_budget;
+	size_t m_resident = 0;
+	Stats m_stats;
+
+public:
+	explicit BrickCache(size_t budget) : m_budget(budget) { }
+
+	// returns nullptr if the brick isn't resident
+	std::shared_ptr<Mesh> find(uint32_t id);
+
+	// adds a loaded brick, evicting the least recently used ones to stay in budget
+	void insert(uint32_t id, std::shared_ptr<Mesh> brick, size_t bytes);
+
+	bool resident(uint32_t id);
+	size_t residentBytes();
+	Stats stats();
+};
+
+
+// Triangle mesh too large to keep in memory, split into bricks (subtrees
+// of its BVH with their own vertices). Only the bounds above the bricks
+// are resident, brick payloads are read from the file when a ray first
+// reaches them and kept in a bounded cache.
+//
+// Rays can be traced one at a time, loading bricks as they are needed,
+// or in batches, where rays that reach a brick that isn't resident are
+// deferred until the other bricks are done and then traced brick by brick,
+// so each brick is read at most once per batch.
+class StreamedMesh : public Shape {
+public:
+	static constexpr size_t default_budget = size_t(256) << 20;
+
+private:
+	struct BrickRecord {
+		uint64_t offset;
+		uint32_t vertex_count, triangle_count, node_count;
+		uint32_t padding;
+	};
+
+	std::vector<BVHNode> m_nodes; // leaves are bricks, with offset as the brick id
+	std::vector<BrickRecord> m_bricks;
+	std::ifstream m_file;
+	std::mutex m_file_lock;
+	BrickCache m_cache;
+
+	StreamedMesh(size_t budget) : m_cache(budget) { }
+
+	std::shared_ptr<Mesh> brick(uint32_t id);
+	std::shared_ptr<Mesh> loadBrick(uint32_t id);
+	static size_t brickBytes(const BrickRecord &brick);
+
+public:
+	virtual RayIntersection intersect(const Ray &ray) override;
+
+	// closest hits for a batch of rays, with deferred loading
+	void intersect(const std::vector<Ray> &rays, std::vector<RayIntersection> &hits);
+
+	uint32_t brickCount() const { return uint32_t(m_bricks.size()); }
+
+	// bytes of all brick payloads together
+	size_t totalBytes() const;
+
+	BrickCache & cache() { return m_cache; }
+
+	// splits a mesh into bricks of at most (about) brick_triangles triangles
+	// and writes them to a file, returns false on failure
+	static bool write(const Mesh &mesh, const std::string &filename, uint32_t brick_triangles = 4096);
+
+	// opens a bricked mesh file with a cache of budget bytes
+	// returns nullptr if it can't be read
+	static std::shared_ptr<StreamedMesh> open(const std::string &filename, size_t budget = default_budget);
+};
@@ -0,0 +1,217 @@
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// glm
+#include <glm/gtc/packing.hpp>
+
+// stb
+#include <stb_image.h>
+
+// project
+#include "texture.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	int wrap(int x, int n) {
+		x %= n;
+		return (x < 0) ? x + n : x;
+	}
+
+	// texel coordinate of a wrapped texture coordinate, without any integer division
+	float wrapCoordinate(float u, int n) {
+		return (u - floor(u)) * n;
+	}
+
+	// half to float with a couple of integer ops (glm's is much slower)
+	float halfToFloat(uint16_t h) {
+		const uint32_t shifted_exponent = 0x7c00u << 13;
+		uint32_t bits = (h & 0x7fffu) << 13;
+		const uint32_t exponent = bits & shifted_exponent;
+		bits += (127 - 15) << 23;
+		float f;
+		if (exponent == shifted_exponent) {
+			bits += (128 - 16) << 23; // inf or nan
+			memcpy(&f, &bits, 4);
+		} else if (exponent == 0) {
+			bits += 1 << 23; // denormal
+			memcpy(&f, &bits, 4);
+			f -= 6.103515625e-05f; // 2^-14
+		} else {
+			memcpy(&f, &bits, 4);
+		}
+		return (h & 0x8000u) ? -f : f;
+	}
+}
+
+
+Texture::Texture(const string &filename, TextureFormat format) : m_format(format) {
+	int w, h, n;
+
+	// stb's flip flag is process-global and textures are decoded in parallel,
+	// so the rows are flipped here instead
+	unsigned char *img = stbi_load(filename.c_str(), &w, &h, &n, 3);
+
+	if (!img) {
+		cerr << "Error: Failed to load image " << filename << " : " << stbi_failure_reason() << endl;
+		throw runtime_error("Failed to load image " + filename);
+	}
+
+	// straight to the float texels the levels are built from, bottom row first
+	vector<vec3> texels(size_t(w) * h);
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < h; y++) {
+		const unsigned char *row = img + 3 * size_t(h - 1 - y) * w;
+		vec3 *out = texels.data() + size_t(y) * w;
+		for (int x = 0; x < w; x++) out[x] = vec3(row[3 * x], row[3 * x + 1], row[3 * x + 2]) / 255.f;
+	}
+	stbi_image_free(img);
+
+	build(w, h, std::move(texels));
+}
+
+
+Texture::Texture(int width, int height, const float *rgb, TextureFormat format) : m_format(format) {
+	if (width < 1 || height < 1) return;
+	vector<vec3> texels(size_t(width) * height);
+	for (size_t i = 0; i < texels.size(); i++) texels[i] = vec3(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+	build(width, height, std::move(texels));
+}
+
+
+void Texture::build(int width, int height, vector<vec3> current) {
+	if (width < 1 || height < 1) return;
+
+	// layout of the levels, each padded to whole tiles
+	size_t texels = 0;
+	for (int w = width, h = height; ; w = std::max(w / 2, 1), h = std::max(h / 2, 1)) {
+		Level level;
+		level.width = w;
+		level.height = h;
+		level.tiles_x = (w + tile_size - 1) / tile_size;
+		level.offset = texels;
+		texels += size_t(level.tiles_x) * ((h + tile_size - 1) / tile_size) * tile_size * tile_size;
+		m_levels.push_back(level);
+		if (w == 1 && h == 1) break;
+	}
+	const size_t texel_bytes = (m_format == TextureFormat::RGBA8) ? 4 : 8;
+	m_data.assign(texels * texel_bytes, 0);
+
+	// each level is a box filter of the one above, done in float
+	// (rows are independent, so large levels are split across threads)
+	vector<vec3> next;
+	for (size_t l = 0; l < m_levels.size(); l++) {
+		const Level &level = m_levels[l];
+#pragma omp parallel for schedule(static) if (level.height >= 64)
+		for (int y = 0; y < level.height; y++) {
+			for (int x = 0; x < level.width; x++) {
+				store(index(level, x, y), current[x + size_t(y) * level.width]);
+			}
+		}
+		if (l + 1 == m_levels.size()) break;
+
+		const Level &smaller = m_levels[l + 1];
+		next.assign(size_t(smaller.width) * smaller.height, vec3(0));
+#pragma omp parallel for schedule(static) if (smaller.height >= 64)
+		for (int y = 0; y < smaller.height; y++) {
+			for (int x = 0; x < smaller.width; x++) {
+				// odd sizes (and 1 texel wide levels) reuse the last row or column
+				int x0 = std::min(2 * x, level.width - 1), x1 = std::min(2 * x + 1, level.width - 1);
+				int y0 = std::min(2 * y, level.height - 1), y1 = std::min(2 * y + 1, level.height - 1);
+				next[x + size_t(y) * smaller.width] = 0.25f * (
+					current[x0 + size_t(y0) * level.width] + current[x1 + size_t(y0) * level.width] +
+					current[x0 + size_t(y1) * level.width] + current[x1 + size_t(y1) * level.width]);
+			}
+		}
+		swap(current, next);
+	}
+}
+
+
+size_t Texture::index(const Level &level, int x, int y) const {
+	// x and y are never negative, so the tile is found with shifts and masks
+	const size_t tile = size_t(y >> tile_shift) * level.tiles_x + (x >> tile_shift);
+	return level.offset + (tile << (2 * tile_shift)) + ((y & (tile_size - 1)) << tile_shift) + (x & (tile_size - 1));
+}
+
+
+void Texture::store(size_t texel, const vec3 &color) {
+	if (m_format == TextureFormat::RGBA8) {
+		uint32_t packed = packUnorm4x8(vec4(color, 1));
+		memcpy(&m_data[texel * 4], &packed, 4);
+	} else {
+		uint64_t packed = packHalf4x16(vec4(color, 1));
+		memcpy(&m_data[texel * 8], &packed, 8);
+	}
+}
+
+
+vec3 Texture::load(size_t texel) const {
+	// all channels at once
+	if (m_format == TextureFormat::RGBA8) {
+		uint32_t packed;
+		memcpy(&packed, &m_data[texel * 4], 4);
+		return vec3(unpackUnorm4x8(packed));
+	}
+	uint16_t packed[4];
+	memcpy(packed, &m_data[texel * 8], 8);
+	return vec3(halfToFloat(packed[0]), halfToFloat(packed[1]), halfToFloat(packed[2]));
+}
+
+
+vec3 Texture::texel(int x, int y, int level) const {
+	if (m_levels.empty()) return vec3(0);
+	const Level &l = m_levels[glm::clamp(level, 0, int(m_levels.size()) - 1)];
+	return load(index(l, wrap(x, l.width), wrap(y, l.height)));
+}
+
+
+vec3 Texture::sampleNearest(const vec2 &uv) const {
+	if (m_levels.empty()) return vec3(0);
+	const Level &l = m_levels[0];
+	const int x = std::min(int(wrapCoordinate(uv.x, l.width)), l.width - 1);
+	const int y = std::min(int(wrapCoordinate(uv.y, l.height)), l.height - 1);
+	return load(index(l, x, y));
+}
+
+
+vec3 Texture::bilinear(int level, const vec2 &uv) const {
+	if (m_levels.empty()) return vec3(0);
+	const Level &l = m_levels[level];
+
+	// texel centers are at half integers
+	const float fx = wrapCoordinate(uv.x, l.width) - 0.5f, fy = wrapCoordinate(uv.y, l.height) - 0.5f;
+	const float bx = floor(fx), by = floor(fy);
+	const float tx = fx - bx, ty = fy - by;
+
+	// in [-1, size], only the edges need to wrap
+	int x0 = int(bx), y0 = int(by);
+	x0 = (x0 < 0) ? l.width - 1 : std::min(x0, l.width - 1);
+	y0 = (y0 < 0) ? l.height - 1 : std::min(y0, l.height - 1);
+	const int x1 = (x0 + 1 < l.width) ? x0 + 1 : 0, y1 = (y0 + 1 < l.height) ? y0 + 1 : 0;
+
+	vec3 bottom = mix(load(index(l, x0, y0)), load(index(l, x1, y0)), tx);
+	vec3 top = mix(load(index(l, x0, y1)), load(index(l, x1, y1)), tx);
+	return mix(bottom, top, ty);
+}
+
+
+vec3 Texture::sample(const vec2 &uv, float width) const {
+	if (m_levels.empty()) return vec3(0);
+
+	// the level where the footprint is about a texel
+	const float texels = width * std::max(m_levels[0].width, m_levels[0].height);
+	const float lod = glm::clamp(log2(std::max(texels, 1.f)), 0.f, float(m_levels.size() - 1));
+	const int level = int(lod);
+	const float t = lod - level;
+	if (t == 0 || level + 1 >= int(m_levels.size())) return bilinear(level, uv);
+	return mix(bilinear(level, uv), bilinear(level + 1, uv), t);
+}
@@ -1,77 +1,82 @@
-
 #pragma once
 
 // std
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 // glm
 #include <glm/glm.hpp>
 
-// stb
-#include <stb_image.h>
+
+// how texels are stored, both padded to 4 channels so a
+// texel is a single aligned load
+enum class TextureFormat {
+	RGBA8, // 4 bytes per texel, values in [0, 1]
+	RGBA16F // 8 bytes per texel, half floats
+};
 
 
+// Mipmapped texture. Every level is stored in 8x8 texel tiles (so the
+// texels a filter touches are usually in the same cache lines), and
+// coordinates wrap around.
 class Texture {
 private:
-	glm::ivec2 m_size{0,0};
-	std::vector<float> m_data;
+	static constexpr int tile_shift = 3;
+	static constexpr int tile_size = 1 << tile_shift;
+
+	struct Level {
+		int width = 0, height = 0;
+		int tiles_x = 0;
+		size_t offset = 0; // of the first texel
+	};
+
+	TextureFormat m_format = TextureFormat::RGBA8;
+	std::vector<Level> m_levels;
+	std::vector<uint8_t> m_data; // texels of all levels
+
+	void build(int width, int height, std::vector<glm::vec3> current);
+	void store(size_t texel, const glm::vec3 &color);
+	glm::vec3 load(size_t texel) const;
+	size_t index(const Level &level, int x, int y) const;
+	glm::vec3 bilinear(int level, const glm::vec2 &uv) const;
 
 public:
-	Texture() {}
+	Texture() { }
 
 	// create a texture from a file
 	// supports JPEG, PNG, TGA, BMP and a few others
-	Texture(const std::string &filename) {
-		int w, h, n;
-
-		stbi_set_flip_vertically_on_load(true);
-		unsigned char *img = stbi_load(filename.c_str(), &w, &h, &n, 3);
-
-		if (!img) {
-			std::cerr << "Error: Failed to load image " << filename << " : " << stbi_failure_reason();
-			throw std::runtime_error("Failed to load image " + filename);
-		}
-
-		m_data = std::vector<float>(w * h * 3);
-		for (int i = 0; i < w * h * 3; i++)
-			m_data[i] = img[i] / 255.f;
-		m_size = glm::ivec2(w, h);
-		stbi_image_free(img);
-	}
+	// throws a runtime_error if the file can't be read
+	Texture(const std::string &filename, TextureFormat format = TextureFormat::RGBA8);
 
+	// create a texture from linear rows of rgb floats (bottom row first)
+	Texture(int width, int height, const float *rgb, TextureFormat format = TextureFormat::RGBA8);
 
-	// fetch the value of a single channel of a texel
-	float texel(float x, float y, int n) const {
-		// wrap coordinates
-		int mx = int(glm::floor(x)) % m_size.x;
-		mx += (mx < 0) ? m_size.x : 0;
+	glm::ivec2 size() const { return m_levels.empty() ? glm::ivec2(0) : glm::ivec2(m_levels[0].width, m_levels[0].height); }
+	int levels() const { return int(m_levels.size()); }
+	TextureFormat format() const { return m_format; }
 
-		int my = int(glm::floor(y)) % m_size.y;
-		my += (my < 0) ? m_size.y : 0;
-		
-		// fetch
-		return m_data.at(n + (mx + my*m_size.x)*3);
-	}
+	// memory used by all the levels
+	size_t bytes() const { return m_data.size(); }
 
-	// fetch the value of a single channel of a texel
-	float texel(const glm::ivec2 &p, int n) const {
-		return texel(float(p.x), float(p.y), n);
-	}
+	// a single texel of a level, with wrapping
+	glm::vec3 texel(int x, int y, int level = 0) const;
 
-	// sample given a range of uv in [0, 1]^2
+	// nearest texel given a range of uv in [0, 1]^2
 	// provides wrapping for values outside that range
-	glm::vec3 sample(float u, float v) const {
-		float x = u * m_size.x + 0.5f;
-		float y = v * m_size.y + 0.5f;
-		return glm::vec3(texel(x, y, 0), texel(x, y, 1), texel(x, y, 2));
-	}
+	glm::vec3 sampleNearest(const glm::vec2 &uv) const;
 
-	// sample given a range of uv in [0, 1]^2
-	// provides wrapping for values outside that range
-	glm::vec3 sample(const glm::vec2 &uv) const {
-		glm::vec2 p = uv * glm::vec2(m_size) + glm::vec2(0.5f);
-		return glm::vec3(texel(p, 0), texel(p, 1), texel(p, 2));
+	// bilinear filtering of the full resolution level
+	glm::vec3 sample(const glm::vec2 &uv) const { return bilinear(0, uv); }
+	glm::vec3 sample(float u, float v) const { return bilinear(0, glm::vec2(u, v)); }
+
+	// trilinear filtering for a footprint of width (in uv units) on the surface
+	glm::vec3 sample(const glm::vec2 &uv, float width) const;
+
+	// trilinear filtering for the footprint given by uv derivatives
+	// (from a ray intersection), the base level if they are zero
+	glm::vec3 sample(const glm::vec2 &uv, const glm::vec2 &duvdx, const glm::vec2 &duvdy) const {
+		return sample(uv, std::max(glm::length(duvdx), glm::length(duvdy)));
 	}
-};
\ No newline at end of file
+};
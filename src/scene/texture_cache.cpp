@@ -0,0 +1,133 @@
+
+// std
+#include <stdexcept>
+
+// project
+#include "texture_cache.hpp"
+
+
+using namespace std;
+
+
+namespace {
+
+	// the same file spelt differently ("a//b", "./a\\b") gets the same key
+	string normalize(const string &filename) {
+		string key;
+		key.reserve(filename.size());
+		for (char c : filename) {
+			if (c == '\\') c = '/';
+			if (c == '/' && !key.empty() && key.back() == '/') continue;
+			key += c;
+		}
+		while (key.size() > 2 && key.compare(0, 2, "./") == 0) key.erase(0, 2);
+		return key;
+	}
+}
+
+
+TextureCache & TextureCache::global() {
+	static TextureCache cache;
+	return cache;
+}
+
+
+shared_ptr<const Texture> TextureCache::get(const string &filename) {
+	const string key = normalize(filename);
+	promise<shared_ptr<const Texture>> decoded;
+	Future future;
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_stats.lookups++;
+		auto it = m_entries.find(key);
+		if (it != m_entries.end()) {
+			m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+			future = it->second.texture;
+		} else {
+			// this thread decodes it, anyone else asking in the meantime waits
+			m_lru.push_front(key);
+			m_entries[key] = { decoded.get_future().share(), 0, m_lru.begin() };
+		}
+	}
+	if (future.valid()) return future.get();
+
+	shared_ptr<const Texture> texture;
+	try {
+		texture = make_shared<Texture>(key, m_format);
+	} catch (runtime_error &) { }
+	decoded.set_value(texture);
+
+	lock_guard<mutex> guard(m_lock);
+	auto it = m_entries.find(key);
+	if (it == m_entries.end()) return texture; // cleared while decoding
+
+	if (!texture) {
+		// not kept, so the file is tried again next time
+		m_lru.erase(it->second.lru);
+		m_entries.erase(it);
+		return nullptr;
+	}
+
+	m_stats.decodes++;
+	m_stats.bytes_decoded += texture->bytes();
+	it->second.bytes = texture->bytes();
+	m_resident += texture->bytes();
+	evict();
+	return texture;
+}
+
+
+void TextureCache::preload(const vector<string> &filenames) {
+	// duplicates wait on the first decode rather than repeating it
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int i = 0; i < int(filenames.size()); i++) get(filenames[i]);
+}
+
+
+void TextureCache::evict() {
+	// from the least recently used, skipping textures still being decoded
+	// (the most recently used one is always kept)
+	auto it = m_lru.end();
+	while (m_resident > m_budget && it != m_lru.begin() && --it != m_lru.begin()) {
+		auto entry = m_entries.find(*it);
+		if (entry->second.bytes == 0) continue;
+		m_resident -= entry->second.bytes;
+		m_entries.erase(entry);
+		it = m_lru.erase(it);
+		m_stats.evictions++;
+	}
+}
+
+
+void TextureCache::setBudget(size_t budget) {
+	lock_guard<mutex> guard(m_lock);
+	m_budget = budget;
+	evict();
+}
+
+
+void TextureCache::clear() {
+	lock_guard<mutex> guard(m_lock);
+	m_entries.clear();
+	m_lru.clear();
+	m_resident = 0;
+}
+
+
+bool TextureCache::resident(const string &filename) {
+	lock_guard<mutex> guard(m_lock);
+	auto it = m_entries.find(normalize(filename));
+	return it != m_entries.end() && it->second.bytes > 0;
+}
+
+
+size_t TextureCache::residentBytes() {
+	lock_guard<mutex> guard(m_lock);
+	return m_resident;
+}
+
+
+TextureCache::Stats TextureCache::stats() {
+	lock_guard<mutex> guard(m_lock);
+	return m_stats;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// project
+#include "texture.hpp"
+
+
+// Cache of textures loaded from files, keyed by path. A file is decoded the
+// first time it is asked for and then shared by everyone who uses it; threads
+// asking for a texture that is being decoded wait for that decode instead of
+// starting another. Decoded textures are kept within a budget in bytes, least
+// recently used first out. Evicted textures stay alive until their last user
+// lets go of them and are decoded again if asked for later.
+class TextureCache {
+public:
+	static constexpr size_t default_budget = size_t(1) << 30;
+
+	struct Stats {
+		uint64_t lookups = 0;
+		uint64_t decodes = 0;
+		uint64_t bytes_decoded = 0;
+		uint64_t evictions = 0;
+	};
+
+private:
+	using Future = std::shared_future<std::shared_ptr<const Texture>>;
+
+	struct Entry {
+		Future texture;
+		size_t bytes; // 0 while decoding
+		std::list<std::string>::iterator lru;
+	};
+
+	std::mutex m_lock;
+	std::unordered_map<std::string, Entry> m_entries;
+	std::list<std::string> m_lru; // most recently used first
+	size_t m_budget;
+	size_t m_resident = 0;
+	TextureFormat m_format;
+	Stats m_stats;
+
+	void evict();
+
+public:
+	explicit TextureCache(size_t budget = default_budget, TextureFormat format = TextureFormat::RGBA8)
+		: m_budget(budget), m_format(format) { }
+
+	// the cache shared by the whole process
+	static TextureCache & global();
+
+	// the texture of a file, decoded on first use
+	// returns nullptr if it can't be read
+	std::shared_ptr<const Texture> get(const std::string &filename);
+
+	// decodes files ahead of their first use, in parallel
+	void preload(const std::vector<std::string> &filenames);
+
+	// evicts textures if the budget shrinks
+	void setBudget(size_t budget);
+
+	// drops every texture (ones in use stay alive with their users)
+	void clear();
+
+	bool resident(const std::string &filename);
+	size_t residentBytes();
+	Stats stats();
+};